@@ -110,7 +110,7 @@ function setup_nvgt {
 	if ! which scons &> /dev/null; then
 		pip3 install scons
 	fi
-	scons -s no_upx=0
+	scons -s no_upx=0 no_opus=0 no_zstd=0
 	echo NVGT built.
 }
 
@@ -124,7 +124,7 @@ function main {
 	cd deps
 	
 	# Insure required packages are installed for building.
-	sudo apt install build-essential gcc g++ make cmake autoconf libtool python3 python3-pip libssl-dev libsystemd-dev libspeechd-dev libogg-dev libvorbis-dev python3-venv -y
+	sudo apt install build-essential gcc g++ make cmake autoconf libtool python3 python3-pip libssl-dev libsystemd-dev libspeechd-dev libogg-dev libopus-dev libvorbis-dev libzstd-dev python3-venv -y
 	
 	setup_angelscript
 	setup_reactphysics
@@ -0,0 +1,372 @@
+/* http_server.cpp - multithreaded HTTP server with script routes
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <Poco/Exception.h>
+#include <Poco/String.h>
+#include <Poco/ThreadPool.h>
+#include <Poco/URI.h>
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+#include <Poco/Net/HTTPServer.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/SocketAddress.h>
+#include "http_server.h"
+#include "nvgt.h" // g_ScriptEngine
+#include "pocostuff.h" // angelscript_refcounted, poco_json_object
+
+using namespace std;
+using namespace Poco;
+using namespace Poco::Net;
+
+const char* http_server_text_type = "text/plain; charset=utf-8";
+
+HTTPRequest* http_server_request::get_headers() const {
+	HTTPRequest* r = angelscript_refcounted_factory<HTTPRequest, const string&, const string&, const string&>(request.getMethod(), request.getURI(), request.getVersion());
+	for (const auto& header : request) r->add(header.first, header.second);
+	return r;
+}
+string http_server_request::get_header(const string& name, const string& default_value) const { return request.get(name, default_value); }
+void http_server_request::respond(HTTPResponse::HTTPStatus status, const string& body, const string& content_type) {
+	response.setStatusAndReason(status);
+	response.setContentType(content_type);
+	response_body = body;
+}
+void http_server_request::set_header(const string& name, const string& value) { response.set(name, value); }
+
+class http_server_handler : public HTTPRequestHandler {
+	http_server* owner;
+public:
+	http_server_handler(http_server* owner) : owner(owner) {}
+	void handleRequest(HTTPServerRequest& req, HTTPServerResponse& resp) override { owner->handle(req, resp); }
+};
+class http_server_handler_factory : public HTTPRequestHandlerFactory {
+	http_server* owner;
+public:
+	http_server_handler_factory(http_server* owner) : owner(owner) {}
+	HTTPRequestHandler* createRequestHandler(const HTTPServerRequest&) override { return new http_server_handler(owner); }
+};
+
+static void send_response(HTTPServerResponse& resp, HTTPResponse::HTTPStatus status, const string& body, const string& content_type = http_server_text_type) {
+	resp.setStatusAndReason(status);
+	resp.setContentType(content_type);
+	resp.setContentLength(body.size());
+	resp.send() << body;
+}
+
+// On a kept alive connection Poco reads the next request from wherever this one's body was left, so a response sent without reading the body must read the rest of it first or close the connection. Bodies up to limit are skipped, anything longer closes the connection instead.
+static void discard_body(HTTPServerRequest& req, HTTPServerResponse& resp, unsigned int limit) {
+	if (!req.hasContentLength() && !req.getChunkedTransferEncoding()) return;
+	if (req.hasContentLength() && req.getContentLength64() > limit) {
+		resp.setKeepAlive(false);
+		return;
+	}
+	istream& in = req.stream();
+	char buffer[8192];
+	unsigned long long total = 0;
+	while (in) {
+		in.read(buffer, sizeof(buffer));
+		total += in.gcount();
+		if (total > limit) {
+			resp.setKeepAlive(false);
+			return;
+		}
+	}
+}
+
+http_server::http_server() : running(nullptr), stopping(false), threads(nullptr), server(nullptr), port(0), script_timeout(10000), max_body_size(1024 * 1024) {}
+http_server::~http_server() {
+	stop();
+	clear_routes();
+}
+
+bool http_server::start(unsigned short port, const string& address, int max_threads, int max_queued) {
+	if (server || max_threads < 1) return false;
+	try {
+		ServerSocket socket(address.empty()? SocketAddress(port) : SocketAddress(address, port));
+		HTTPServerParams::Ptr params = new HTTPServerParams();
+		params->setMaxThreads(max_threads);
+		params->setMaxQueued(max_queued);
+		params->setKeepAlive(true);
+		threads = new ThreadPool("http_server", 1, max_threads + 1); // The dispatcher takes a thread of its own.
+		server = new HTTPServer(new http_server_handler_factory(this), *threads, socket, params);
+		server->start();
+		this->port = socket.address().port();
+	} catch (Exception&) {
+		delete server;
+		server = nullptr;
+		delete threads;
+		threads = nullptr;
+		return false;
+	}
+	return true;
+}
+// Answers everything the script hasn't gotten to, so that no server thread is left waiting on it. Must be called with queue_mutex held.
+void http_server::abort_queue() {
+	for (http_server_request* r : queue) {
+		if (!r->abandoned) r->respond(HTTPResponse::HTTP_SERVICE_UNAVAILABLE, "Service Unavailable", http_server_text_type);
+		r->done.set();
+		r->callback->Release();
+		r->callback = nullptr;
+		r->release();
+	}
+	queue.clear();
+}
+void http_server::stop() {
+	if (!server) return;
+	{
+		FastMutex::ScopedLock lock(queue_mutex);
+		stopping = true;
+		abort_queue();
+		if (running) {
+			// stop was called from a route callback, and the server thread waiting on that request would otherwise hold up joinAll below until it timed out.
+			running->respond(HTTPResponse::HTTP_SERVICE_UNAVAILABLE, "Service Unavailable", http_server_text_type);
+			running->done.set();
+		}
+	}
+	server->stopAll(true);
+	threads->joinAll();
+	delete server;
+	server = nullptr;
+	delete threads;
+	threads = nullptr;
+	FastMutex::ScopedLock lock(queue_mutex);
+	abort_queue(); // Requests that arrived while we were stopping, already answered by their threads.
+	stopping = false;
+}
+
+void http_server::add_route(const string& method, const string& path, asIScriptFunction* callback, const string& body, const string& content_type, HTTPResponse::HTTPStatus status) {
+	route r {method == "*"? "" : method, path, !path.empty() && path.back() == '*', callback, body, content_type, status};
+	if (r.prefix) r.path.pop_back();
+	ScopedWriteRWLock lock(routes_lock);
+	for (route& existing : routes) {
+		if (existing.method != r.method || existing.path != r.path || existing.prefix != r.prefix) continue;
+		if (existing.callback) existing.callback->Release();
+		existing = r;
+		return;
+	}
+	routes.push_back(r);
+}
+void http_server::route_script(const string& method, const string& path, asIScriptFunction* callback) {
+	if (!callback) return;
+	add_route(method, path, callback, "", "", HTTPResponse::HTTP_OK); // The route takes over the reference the script passed in.
+}
+void http_server::route_static(const string& method, const string& path, const string& body, const string& content_type, HTTPResponse::HTTPStatus status) {
+	add_route(method, path, nullptr, body, content_type, status);
+}
+bool http_server::remove_route(const string& method, const string& path) {
+	string m = method == "*"? "" : method, p = path;
+	bool prefix = !p.empty() && p.back() == '*';
+	if (prefix) p.pop_back();
+	ScopedWriteRWLock lock(routes_lock);
+	for (auto it = routes.begin(); it != routes.end(); ++it) {
+		if (it->method != m || it->path != p || it->prefix != prefix) continue;
+		if (it->callback) it->callback->Release();
+		routes.erase(it);
+		return true;
+	}
+	return false;
+}
+void http_server::clear_routes() {
+	ScopedWriteRWLock lock(routes_lock);
+	for (route& r : routes) {
+		if (r.callback) r.callback->Release();
+	}
+	routes.clear();
+}
+// An exact path beats a prefix, and a longer prefix beats a shorter one. Must be called with routes_lock held.
+const http_server::route* http_server::find_route(const string& method, const string& path) const {
+	const route* best = nullptr;
+	for (const route& r : routes) {
+		if (!r.method.empty() && r.method != method) continue;
+		if (!r.prefix) {
+			if (r.path == path) return &r;
+			continue;
+		}
+		if (path.compare(0, r.path.size(), r.path) != 0) continue;
+		if (!best || r.path.size() > best->path.size()) best = &r;
+	}
+	return best;
+}
+
+void http_server::handle(HTTPServerRequest& req, HTTPServerResponse& resp) {
+	string path, query;
+	try {
+		URI uri(req.getURI());
+		path = uri.getPath();
+		query = uri.getRawQuery();
+	} catch (Exception&) {
+		discard_body(req, resp, max_body_size);
+		send_response(resp, HTTPResponse::HTTP_BAD_REQUEST, "Bad Request");
+		return;
+	}
+	asIScriptFunction* callback = nullptr;
+	HTTPResponse::HTTPStatus status = HTTPResponse::HTTP_NOT_FOUND;
+	string body = "Not Found", content_type = http_server_text_type;
+	{
+		ScopedReadRWLock lock(routes_lock);
+		const route* found = find_route(req.getMethod(), path);
+		if (found && found->callback) {
+			callback = found->callback;
+			callback->AddRef();
+		} else if (found) {
+			status = found->status;
+			body = found->body;
+			content_type = found->content_type;
+		}
+	}
+	if (!callback) {
+		discard_body(req, resp, max_body_size); // Not while holding the routes, since it waits on the client.
+		send_response(resp, status, body, content_type);
+		return;
+	}
+	http_server_request* r = new http_server_request();
+	r->callback = callback;
+	r->request.setMethod(req.getMethod());
+	r->request.setURI(req.getURI());
+	r->request.setVersion(req.getVersion());
+	for (const auto& header : req) r->request.add(header.first, header.second);
+	r->method = req.getMethod();
+	r->uri = req.getURI();
+	r->path = path;
+	r->query = query;
+	r->client_address = req.clientAddress().toString();
+	r->respond(HTTPResponse::HTTP_NO_CONTENT, "", http_server_text_type); // Unless the script says otherwise.
+	unsigned int max_body = max_body_size;
+	bool too_large = req.hasContentLength() && req.getContentLength64() > max_body;
+	if (!too_large) {
+		istream& in = req.stream();
+		char buffer[8192];
+		while (in && !too_large) {
+			in.read(buffer, sizeof(buffer));
+			r->body.append(buffer, in.gcount());
+			too_large = r->body.size() > max_body;
+		}
+	}
+	bool abandoned;
+	{
+		// Even a request we won't run goes through the queue, so that its callback is only ever released on the script thread.
+		FastMutex::ScopedLock lock(queue_mutex);
+		abandoned = too_large || stopping;
+		r->abandoned = abandoned;
+		r->duplicate();
+		queue.push_back(r);
+	}
+	if (too_large) {
+		resp.setKeepAlive(false); // The rest of the body is still unread.
+		send_response(resp, HTTPResponse::HTTP_REQUEST_ENTITY_TOO_LARGE, "Request Entity Too Large");
+	}
+	else if (abandoned) send_response(resp, HTTPResponse::HTTP_SERVICE_UNAVAILABLE, "Service Unavailable");
+	else if (!r->done.tryWait(script_timeout)) {
+		r->abandoned = true;
+		send_response(resp, HTTPResponse::HTTP_GATEWAY_TIMEOUT, "Gateway Timeout");
+	} else {
+		resp.setStatusAndReason(r->response.getStatus(), r->response.getReason());
+		for (const auto& header : r->response) {
+			if (icompare(header.first, HTTPMessage::CONTENT_LENGTH) != 0) resp.set(header.first, header.second);
+		}
+		resp.setContentLength(r->response_body.size());
+		resp.send() << r->response_body;
+	}
+	r->release();
+}
+
+void http_server::call_script(http_server_request* r) {
+	asIScriptContext* ACtx = asGetActiveContext();
+	bool new_context = ACtx == NULL || ACtx->PushState() < 0;
+	asIScriptContext* ctx = (new_context ? g_ScriptEngine->RequestContext() : ACtx);
+	int result = asERROR;
+	if (ctx && ctx->Prepare(r->callback) >= 0) {
+		ctx->SetArgObject(0, r);
+		result = ctx->Execute();
+	}
+	if (ctx) {
+		if (new_context) g_ScriptEngine->ReturnContext(ctx);
+		else ctx->PopState();
+	}
+	if (result != asEXECUTION_FINISHED) {
+		r->response.clear();
+		r->respond(HTTPResponse::HTTP_INTERNAL_SERVER_ERROR, "Internal Server Error", http_server_text_type);
+	}
+}
+// Runs the callbacks of queued script routes on the calling thread, up to max of them if max isn't 0. Returns how many requests were handled.
+unsigned int http_server::update(unsigned int max) {
+	unsigned int handled = 0;
+	while (!max || handled < max) {
+		http_server_request* r;
+		{
+			FastMutex::ScopedLock lock(queue_mutex);
+			if (queue.empty()) break;
+			r = queue.front();
+			queue.pop_front();
+			running = r;
+		}
+		if (!r->abandoned) call_script(r);
+		{
+			FastMutex::ScopedLock lock(queue_mutex);
+			running = nullptr;
+		}
+		r->done.set();
+		r->callback->Release();
+		r->callback = nullptr;
+		r->release();
+		handled++;
+	}
+	return handled;
+}
+unsigned int http_server::get_pending() const {
+	FastMutex::ScopedLock lock(queue_mutex);
+	return queue.size();
+}
+
+template <class T> void http_server_route_json(http_server* s, const string& method, const string& path, const T* body, HTTPResponse::HTTPStatus status) {
+	s->route_static(method, path, body? body->stringify() : "null", "application/json", status);
+}
+http_server* http_server_factory() { return new http_server(); }
+void RegisterHTTPServer(asIScriptEngine* engine) {
+	engine->RegisterObjectType("http_server_request", 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour("http_server_request", asBEHAVE_ADDREF, "void f()", asMETHODPR(http_server_request, duplicate, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour("http_server_request", asBEHAVE_RELEASE, "void f()", asMETHODPR(http_server_request, release, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectProperty("http_server_request", "const string method", asOFFSET(http_server_request, method));
+	engine->RegisterObjectProperty("http_server_request", "const string uri", asOFFSET(http_server_request, uri));
+	engine->RegisterObjectProperty("http_server_request", "const string path", asOFFSET(http_server_request, path));
+	engine->RegisterObjectProperty("http_server_request", "const string query", asOFFSET(http_server_request, query));
+	engine->RegisterObjectProperty("http_server_request", "const string body", asOFFSET(http_server_request, body));
+	engine->RegisterObjectProperty("http_server_request", "const string client_address", asOFFSET(http_server_request, client_address));
+	engine->RegisterObjectMethod("http_server_request", "http_request@ get_headers() const property", asMETHOD(http_server_request, get_headers), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server_request", "string get_header(const string&in name, const string&in default_value = \"\") const", asMETHOD(http_server_request, get_header), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server_request", "void respond(http_status status, const string&in body = \"\", const string&in content_type = \"text/plain; charset=utf-8\")", asMETHOD(http_server_request, respond), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server_request", "void set_header(const string&in name, const string&in value)", asMETHOD(http_server_request, set_header), asCALL_THISCALL);
+	engine->RegisterFuncdef("void http_route_callback(http_server_request@ request)");
+	engine->RegisterObjectType("http_server", 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour("http_server", asBEHAVE_FACTORY, "http_server@ f()", asFUNCTION(http_server_factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour("http_server", asBEHAVE_ADDREF, "void f()", asMETHODPR(http_server, duplicate, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour("http_server", asBEHAVE_RELEASE, "void f()", asMETHODPR(http_server, release, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "bool start(uint16 port, const string&in address = \"\", int max_threads = 8, int max_queued = 64)", asMETHOD(http_server, start), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "void stop()", asMETHOD(http_server, stop), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "bool get_active() const property", asMETHOD(http_server, is_active), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "uint16 get_port() const property", asMETHOD(http_server, get_port), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "void route(const string&in method, const string&in path, http_route_callback@ callback)", asMETHOD(http_server, route_script), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "void route_static(const string&in method, const string&in path, const string&in body, const string&in content_type = \"text/plain; charset=utf-8\", http_status status = HTTP_OK)", asMETHOD(http_server, route_static), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "void route_json(const string&in method, const string&in path, const json_object@+ body, http_status status = HTTP_OK)", asFUNCTION(http_server_route_json<poco_json_object>), asCALL_CDECL_OBJFIRST);
+	engine->RegisterObjectMethod("http_server", "void route_json(const string&in method, const string&in path, const json_array@+ body, http_status status = HTTP_OK)", asFUNCTION(http_server_route_json<poco_json_array>), asCALL_CDECL_OBJFIRST);
+	engine->RegisterObjectMethod("http_server", "bool remove_route(const string&in method, const string&in path)", asMETHOD(http_server, remove_route), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "void clear_routes()", asMETHOD(http_server, clear_routes), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "uint update(uint max = 0)", asMETHOD(http_server, update), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "uint get_pending() const property", asMETHOD(http_server, get_pending), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "uint get_script_timeout() const property", asMETHOD(http_server, get_script_timeout), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "void set_script_timeout(uint ms) property", asMETHOD(http_server, set_script_timeout), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "uint get_max_body_size() const property", asMETHOD(http_server, get_max_body_size), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_server", "void set_max_body_size(uint size) property", asMETHOD(http_server, set_max_body_size), asCALL_THISCALL);
+}
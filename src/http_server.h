@@ -0,0 +1,97 @@
+/* http_server.h - multithreaded HTTP server with script routes
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+#include <angelscript.h>
+#include <Poco/Event.h>
+#include <Poco/Mutex.h>
+#include <Poco/RefCountedObject.h>
+#include <Poco/RWLock.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+
+namespace Poco {
+	class ThreadPool;
+	namespace Net {
+		class HTTPServer;
+		class HTTPServerRequest;
+		class HTTPServerResponse;
+	}
+}
+
+// A request waiting for a script route to answer it. A server thread fills it in and queues it, the script answers it from http_server::update on its own thread, and the server thread then sends the answer.
+class http_server_request : public Poco::RefCountedObject {
+public:
+	Poco::Net::HTTPRequest request; // Method, URI and headers.
+	std::string method, uri, path, query, body, client_address;
+	Poco::Net::HTTPResponse response;
+	std::string response_body;
+	asIScriptFunction* callback; // Referenced, released on the script thread once the request has been handled.
+	Poco::Event done;
+	std::atomic<bool> abandoned; // The server thread gave up waiting, so the script shouldn't bother.
+	http_server_request() : callback(nullptr), abandoned(false) {}
+	Poco::Net::HTTPRequest* get_headers() const;
+	std::string get_header(const std::string& name, const std::string& default_value) const;
+	void respond(Poco::Net::HTTPResponse::HTTPStatus status, const std::string& body, const std::string& content_type);
+	void set_header(const std::string& name, const std::string& value);
+};
+
+// Wraps Poco's HTTPServer. Static and JSON routes are answered on the server's worker threads without touching the script, and only script routes are queued for the script thread.
+class http_server : public Poco::RefCountedObject {
+	struct route {
+		std::string method, path; // An empty method matches any. A path ending in * matches everything that starts with the rest of it.
+		bool prefix;
+		asIScriptFunction* callback; // Null for static routes.
+		std::string body, content_type;
+		Poco::Net::HTTPResponse::HTTPStatus status;
+	};
+	mutable Poco::RWLock routes_lock;
+	std::vector<route> routes;
+	mutable Poco::FastMutex queue_mutex;
+	std::deque<http_server_request*> queue;
+	http_server_request* running; // The request whose callback update is running, if any.
+	bool stopping;
+	Poco::ThreadPool* threads;
+	Poco::Net::HTTPServer* server;
+	unsigned short port;
+	void add_route(const std::string& method, const std::string& path, asIScriptFunction* callback, const std::string& body, const std::string& content_type, Poco::Net::HTTPResponse::HTTPStatus status);
+	const route* find_route(const std::string& method, const std::string& path) const;
+	std::atomic<unsigned int> script_timeout, max_body_size;
+	void call_script(http_server_request* r);
+	void abort_queue();
+public:
+	http_server();
+	~http_server();
+	bool start(unsigned short port, const std::string& address, int max_threads, int max_queued);
+	void stop();
+	bool is_active() const { return server != nullptr; }
+	unsigned short get_port() const { return server ? port : 0; }
+	void route_script(const std::string& method, const std::string& path, asIScriptFunction* callback);
+	void route_static(const std::string& method, const std::string& path, const std::string& body, const std::string& content_type, Poco::Net::HTTPResponse::HTTPStatus status);
+	bool remove_route(const std::string& method, const std::string& path);
+	void clear_routes();
+	unsigned int update(unsigned int max);
+	unsigned int get_pending() const;
+	unsigned int get_script_timeout() const { return script_timeout; }
+	void set_script_timeout(unsigned int ms) { script_timeout = ms; }
+	unsigned int get_max_body_size() const { return max_body_size; }
+	void set_max_body_size(unsigned int size) { max_body_size = size; }
+	// Called on a server thread for every request.
+	void handle(Poco::Net::HTTPServerRequest& req, Poco::Net::HTTPServerResponse& resp);
+};
+
+void RegisterHTTPServer(asIScriptEngine* engine);
@@ -11,15 +11,28 @@
 */
 
 #include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
 #include <string>
 #include <obfuscate.h>
+#include <Poco/AutoPtr.h>
+#include <Poco/BufferedStreamBuf.h>
+#include <Poco/DigestEngine.h>
 #include <Poco/Format.h>
+#include <Poco/MD5Engine.h>
+#include <Poco/Mutex.h>
 #include <Poco/NullStream.h>
 #include <Poco/RefCountedObject.h>
 #include <Poco/Runnable.h>
+#include <Poco/SHA1Engine.h>
+#include <Poco/SHA2Engine.h>
 #include <Poco/StreamCopier.h>
+#include <Poco/String.h>
 #include <Poco/SynchronizedObject.h>
 #include <Poco/Thread.h>
+#include <Poco/ThreadPool.h>
+#include <Poco/Timestamp.h>
 #include <Poco/URI.h>
 #include <Poco/URIStreamOpener.h>
 #include <Poco/Net/AcceptCertificateHandler.h>
@@ -33,16 +46,19 @@
 #include <Poco/Net/HTTPRequest.h>
 #include <Poco/Net/HTTPSClientSession.h>
 #include <Poco/Net/MessageHeader.h>
+#include <Poco/Net/NetException.h>
 #include <Poco/Net/SSLManager.h>
 #include <Poco/Net/WebSocket.h>
 #include <scriptarray.h>
 #include <scriptdictionary.h>
 #include <entities.h>
 #include "datastreams.h"
+#include "http_server.h"
 #include "internet.h"
 #include "nvgt.h"
 #include "nvgt_angelscript.h"
 #include "pocostuff.h" // angelscript_refcounted
+#include "threading.h" // async_native_start
 #include "version.h"
 
 using namespace std;
@@ -759,6 +775,430 @@ void RegisterHTTP(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod("http", "void reset()", asMETHOD(http, reset), asCALL_THISCALL);
 }
 
+const streamsize http_download_chunk_size = 65536;
+// Reads a response body from a session borrowed from an http_client_pool. When the stream is destroyed, the session goes back to the pool if the body was read to the end and the server allows keep-alive. Otherwise the session is closed.
+class http_client_pool;
+class http_body_istreambuf : public BasicBufferedStreamBuf<char, char_traits<char>> {
+	http_client_pool* _pool;
+	string _key;
+	HTTPClientSession* _session;
+	istream& _body;
+	bool _keep_alive, _finished;
+public:
+	http_body_istreambuf(http_client_pool* pool, const string& key, HTTPClientSession* session, istream& body, bool keep_alive);
+	~http_body_istreambuf();
+	int readFromDevice(char* buffer, streamsize length) {
+		if (_finished || !_body.good()) return -1;
+		_body.read(buffer, length);
+		streamsize count = _body.gcount();
+		if (_body.eof() && !_body.bad()) _finished = true;
+		return count > 0? int(count) : -1;
+	}
+};
+class http_body_istream : public istream {
+public:
+	http_body_istream(http_client_pool* pool, const string& key, HTTPClientSession* session, istream& body, bool keep_alive) : istream(new http_body_istreambuf(pool, key, session, body, keep_alive)) {}
+	~http_body_istream() { delete rdbuf(); }
+};
+unique_ptr<DigestEngine> http_digest_engine(const string& algorithm) {
+	string name = toLower(algorithm);
+	if (name.empty()) return nullptr;
+	else if (name == "md5") return make_unique<MD5Engine>();
+	else if (name == "sha1") return make_unique<SHA1Engine>();
+	else if (name == "sha224") return make_unique<SHA2Engine>(SHA2Engine::SHA_224);
+	else if (name == "sha256") return make_unique<SHA2Engine>(SHA2Engine::SHA_256);
+	else if (name == "sha384") return make_unique<SHA2Engine>(SHA2Engine::SHA_384);
+	else if (name == "sha512") return make_unique<SHA2Engine>(SHA2Engine::SHA_512);
+	throw InvalidArgumentException("unknown hash algorithm " + algorithm);
+}
+// Returns false if the script asked to stop, either by returning false or by throwing.
+bool http_progress(asIScriptFunction* callback, UInt64 received, Int64 total) {
+	asIScriptContext* ACtx = asGetActiveContext();
+	bool new_context = ACtx == NULL || ACtx->PushState() < 0;
+	asIScriptContext* ctx = (new_context ? g_ScriptEngine->RequestContext() : ACtx);
+	if (!ctx) return true;
+	bool result = false;
+	if (ctx->Prepare(callback) >= 0) {
+		ctx->SetArgQWord(0, received);
+		ctx->SetArgQWord(1, total);
+		if (ctx->Execute() == asEXECUTION_FINISHED) result = ctx->GetReturnByte();
+	}
+	if (new_context) g_ScriptEngine->ReturnContext(ctx);
+	else ctx->PopState();
+	return result;
+}
+// Whether a request that failed on a reused session may be sent again on a fresh one. Must be called from a catch block. Only idempotent methods qualify, and only if not a byte of the response arrived, since otherwise the server may already have acted on the request.
+bool http_may_retry(const string& method, bool reading_response) {
+	if (method != HTTPRequest::HTTP_GET && method != HTTPRequest::HTTP_HEAD && method != HTTPRequest::HTTP_PUT && method != HTTPRequest::HTTP_DELETE && method != HTTPRequest::HTTP_OPTIONS) return false;
+	if (!reading_response) return true;
+	try {
+		throw;
+	} catch (NoMessageException&) {
+		return true; // The connection closed before the status line.
+	} catch (...) {
+		return false;
+	}
+}
+
+// Keeps idle keep-alive sessions keyed by scheme, host and port, so that repeated requests to the same server skip the TCP and TLS handshakes. A session is borrowed for one request at a time and handed back afterward unless the server closed the connection.
+class http_client_pool : public RefCountedObject {
+	struct idle_session {
+		HTTPClientSession* session;
+		Timestamp returned;
+	};
+	mutable FastMutex _mutex;
+	map<string, deque<idle_session>> _idle; // The most recently returned session of each host is at the back.
+	unsigned int _idle_count, _max_idle, _max_idle_per_host, _idle_timeout;
+	string _user_agent;
+	string key(const URI& url) const { return url.getScheme() + "://" + toLower(url.getHost()) + ":" + to_string(url.getPort()); }
+	// Must be called with the mutex held.
+	void evict_expired() {
+		Timestamp::TimeDiff timeout = Timestamp::TimeDiff(_idle_timeout) * 1000;
+		for (auto it = _idle.begin(); it != _idle.end();) {
+			deque<idle_session>& sessions = it->second;
+			while (!sessions.empty() && sessions.front().returned.isElapsed(timeout)) {
+				delete sessions.front().session;
+				sessions.pop_front();
+				_idle_count--;
+			}
+			if (sessions.empty()) it = _idle.erase(it);
+			else ++it;
+		}
+	}
+	HTTPClientSession* borrow(const URI& url, const string& k, bool& reused) {
+		{
+			FastMutex::ScopedLock lock(_mutex);
+			evict_expired();
+			auto it = _idle.find(k);
+			if (it != _idle.end()) {
+				HTTPClientSession* s = it->second.back().session;
+				it->second.pop_back();
+				if (it->second.empty()) _idle.erase(it);
+				_idle_count--;
+				reused = true;
+				return s;
+			}
+		}
+		reused = false;
+		HTTPClientSession* s = url.getScheme() == "http"? new HTTPClientSession(url.getHost(), url.getPort()) : new HTTPSClientSession(url.getHost(), url.getPort());
+		s->setKeepAlive(true);
+		return s;
+	}
+	void give_back(const string& k, HTTPClientSession* s) {
+		FastMutex::ScopedLock lock(_mutex);
+		if (!_max_idle || !_max_idle_per_host) {
+			delete s;
+			return;
+		}
+		s->setKeepAliveTimeout(Timespan(Timespan::TimeDiff(_idle_timeout) * 1000));
+		deque<idle_session>& sessions = _idle[k];
+		if (sessions.size() >= _max_idle_per_host) {
+			delete sessions.front().session;
+			sessions.pop_front();
+			_idle_count--;
+		}
+		sessions.push_back({s, Timestamp()});
+		_idle_count++;
+		evict_expired();
+		trim();
+	}
+	// Over the total cap, drops the longest idle session of whichever host holds it. Must be called with the mutex held.
+	void trim() {
+		while (_idle_count > _max_idle) {
+			auto oldest = _idle.begin();
+			for (auto it = _idle.begin(); it != _idle.end(); ++it) {
+				if (it->second.front().returned < oldest->second.front().returned) oldest = it;
+			}
+			delete oldest->second.front().session;
+			oldest->second.pop_front();
+			if (oldest->second.empty()) _idle.erase(oldest);
+			_idle_count--;
+		}
+	}
+	HTTPRequest prepare(const string& method, const URI& url, const string& body, const NameValueCollection* headers) {
+		if (url.getScheme() != "http" && url.getScheme() != "https") throw InvalidArgumentException("http_client_pool only supports http and https URLs");
+		string path = url.getPathAndQuery();
+		if (path.empty()) path = "/";
+		HTTPRequest req(method, path, HTTPMessage::HTTP_1_1);
+		req.setHost(url.getHost(), url.getPort());
+		req.setKeepAlive(true);
+		{
+			FastMutex::ScopedLock lock(_mutex);
+			req.set("User-Agent", _user_agent);
+		}
+		if (!body.empty() || method == HTTPRequest::HTTP_POST || method == HTTPRequest::HTTP_PUT || method == HTTPRequest::HTTP_PATCH) {
+			req.setContentLength(body.length());
+			req.setContentType("application/x-www-form-urlencoded");
+		}
+		if (headers) {
+			for (const auto& header : *headers) req.set(header.first, header.second);
+		}
+		return req;
+	}
+	friend class http_body_istreambuf;
+public:
+	http_client_pool() : _idle_count(0), _max_idle(32), _max_idle_per_host(4), _idle_timeout(30000) { set_user_agent(); }
+	~http_client_pool() { clear(); }
+	// Performs a blocking request and returns the response body. Poco exceptions are passed on to the caller. Cancelling the token aborts the request from another thread.
+	string perform(const string& method, const URI& url, const string& body, const NameValueCollection* headers, HTTPResponse* response, cancellation_token* cancel) {
+		HTTPRequest req = prepare(method, url, body, headers);
+		string k = key(url);
+		while (true) {
+			bool reused;
+			HTTPClientSession* s = borrow(url, k, reused);
+			int subscription = 0;
+			if (cancel && !(subscription = cancel->subscribe([s] {
+				try {
+					s->abort();
+				} catch (Exception&) {} // The session wasn't connected yet.
+			}))) {
+				give_back(k, s);
+				throw Exception("request cancelled");
+			}
+			bool reading = false;
+			try {
+				HTTPResponse resp;
+				s->sendRequest(req) << body;
+				reading = true;
+				istream& istr = s->receiveResponse(resp);
+				string result;
+				StreamCopier::copyToString(istr, result);
+				if (cancel) {
+					cancel->unsubscribe(subscription);
+					subscription = 0;
+					if (cancel->is_cancelled()) throw Exception("request cancelled"); // An aborted body can look like a short but complete one.
+				}
+				if (resp.getKeepAlive()) give_back(k, s);
+				else delete s;
+				if (response) *response = resp;
+				return result;
+			} catch (...) {
+				if (subscription) cancel->unsubscribe(subscription);
+				delete s;
+				if (!reused || (cancel && cancel->is_cancelled()) || !http_may_retry(method, reading)) throw;
+				// The server may have closed an idle connection just before we used it, so try again on a fresh one.
+			}
+		}
+	}
+	string request(const string& method, const URI& url, const string& body, const NameValueCollection* headers, HTTPResponse* response) { return perform(method, url, body, headers, response, nullptr); }
+	// Sends a request and returns a stream of the response body, which keeps the session until it is closed.
+	datastream* open(const string& method, const URI& url, const string& body, const NameValueCollection* headers, HTTPResponse* response) {
+		HTTPRequest req = prepare(method, url, body, headers);
+		string k = key(url);
+		while (true) {
+			bool reused;
+			HTTPClientSession* s = borrow(url, k, reused);
+			bool reading = false;
+			try {
+				HTTPResponse resp;
+				s->sendRequest(req) << body;
+				reading = true;
+				istream& istr = s->receiveResponse(resp);
+				if (response) *response = resp;
+				return new datastream(new http_body_istream(this, k, s, istr, resp.getKeepAlive()));
+			} catch (...) {
+				delete s;
+				if (!reused || !http_may_retry(method, reading)) throw;
+			}
+		}
+	}
+	// Copies a response body into destination a chunk at a time, so that memory use doesn't grow with the size of the download.
+	UInt64 download(const URI& url, datastream* destination, asIScriptFunction* progress, const string& hash_algorithm, string* digest, const NameValueCollection* headers, HTTPResponse* response) {
+		unique_ptr<asIScriptFunction, void(*)(asIScriptFunction*)> progress_ref(progress, [](asIScriptFunction* f) { f->Release(); }); // We own the handle the script passed in.
+		if (!destination || !destination->get_ostr()) throw InvalidArgumentException("download requires a writable destination stream");
+		unique_ptr<DigestEngine> hash = http_digest_engine(hash_algorithm);
+		HTTPResponse resp;
+		datastream* ds = open(HTTPRequest::HTTP_GET, url, "", headers, &resp);
+		if (response) *response = resp;
+		Int64 total = resp.hasContentLength()? resp.getContentLength64() : -1;
+		UInt64 received = 0;
+		try {
+			istream* istr = ds->get_istr();
+			ostream* ostr = destination->get_ostr();
+			string buffer(http_download_chunk_size, '\0');
+			while (istr->good()) {
+				istr->read(buffer.data(), buffer.size());
+				streamsize count = istr->gcount();
+				if (count <= 0) break;
+				if (hash) hash->update(buffer.data(), count);
+				ostr->write(buffer.data(), count);
+				if (!ostr->good()) throw WriteFileException("cannot write to the download destination");
+				received += count;
+				if (progress && !http_progress(progress, received, total)) throw Exception("download cancelled");
+			}
+			if (istr->bad()) throw IOException("connection lost during download");
+		} catch (...) {
+			ds->release();
+			throw;
+		}
+		ds->release(); // Hands the session back to the pool.
+		if (digest && hash) *digest = DigestEngine::digestToHex(hash->digest());
+		return received;
+	}
+	string get(const URI& url, const NameValueCollection* headers, HTTPResponse* response) { return perform(HTTPRequest::HTTP_GET, url, "", headers, response, nullptr); }
+	string post(const URI& url, const string& body, const NameValueCollection* headers, HTTPResponse* response) { return perform(HTTPRequest::HTTP_POST, url, body, headers, response, nullptr); }
+	void clear() {
+		FastMutex::ScopedLock lock(_mutex);
+		for (auto& host : _idle) {
+			for (auto& i : host.second) delete i.session;
+		}
+		_idle.clear();
+		_idle_count = 0;
+	}
+	unsigned int get_idle_count() {
+		FastMutex::ScopedLock lock(_mutex);
+		evict_expired();
+		return _idle_count;
+	}
+	unsigned int get_max_idle() const {
+		FastMutex::ScopedLock lock(_mutex);
+		return _max_idle;
+	}
+	void set_max_idle(unsigned int max) {
+		FastMutex::ScopedLock lock(_mutex);
+		_max_idle = max;
+		trim();
+	}
+	unsigned int get_max_idle_per_host() const {
+		FastMutex::ScopedLock lock(_mutex);
+		return _max_idle_per_host;
+	}
+	void set_max_idle_per_host(unsigned int max) {
+		FastMutex::ScopedLock lock(_mutex);
+		_max_idle_per_host = max;
+		for (auto it = _idle.begin(); it != _idle.end();) {
+			while (it->second.size() > max) {
+				delete it->second.front().session;
+				it->second.pop_front();
+				_idle_count--;
+			}
+			if (it->second.empty()) it = _idle.erase(it);
+			else ++it;
+		}
+	}
+	unsigned int get_idle_timeout() const {
+		FastMutex::ScopedLock lock(_mutex);
+		return _idle_timeout;
+	}
+	void set_idle_timeout(unsigned int ms) {
+		FastMutex::ScopedLock lock(_mutex);
+		_idle_timeout = ms;
+		evict_expired();
+	}
+	string get_user_agent() const {
+		FastMutex::ScopedLock lock(_mutex);
+		return _user_agent;
+	}
+	void set_user_agent(const string& agent = "") {
+		FastMutex::ScopedLock lock(_mutex);
+		if (agent.empty()) _user_agent = "nvgt " + NVGT_VERSION;
+		else _user_agent = agent;
+	}
+};
+http_body_istreambuf::http_body_istreambuf(http_client_pool* pool, const string& key, HTTPClientSession* session, istream& body, bool keep_alive) : BasicBufferedStreamBuf(http_download_chunk_size, ios_base::in), _pool(pool), _key(key), _session(session), _body(body), _keep_alive(keep_alive), _finished(false) {
+	_pool->duplicate();
+}
+http_body_istreambuf::~http_body_istreambuf() {
+	if (_finished && _keep_alive) _pool->give_back(_key, _session);
+	else delete _session;
+	_pool->release();
+}
+http_client_pool* http_client_pool_factory() { return new http_client_pool(); }
+void RegisterHTTPClientPool(asIScriptEngine* engine) {
+	engine->RegisterFuncdef("bool http_progress_callback(uint64 received, int64 total)");
+	engine->RegisterObjectType("http_client_pool", 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour("http_client_pool", asBEHAVE_FACTORY, "http_client_pool@ f()", asFUNCTION(http_client_pool_factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour("http_client_pool", asBEHAVE_ADDREF, "void f()", asMETHODPR(http_client_pool, duplicate, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour("http_client_pool", asBEHAVE_RELEASE, "void f()", asMETHODPR(http_client_pool, release, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "string request(const string&in method, const spec::uri&in url, const string&in body = \"\", const name_value_collection@+ headers = null, http_response&out response = void)", asMETHOD(http_client_pool, request), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "string get(const spec::uri&in url, const name_value_collection@+ headers = null, http_response&out response = void)", asMETHOD(http_client_pool, get), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "string post(const spec::uri&in url, const string&in body, const name_value_collection@+ headers = null, http_response&out response = void)", asMETHOD(http_client_pool, post), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "datastream@ open(const string&in method, const spec::uri&in url, const string&in body = \"\", const name_value_collection@+ headers = null, http_response&out response = void)", asMETHOD(http_client_pool, open), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "uint64 download(const spec::uri&in url, datastream@+ destination, http_progress_callback@ progress = null, const string&in hash_algorithm = \"\", string&out digest = void, const name_value_collection@+ headers = null, http_response&out response = void)", asMETHOD(http_client_pool, download), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "void clear()", asMETHOD(http_client_pool, clear), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "uint get_idle_count() property", asMETHOD(http_client_pool, get_idle_count), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "uint get_max_idle() const property", asMETHOD(http_client_pool, get_max_idle), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "void set_max_idle(uint max) property", asMETHOD(http_client_pool, set_max_idle), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "uint get_max_idle_per_host() const property", asMETHOD(http_client_pool, get_max_idle_per_host), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "void set_max_idle_per_host(uint max) property", asMETHOD(http_client_pool, set_max_idle_per_host), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "uint get_idle_timeout() const property", asMETHOD(http_client_pool, get_idle_timeout), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "void set_idle_timeout(uint ms) property", asMETHOD(http_client_pool, set_idle_timeout), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "string get_user_agent() const property", asMETHOD(http_client_pool, get_user_agent), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_client_pool", "void set_user_agent(const string&in agent = \"\") property", asMETHOD(http_client_pool, set_user_agent), asCALL_THISCALL);
+}
+
+// The result of http_request_async.
+class http_result : public RefCountedObject {
+public:
+	HTTPResponse response;
+	string body;
+	HTTPResponse* get_response() const { return angelscript_refcounted_factory<HTTPResponse, const HTTPResponse&>(response); }
+	int get_status_code() const { return response.getStatus(); }
+	const string& get_body() const { return body; }
+};
+// Requests started by http_request_async share these keep-alive connections and worker threads. Poco's default pool tops out at 16 threads, which is too few for the dozens of requests a game might keep in flight.
+// The service is created on first use and torn down by http_async_shutdown, which cancels whatever is still in flight and joins the threads while the script engine is still around for those requests to report to.
+class http_async_service {
+public:
+	http_client_pool connections;
+	ThreadPool threads;
+	AutoPtr<cancellation_token> stopping; // Every request subscribes to this, and it's cancelled at shutdown.
+	http_async_service() : threads("http", 2, 64), stopping(new cancellation_token()) {}
+};
+static FastMutex g_http_async_mutex;
+static http_async_service* g_http_async = nullptr;
+static bool g_http_async_shut_down = false;
+static http_async_service* http_async() {
+	FastMutex::ScopedLock lock(g_http_async_mutex);
+	if (!g_http_async && !g_http_async_shut_down) g_http_async = new http_async_service();
+	return g_http_async;
+}
+void http_async_shutdown() {
+	http_async_service* service;
+	{
+		FastMutex::ScopedLock lock(g_http_async_mutex);
+		service = g_http_async;
+		g_http_async = nullptr;
+		g_http_async_shut_down = true;
+	}
+	if (!service) return;
+	service->stopping->cancel();
+	service->threads.joinAll();
+	delete service;
+}
+async_result* http_request_async(const string& method, const URI& url, const NameValueCollection* headers, const string& body, cancellation_token* cancel) {
+	static asITypeInfo* type = g_ScriptEngine->GetTypeInfoByDecl("async<http_result@>");
+	http_async_service* service = http_async();
+	if (!service) throw IllegalStateException("http_request_async is unavailable during shutdown");
+	NameValueCollection request_headers;
+	if (headers) request_headers = *headers;
+	AutoPtr<cancellation_token> token = cancel ? AutoPtr<cancellation_token>(cancel, true) : AutoPtr<cancellation_token>(new cancellation_token()); // Shutdown cancels through this, so every request gets one.
+	return async_native_start(type, [=]() mutable -> void* {
+		cancellation_token* t = token.get();
+		int link = service->stopping->subscribe([t] { t->cancel(); });
+		if (!link) throw Exception("request cancelled");
+		http_result* r = new http_result();
+		try {
+			r->body = service->connections.perform(method, url, body, &request_headers, &r->response, t);
+		} catch (...) {
+			service->stopping->unsubscribe(link);
+			r->release();
+			throw;
+		}
+		service->stopping->unsubscribe(link);
+		return r;
+	}, service->threads);
+}
+void RegisterHTTPAsync(asIScriptEngine* engine) {
+	engine->RegisterObjectType("http_result", 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour("http_result", asBEHAVE_ADDREF, "void f()", asMETHODPR(http_result, duplicate, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour("http_result", asBEHAVE_RELEASE, "void f()", asMETHODPR(http_result, release, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_result", "http_response@ get_response() const property", asMETHOD(http_result, get_response), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_result", "int get_status_code() const property", asMETHOD(http_result, get_status_code), asCALL_THISCALL);
+	engine->RegisterObjectMethod("http_result", "const string& get_body() const property", asMETHOD(http_result, get_body), asCALL_THISCALL);
+	engine->RegisterGlobalFunction("async<http_result@>@ http_request_async(const string&in method, const spec::uri&in url, const name_value_collection@+ headers = null, const string&in body = \"\", cancellation_token@+ cancel = null)", asFUNCTION(http_request_async), asCALL_CDECL);
+}
+
 // NVGT's highest level HTTP.
 string url_request(const string& method, const string& url, const string& data, HTTPResponse* resp) {
 	http h;
@@ -826,6 +1266,9 @@ void RegisterInternet(asIScriptEngine* engine) {
 	RegisterWebSocket(engine);
 	RegisterDNS(engine);
 	RegisterHTTP(engine);
+	RegisterHTTPClientPool(engine);
+	RegisterHTTPAsync(engine);
+	RegisterHTTPServer(engine);
 	engine->RegisterGlobalFunction("string url_request(const string&in method, const string&in url, const string&in data = \"\", http_response&out response = void)", asFUNCTION(url_request), asCALL_CDECL);
 	engine->RegisterGlobalFunction("string url_get(const string&in url, http_response&out response = void)", asFUNCTION(url_get), asCALL_CDECL);
 	engine->RegisterGlobalFunction("string url_post(const string&in url, const string&in data, http_response&out response = void)", asFUNCTION(url_post), asCALL_CDECL);
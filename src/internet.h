@@ -15,4 +15,6 @@
 #include <string>
 #include <angelscript.h>
 
+// Cancels requests still running from http_request_async and joins their threads. Call before the script engine shuts down.
+void http_async_shutdown();
 void RegisterInternet(asIScriptEngine* engine);
@@ -10,17 +10,94 @@
  * 3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <chrono>
+#include <mutex>
+#include <vector>
 #include <obfuscate.h>
+#include <Poco/MemoryStream.h>
+#include "datastreams.h"
 #include "nvgt_angelscript.h" // get_array_type
 #include "network.h"
+#include "network_cluster.h"
+#include "network_compression.h"
+#include "network_interest.h"
+#include "network_replication.h"
+#include "network_simulator.h"
+#include "network_stream.h"
 
 bool g_enet_initialized = false;
 network_event g_enet_none_event; // The none event is static and never changes, why reallocate it every time network::request() doesn't come up with an event?
+static thread_local network* g_servicing_network = nullptr; // ENet's intercept callback gets no user data, so whoever services a host says which network it belongs to.
+const size_t network_connection_bucket_purge_size = 1024; // Past this many remembered addresses, those whose buckets have refilled are forgotten about once a second.
+asQWORD network_peer_table::insert(ENetPeer* peer) {
+	asUINT index;
+	if (!free_slots.empty()) {
+		index = free_slots.back();
+		free_slots.pop_back();
+	} else {
+		index = slots.size();
+		slots.emplace_back();
+	}
+	slot& s = slots[index];
+	s.data = network_peer_data();
+	s.data.peer = peer;
+	s.used = true;
+	s.closed = false;
+	s.live_position = live.size();
+	live.push_back(index);
+	peer->data = reinterpret_cast<void*>(uintptr_t(index) + 1);
+	return id_of(index);
+}
+void network_peer_table::unlink(asUINT index) {
+	slot& s = slots[index];
+	asUINT moved = live.back();
+	live[s.live_position] = moved;
+	slots[moved].live_position = s.live_position;
+	live.pop_back();
+}
+bool network_peer_table::close(asQWORD peer_id) {
+	if (!find(peer_id)) return false;
+	asUINT index = asUINT(peer_id) - 1;
+	unlink(index);
+	slots[index].closed = true;
+	return true;
+}
+void network_peer_table::release(ENetPeer* peer) {
+	if (!peer->data) return;
+	asUINT index = index_of(peer);
+	slot& s = slots[index];
+	if (!s.closed) unlink(index);
+	s.used = s.closed = false;
+	s.data.crypto.reset();
+	s.generation = (s.generation + 1) & 0xffffff;
+	free_slots.push_back(index);
+	peer->data = nullptr;
+}
+void network_peer_table::clear() {
+	slots.clear();
+	free_slots.clear();
+	live.clear();
+}
+
 ENetPeer* network::get_peer(asQWORD peer_id) {
-	std::unordered_map<asQWORD, ENetPeer*>::iterator i = peers.find(peer_id);
-	if (i == peers.end())
-		return NULL;
-	return i->second;
+	network_peer_data* d = peers.find(peer_id);
+	return d ? d->peer : NULL;
+}
+network_peer_data* network::get_peer_data(asQWORD peer_id) {
+	return peers.find(peer_id);
+}
+void network::count_sent(asQWORD peer_id, size_t bytes) {
+	if (peer_id) {
+		network_peer_data* d = get_peer_data(peer_id);
+		if (!d) return;
+		d->bytes_sent += bytes;
+		d->packets_sent++;
+	} else {
+		peers.for_each([bytes](asQWORD, network_peer_data& d) {
+			d.bytes_sent += bytes;
+			d.packets_sent++;
+		});
+	}
 }
 
 network::network() {
@@ -29,10 +106,23 @@ network::network() {
 		g_enet_initialized = true;
 	}
 	host = NULL;
-	next_peer = 1;
 	channel_count = 0;
 	is_client = receive_timeout_event = false;
 	IPv6enabled = true;
+	last_batch_receives = last_batch_received_bytes = 0;
+	threaded = false;
+	io_thread_stop = false;
+	cluster = nullptr;
+	shard_index = 0;
+	qos_queued_bytes = 0;
+	connection_rate = connection_burst = peer_message_rate = peer_byte_rate = 0;
+	rate_limit_action = rate_limit_drop;
+	connection_buckets_purge_time = 0;
+	rate_limited_connections = rate_limited_messages = 0;
+	encrypted = false;
+	memset(encryption_secret, 0, sizeof(encryption_secret));
+	memset(encryption_public_key, 0, sizeof(encryption_public_key));
+	decryption_failures = 0;
 	RefCount = 1;
 	reset_totals();
 }
@@ -47,16 +137,38 @@ void network::release() {
 }
 
 void network::destroy(bool flush) {
+	stop_io_thread();
 	if (host) {
 		if (flush) {
-			for (const auto& it : peers) enet_peer_disconnect(it.second, 0);
+			flush_coalesced();
+			peers.for_each([this](asQWORD, network_peer_data& d) {
+				drop_qos(d, true);
+				enet_peer_disconnect(d.peer, 0);
+			});
 			enet_host_flush(host);
 		}
 		enet_host_destroy(host);
 		host = NULL;
 	}
+	// Anything the I/O thread queued up is now meaningless.
+	while (network_outgoing_packet* o = outbound.pop()) {
+		enet_packet_destroy(o->packet);
+		delete o;
+	}
+	{
+		std::lock_guard<std::mutex> lock(inbound_mutex);
+		while (network_event* e = inbound.pop()) e->release();
+	}
+	for (network_event* e : ready_events) e->release();
+	ready_events.clear();
+	{
+		std::lock_guard<std::mutex> lock(coalesce_mutex);
+		coalesce_buffers.clear();
+	}
+	peers.for_each([this](asQWORD, network_peer_data& d) { drop_qos(d); });
 	peers.clear();
-	next_peer = 1;
+	qos_queued_bytes = 0;
+	connection_buckets.clear();
 	channel_count = 0;
 	is_client = false;
 	reset_totals();
@@ -68,28 +180,36 @@ bool network::setup_client(unsigned char max_channels, unsigned short max_peers)
 	if (!host) return false;
 	is_client = true;
 	channel_count = max_channels;
+	peers.reserve(max_peers);
+	if (threaded) start_io_thread();
 	return true;
 }
 
 bool network::setup_server(unsigned short port, unsigned char max_channels, unsigned short max_peers) {
-	if (host) return false;
+	if (host || !setup_encryption()) return false;
 	ENetAddress address;
 	enet_address_build_any(&address, IPv6enabled? ENET_ADDRESS_TYPE_IPV6 : ENET_ADDRESS_TYPE_IPV4);
 	address.port = port;
 	host = enet_host_create(IPv6enabled? ENET_ADDRESS_TYPE_ANY : ENET_ADDRESS_TYPE_IPV4, &address, max_peers, max_channels, 0, 0);
 	if (!host) return false;
+	host->intercept = intercept;
 	channel_count = max_channels;
+	peers.reserve(max_peers);
+	if (threaded) start_io_thread();
 	return true;
 }
 
 bool network::setup_local_server(unsigned short port, unsigned char max_channels, unsigned short max_peers) {
-	if (host) return false;
+	if (host || !setup_encryption()) return false;
 	ENetAddress address;
 	enet_address_build_loopback(&address, IPv6enabled? ENET_ADDRESS_TYPE_IPV6 : ENET_ADDRESS_TYPE_IPV4);
 	address.port = port;
 	host = enet_host_create(IPv6enabled? ENET_ADDRESS_TYPE_ANY : ENET_ADDRESS_TYPE_IPV4, &address, max_peers, max_channels, 0, 0);
 	if (!host) return false;
+	host->intercept = intercept;
 	channel_count = max_channels;
+	peers.reserve(max_peers);
+	if (threaded) start_io_thread();
 	return true;
 }
 
@@ -98,54 +218,323 @@ asQWORD network::connect(const std::string& hostname, unsigned short port) {
 	ENetAddress addr;
 	if (enet_address_set_host(&addr, IPv6enabled? ENET_ADDRESS_TYPE_ANY : ENET_ADDRESS_TYPE_IPV4, hostname.c_str()) < 0) return false;
 	addr.port = port;
-	ENetPeer* svr = enet_host_connect(host, &addr, channel_count, 0);
+	auto lock = lock_host();
+	enet_uint32 framed = get_framed_channels();
+	ENetPeer* svr = enet_host_connect(host, &addr, channel_count, framed); // The server learns which channels to frame from the connect data.
 	if (!svr) return 0;
-	peers[next_peer] = svr;
-	svr->data = reinterpret_cast<void*>(next_peer);
-	next_peer += 1;
-	return next_peer - 1;
+	asQWORD id = peers.insert(svr);
+	peers.find(id)->framed_channels = framed;
+	return id;
 }
 
-const network_event* network::request(uint32_t timeout) {
-	if (!host) {
-		g_enet_none_event.addRef();
-			return &g_enet_none_event;
-		}
-	ENetEvent event;
-	int r = enet_host_service(host, &event, timeout);
-	if (r < 1) {
-		g_enet_none_event.addRef();
-			return &g_enet_none_event;
+static void write_varint(std::string& out, size_t value) {
+	while (value >= 0x80) {
+		out.push_back(char((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.push_back(char(value));
+}
+static bool read_varint(const unsigned char* data, size_t size, size_t& pos, size_t& value) {
+	value = 0;
+	for (int shift = 0; pos < size && shift < 64; shift += 7) {
+		unsigned char b = data[pos++];
+		value |= size_t(b & 0x7f) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+// A bundle is a sequence of length prefixed messages that must end exactly where the packet does. Packets made by coalesce() point their user data here, so that enet_send can tell them from plain ones.
+static char network_bundle_tag;
+// Returns how many messages the bundle between pos and size holds, or 0 if it is malformed.
+static size_t count_bundle(const unsigned char* data, size_t size, size_t pos) {
+	size_t count = 0, message_length;
+	while (pos < size) {
+		if (!read_varint(data, size, pos, message_length) || message_length > size - pos) return 0;
+		pos += message_length;
+		count++;
+	}
+	return count;
+}
+
+// Translates an ENet event into one network_event, or into several when it delivered a coalesced bundle, appending them to out.
+void network::queue_event(ENetEvent& event, std::deque<network_event*>& out) {
+	if (event.type == ENET_EVENT_TYPE_RECEIVE && (peer_message_rate || peer_byte_rate)) {
+		network_peer_data* d = peers.find(event.peer);
+		if (d && (d->rate_limited || !admit_message(*d, event.packet->dataLength))) {
+			rate_limited_messages++;
+			if (!d->rate_limited && rate_limit_action == rate_limit_disconnect) {
+				d->rate_limited = true;
+				enet_peer_disconnect(event.peer, 0);
+			}
+			enet_packet_destroy(event.packet);
+			return;
 		}
-	update_totals(); // total_sent, total_received...
-	network_event* e = new network_event();
+	}
+	network_event* e = network_event::acquire();
 	e->type = event.type;
 	e->channel = event.channelID;
 	if (!receive_timeout_event && e->type == ENET_EVENT_TYPE_DISCONNECT_TIMEOUT) e->type = ENET_EVENT_TYPE_DISCONNECT;
 	if (event.type == ENET_EVENT_TYPE_CONNECT) {
 		enet_peer_timeout(event.peer, 128, 10000, 35000);
 		if (!is_client) {
-			event.peer->data = reinterpret_cast<void*>(next_peer);
-			peers[next_peer] = event.peer;
-			e->peer_id = next_peer;
-			next_peer++;
-		} else
-			e->peer_id = (asQWORD)event.peer->data;
+			e->peer_id = peers.insert(event.peer);
+			peers.find(e->peer_id)->framed_channels = event.data & network_framed_channel_mask(channel_count);
+		} else e->peer_id = peers.id_of(event.peer);
+		network_peer_data* d = encrypted ? peers.find(event.peer) : nullptr;
+		if (d) {
+			d->crypto = std::make_unique<network_peer_crypto>(channel_count);
+			if (is_client) {
+				std::string hello = network_crypto_hello(*d->crypto);
+				ENetPacket* p = hello.empty() ? nullptr : enet_packet_create(hello.data(), hello.size(), ENET_PACKET_FLAG_RELIABLE);
+				if (!p || enet_peer_send(event.peer, 0, p) != 0) {
+					if (p) enet_packet_destroy(p);
+					enet_peer_disconnect(event.peer, 0);
+				}
+			}
+			d->crypto->connect_event = e; // The script hears of the connection once the handshake is done.
+			return;
+		}
 	} else if (event.type == ENET_EVENT_TYPE_DISCONNECT || event.type == ENET_EVENT_TYPE_DISCONNECT_TIMEOUT) {
-		asQWORD peer_id = (asQWORD)event.peer->data;
-		event.peer->data = NULL;
-		if (peer_id > 0)
-			peers.erase(peer_id);
-		e->peer_id = peer_id;
+		e->peer_id = peers.id_of(event.peer);
+		network_peer_data* d = peers.find(event.peer);
+		bool announced = is_client || !d || !d->crypto || d->crypto->ready;
+		if (d) drop_qos(*d);
+		peers.release(event.peer);
+		if (!announced) {
+			e->release(); // The script never heard that this peer connected.
+			return;
+		}
 	} else if (event.type == ENET_EVENT_TYPE_RECEIVE) {
-		e->peer_id = (asQWORD)event.peer->data;
-		e->message.append((char*)event.packet->data, event.packet->dataLength);
+		e->peer_id = peers.id_of(event.peer);
+		network_peer_data* d = peers.find(event.peer);
+		size_t offset = 0, length = event.packet->dataLength;
+		if (encrypted) {
+			if (!d || !d->crypto) enet_packet_destroy(event.packet);
+			if (!d || !d->crypto || !receive_encrypted(*d, event, offset, length, out)) {
+				e->release();
+				return;
+			}
+		}
+		if (d) {
+			d->bytes_received += event.packet->dataLength;
+			d->packets_received++;
+			if (host->serviceTime - d->last_rtt_sample_time >= 1000 || !d->rtt_sample_total) {
+				d->rtt_samples[d->rtt_sample_total++ % network_rtt_sample_count] = event.peer->roundTripTime < 65535 ? event.peer->roundTripTime : 65535;
+				d->last_rtt_sample_time = host->serviceTime;
+			}
+		}
+		// On a channel the connection frames, every unreliable packet is a bundle, and each message in it becomes an event holding a slice of the same packet.
+		const unsigned char* data = event.packet->data;
+		size_t size = offset + length;
+		if (d && d->frames(event.channelID) && !(event.packet->flags & ENET_PACKET_FLAG_RELIABLE)) {
+			if (!count_bundle(data, size, offset)) {
+				e->release();
+				enet_packet_destroy(event.packet);
+				return;
+			}
+			size_t pos = offset, message_length;
+			while (pos < size && read_varint(data, size, pos, message_length)) {
+				network_event* m = network_event::acquire();
+				m->type = e->type;
+				m->peer_id = e->peer_id;
+				m->channel = e->channel;
+				m->set_packet(event.packet, pos, message_length);
+				out.push_back(m);
+				pos += message_length;
+			}
+			e->release();
+			return;
+		}
+		e->set_packet(event.packet, offset, length); // The event now owns the packet and destroys it when recycled.
+	}
+	out.push_back(e);
+}
+// Takes a received packet from a peer on an encrypted network. Handshake messages are handled here. Sealed packets are held back until the handshake is done, then opened in place. Returns true with offset and length locating the plaintext, or false if the packet was consumed or rejected, in which case it has been destroyed.
+bool network::receive_encrypted(network_peer_data& d, ENetEvent& event, size_t& offset, size_t& length, std::deque<network_event*>& out) {
+	network_peer_crypto& c = *d.crypto;
+	const unsigned char* data = event.packet->data;
+	size_t size = event.packet->dataLength;
+	if (size && data[0] == network_crypto_handshake) {
+		std::string reply;
+		if (c.ready) {} // A duplicate, ignore it.
+		else if (!(is_client ? network_crypto_finish(c, data, size, encryption_key) : network_crypto_accept(c, encryption_secret, encryption_public_key, data, size, reply))) {
+			decryption_failures++;
+			enet_peer_disconnect(event.peer, 0); // Includes a server whose key doesn't match the one the client expects.
+		} else {
+			if (!reply.empty()) {
+				ENetPacket* p = enet_packet_create(reply.data(), reply.size(), ENET_PACKET_FLAG_RELIABLE);
+				if (p && enet_peer_send(event.peer, 0, p) != 0) enet_packet_destroy(p);
+			}
+			if (c.connect_event) out.push_back(c.connect_event);
+			c.connect_event = nullptr;
+			std::deque<std::pair<unsigned char, ENetPacket*>> early;
+			early.swap(c.early);
+			for (auto& p : early) {
+				ENetEvent held = event;
+				held.channelID = p.first;
+				held.packet = p.second;
+				queue_event(held, out);
+			}
+		}
 		enet_packet_destroy(event.packet);
+		return false;
+	}
+	if (!c.ready) {
+		// The server may send on another channel before its half of the handshake arrives.
+		if (c.early.size() < network_crypto_max_early_packets) c.early.emplace_back(event.channelID, event.packet);
+		else enet_packet_destroy(event.packet);
+		return false;
+	}
+	if (!network_crypto_open(c, event.channelID, event.packet, offset, length)) {
+		decryption_failures++;
+		enet_packet_destroy(event.packet);
+		return false;
+	}
+	return true;
+}
+// Returns the next translated event, or null if there isn't one. With service set, ENet is serviced with the given timeout first, otherwise only events it has already queued are drained.
+network_event* network::next_event(uint32_t timeout, bool service) {
+	if (ready_events.empty()) {
+		if (io_thread.joinable()) return pop_event(service ? timeout : 0);
+		ENetEvent event;
+		if (service) schedule_qos();
+		g_servicing_network = this;
+		while (ready_events.empty()) {
+			int r = service ? enet_host_service(host, &event, timeout) : enet_host_check_events(host, &event);
+			if (r < 1) break;
+			service = false;
+			queue_event(event, ready_events);
+		}
+		g_servicing_network = nullptr;
+		if (ready_events.empty()) return nullptr;
 	}
+	network_event* e = ready_events.front();
+	ready_events.pop_front();
 	return e;
 }
+const network_event* network::request(uint32_t timeout) {
+	if (!host) {
+		g_enet_none_event.addRef();
+		return &g_enet_none_event;
+	}
+	flush_coalesced();
+	network_event* e = next_event(timeout, true);
+	if (!io_thread.joinable()) update_totals(); // total_sent, total_received...
+	if (e) return e;
+	g_enet_none_event.addRef();
+	return &g_enet_none_event;
+}
+// Services the host once and then only drains events ENet has already queued, so a busy tick costs one trip into native code and one round of socket I/O rather than one per event.
+CScriptArray* network::request_batch(unsigned int max_events, uint32_t timeout) {
+	CScriptArray* array = CScriptArray::Create(get_array_type("array<network_event@>"));
+	last_batch_receives = last_batch_received_bytes = 0;
+	if (!host) return array;
+	flush_coalesced();
+	network_event* e = next_event(timeout, true);
+	if (e && max_events) array->Reserve(max_events < 64 ? max_events : 64);
+	while (e) {
+		if (e->type == ENET_EVENT_TYPE_RECEIVE) {
+			last_batch_receives++;
+			last_batch_received_bytes += e->get_message_length();
+		}
+		array->InsertLast(&e);
+		e->release(); // The array holds its own reference.
+		if (max_events && array->GetSize() >= max_events) break;
+		e = next_event(0, false);
+	}
+	if (!io_thread.joinable()) update_totals();
+	return array;
+}
 
+void network::set_threaded(bool enabled) {
+	if (enabled == threaded) return;
+	threaded = enabled;
+	if (!host) return; // The thread starts or doesn't when the network is next set up.
+	if (enabled) start_io_thread();
+	else stop_io_thread();
+}
+void network::start_io_thread() {
+	if (io_thread.joinable()) return;
+	io_thread_stop = false;
+	io_thread = std::thread(&network::io_thread_func, this);
+}
+void network::stop_io_thread() {
+	if (!io_thread.joinable()) return;
+	io_thread_stop = true;
+	outbound_cv.notify_one();
+	inbound_cv.notify_all();
+	io_thread.join();
+	service_outbound(); // Hand over anything sent after the thread's last pass.
+	// Events the thread already received are handed to request() ahead of anything ENet delivers from now on.
+	std::lock_guard<std::mutex> lock(inbound_mutex);
+	while (network_event* e = inbound.pop()) ready_events.push_back(e);
+}
+network_event* network::pop_event(uint32_t timeout) {
+	std::unique_lock<std::mutex> lock(inbound_mutex);
+	network_event* e = inbound.pop();
+	if (!e && timeout > 0) inbound_cv.wait_for(lock, std::chrono::milliseconds(timeout), [&] { return (e = inbound.pop()) != nullptr || io_thread_stop; });
+	return e;
+}
+// Hands queued packets to ENet, returning whether there were any. Must be called with the host locked or from the I/O thread.
+bool network::service_outbound() {
+	bool any = false;
+	while (network_outgoing_packet* o = outbound.pop()) {
+		any = true;
+		bool sent = false;
+		if (!host) sent = false;
+		else if (!o->peer_id) {
+			broadcast_packet(o->channel, o->packet);
+			sent = true;
+		} else {
+			network_peer_data* d = get_peer_data(o->peer_id);
+			sent = d && peer_send(*d, o->channel, o->packet);
+		}
+		if (!sent) enet_packet_destroy(o->packet);
+		else count_sent(o->peer_id, o->packet->dataLength);
+		delete o;
+	}
+	return any;
+}
+void network::io_thread_func() {
+	std::deque<network_event*> arrived;
+	g_servicing_network = this;
+	while (!io_thread_stop) {
+		bool received = false;
+		{
+			std::lock_guard<std::mutex> lock(host_mutex);
+			service_outbound();
+			schedule_qos();
+			ENetEvent event;
+			int r = enet_host_service(host, &event, 0);
+			while (r > 0) {
+				queue_event(event, arrived);
+				r = enet_host_check_events(host, &event);
+			}
+			update_totals();
+		}
+		received = !arrived.empty();
+		if (cluster) {
+			cluster->deliver(shard_index, arrived);
+			received = false;
+		}
+		for (network_event* e : arrived) inbound.push(e);
+		arrived.clear();
+		if (received) {
+			{ std::lock_guard<std::mutex> lock(inbound_mutex); } // Orders the push before any waiter's predicate check, so the wakeup can't be lost.
+			inbound_cv.notify_all();
+		}
+		// Sleep for a millisecond or until the script sends something, either way ENet gets serviced roughly 1000 times a second regardless of how slow the script's frames are.
+		std::unique_lock<std::mutex> lock(outbound_wait_mutex);
+		outbound_cv.wait_for(lock, std::chrono::milliseconds(1));
+	}
+}
+
+bool network::has_peer(asQWORD peer_id) {
+	auto lock = lock_host();
+	return get_peer(peer_id) != nullptr;
+}
 std::string network::get_peer_address(asQWORD peer_id) {
+	auto lock = lock_host();
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return "";
 	std::string tmp(32, '\0');
@@ -155,56 +544,402 @@ std::string network::get_peer_address(asQWORD peer_id) {
 }
 unsigned int network::get_peer_average_round_trip_time(asQWORD peer_id) {
 	if (!host) return -1;
+	auto lock = lock_host();
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return -1;
 	return peer->roundTripTime;
 }
 
+network_peer_stats* network::make_peer_stats(asQWORD peer_id, const network_peer_data& data) {
+	network_peer_stats* st = new network_peer_stats();
+	const ENetPeer* peer = data.peer;
+	st->peer_id = peer_id;
+	st->round_trip_time = peer->roundTripTime;
+	st->round_trip_time_variance = peer->roundTripTimeVariance;
+	st->packet_loss = float(peer->packetLoss) / ENET_PEER_PACKET_LOSS_SCALE;
+	st->packet_loss_variance = float(peer->packetLossVariance) / ENET_PEER_PACKET_LOSS_SCALE;
+	st->packet_throttle = float(peer->packetThrottle) / ENET_PEER_PACKET_THROTTLE_SCALE;
+	st->reliable_bytes_in_transit = peer->reliableDataInTransit;
+	st->reliable_commands_in_flight = enet_list_size(const_cast<ENetList*>(&peer->sentReliableCommands));
+	st->mtu = peer->mtu;
+	st->bytes_sent = data.bytes_sent;
+	st->bytes_received = data.bytes_received;
+	st->packets_sent = data.packets_sent;
+	st->packets_received = data.packets_received;
+	st->queued_bytes = data.qos_queued_bytes;
+	unsigned int samples = data.rtt_sample_total < network_rtt_sample_count ? data.rtt_sample_total : network_rtt_sample_count;
+	for (unsigned int i = 0; i < samples; i++) {
+		int bucket = 0;
+		for (unsigned int bound = 10; bucket < network_rtt_histogram_buckets - 1 && data.rtt_samples[i] >= bound; bound *= 2) bucket++;
+		st->rtt_histogram[bucket]++;
+	}
+	return st;
+}
+network_peer_stats* network::get_peer_stats(asQWORD peer_id) {
+	if (!host) return nullptr;
+	auto lock = lock_host();
+	network_peer_data* d = get_peer_data(peer_id);
+	if (!d) return nullptr;
+	return make_peer_stats(peer_id, *d);
+}
+CScriptArray* network::get_all_peer_stats() {
+	CScriptArray* array = CScriptArray::Create(get_array_type("array<network_peer_stats@>"));
+	if (!host) return array;
+	auto lock = lock_host();
+	array->Reserve(peers.size());
+	peers.for_each([this, array](asQWORD peer_id, network_peer_data& d) {
+		network_peer_stats* st = make_peer_stats(peer_id, d);
+		array->InsertLast(&st);
+		st->release();
+	});
+	return array;
+}
+
 bool network::send(asQWORD peer_id, const std::string& message, unsigned char channel, bool reliable) {
 	if (!host || channel > channel_count) return false;
-	ENetPeer* peer = get_peer(peer_id);
-	if (peer_id && !peer) return false;
+	if (!reliable && coalesced_channels[channel]) return coalesce(peer_id, message, channel);
+	if (!io_thread.joinable() && peer_id && !get_peer(peer_id)) return false;
 	ENetPacket* packet = enet_packet_create(message.c_str(), message.size(), (reliable ? ENET_PACKET_FLAG_RELIABLE : 0));
 	if (!packet) return false;
+	return send_packet(peer_id, packet, channel);
+}
+// Takes ownership of the packet, destroying it if it couldn't be sent.
+bool network::send_packet(asQWORD peer_id, ENetPacket* packet, unsigned char channel) {
+	if (io_thread.joinable()) {
+		// Queued without locking, the I/O thread drops it if the peer is gone by the time it's sent.
+		outbound.push(new network_outgoing_packet {nullptr, packet, peer_id, channel});
+		outbound_cv.notify_one();
+		return true;
+	}
+	network_peer_data* d = get_peer_data(peer_id);
+	if (peer_id && !d) {
+		enet_packet_destroy(packet);
+		return false;
+	}
+	size_t size = packet->dataLength;
 	bool r = true;
-	if (peer_id) r = enet_peer_send(peer, channel, packet) == 0;
-	else enet_host_broadcast(host, channel, packet);
+	if (peer_id) r = peer_send(*d, channel, packet);
+	else broadcast_packet(channel, packet);
 	if (!r) enet_packet_destroy(packet);
+	else count_sent(peer_id, size);
 	return r;
 }
+// Hands a packet to ENet, or queues it for the scheduler if its channel has QoS. Like enet_peer_send, the packet is only referenced if this returns true, so callers still destroy unreferenced packets themselves.
+bool network::peer_send(network_peer_data& d, unsigned char channel, ENetPacket* packet) {
+	if (!qos_channels[channel]) return enet_send(d, channel, packet);
+	if (d.qos.size() <= channel) d.qos.resize(channel + 1);
+	packet->referenceCount++;
+	d.qos[channel].packets.push_back(packet);
+	d.qos_queued_bytes += packet->dataLength;
+	qos_queued_bytes += packet->dataLength;
+	return true;
+}
+// Takes ownership of the packet like enet_host_broadcast. Unreliable packets go through enet_send peer by peer, since each connection frames its own channels.
+void network::broadcast_packet(unsigned char channel, ENetPacket* packet) {
+	if (!qos_channels[channel] && !encrypted && (packet->flags & ENET_PACKET_FLAG_RELIABLE)) {
+		enet_host_broadcast(host, channel, packet);
+		return;
+	}
+	peers.for_each([this, channel, packet](asQWORD, network_peer_data& d) { peer_send(d, channel, packet); });
+	if (packet->referenceCount == 0) enet_packet_destroy(packet);
+}
+static void ENET_CALLBACK release_original(ENetPacket* copy) {
+	ENetPacket* original = reinterpret_cast<ENetPacket*>(copy->userData);
+	if (--original->referenceCount == 0) enet_packet_destroy(original);
+}
+// Makes copy hold a reference to original until ENet is done with the copy.
+static void hold_original(ENetPacket* copy, ENetPacket* original) {
+	original->referenceCount++;
+	copy->userData = original;
+	copy->freeCallback = release_original;
+}
+// Every packet for a known peer reaches ENet through here. On a channel the peer's connection frames, a plain unreliable message goes out as a bundle of one. A bundle for a peer whose connection doesn't frame the channel is split back into plain messages instead. Either way the packets made here hold a reference to the original until ENet is done with them, so callers can treat it exactly as if ENet had taken it.
+bool network::enet_send(network_peer_data& d, unsigned char channel, ENetPacket* packet) {
+	bool framed = d.frames(channel) && !(packet->flags & ENET_PACKET_FLAG_RELIABLE), bundle = packet->userData == &network_bundle_tag;
+	if (framed == bundle) return enet_deliver(d, channel, packet);
+	std::vector<ENetPacket*> copies;
+	if (framed) {
+		std::string bundle_of_one;
+		write_varint(bundle_of_one, packet->dataLength);
+		bundle_of_one.append((const char*)packet->data, packet->dataLength);
+		copies.push_back(enet_packet_create(bundle_of_one.data(), bundle_of_one.size(), packet->flags));
+	} else {
+		size_t pos = 0, message_length;
+		while (pos < packet->dataLength && read_varint(packet->data, packet->dataLength, pos, message_length)) {
+			copies.push_back(enet_packet_create(packet->data + pos, message_length, packet->flags));
+			pos += message_length;
+		}
+	}
+	ENetPacket* last = nullptr;
+	for (ENetPacket* p : copies) {
+		if (p && enet_deliver(d, channel, p)) last = p;
+		else if (p) enet_packet_destroy(p);
+	}
+	if (!last) return false;
+	hold_original(last, packet);
+	return true;
+}
+// With encryption on, ENet gets a sealed copy for the peer.
+bool network::enet_deliver(network_peer_data& d, unsigned char channel, ENetPacket* packet) {
+	if (!encrypted) return enet_peer_send(d.peer, channel, packet) == 0;
+	ENetPacket* sealed = d.crypto ? network_crypto_seal(*d.crypto, channel, packet) : nullptr;
+	if (!sealed) return false;
+	if (enet_peer_send(d.peer, channel, sealed) != 0) {
+		enet_packet_destroy(sealed);
+		return false;
+	}
+	hold_original(sealed, packet);
+	return true;
+}
+static void release_queued_packet(ENetPacket* packet) {
+	if (--packet->referenceCount == 0) enet_packet_destroy(packet);
+}
+// Empties the peer's queues, handing the packets to ENet first if send is set.
+void network::drop_qos(network_peer_data& d, bool send) {
+	for (size_t ch = 0; ch < d.qos.size(); ch++) {
+		for (ENetPacket* p : d.qos[ch].packets) {
+			if (send) enet_send(d, ch, p);
+			release_queued_packet(p);
+		}
+		d.qos[ch].packets.clear();
+	}
+	qos_queued_bytes -= d.qos_queued_bytes;
+	d.qos_queued_bytes = 0;
+}
+// Runs once per service, with the host locked or from the I/O thread.
+void network::schedule_qos() {
+	if (!qos_queued_bytes) return;
+	enet_uint32 now = enet_time_get();
+	peers.for_each([this, now](asQWORD, network_peer_data& d) {
+		if (d.qos_queued_bytes) schedule_peer(d, now);
+	});
+}
+// Weighted fair queuing by deficit round robin. A peer may be handed about as much as its reliable window has room for, at least an MTU, so that ENet's own queue stays short and anything sent on an unscheduled channel goes out right behind it. That allowance is split between the backlogged channels by weight, then the channels take turns sending one packet each while they have credit. A packet larger than a channel's share still goes, leaving the channel in debt for later ticks.
+void network::schedule_peer(network_peer_data& d, enet_uint32 now) {
+	ENetPeer* peer = d.peer;
+	long long allowance = peer->windowSize > peer->reliableDataInTransit ? peer->windowSize - peer->reliableDataInTransit : 0;
+	if (allowance < peer->mtu) allowance = peer->mtu;
+	enet_uint32 elapsed = now - d.qos_time;
+	d.qos_time = now;
+	unsigned long long total_weight = 0;
+	for (size_t ch = 0; ch < d.qos.size(); ch++) {
+		network_qos_queue& q = d.qos[ch];
+		const channel_qos& c = qos_settings[ch];
+		if (c.rate) {
+			long long burst = c.rate / 10 > peer->mtu ? c.rate / 10 : peer->mtu; // About 100ms worth.
+			q.tokens += (long long)c.rate * elapsed / 1000;
+			if (q.tokens > burst) q.tokens = burst;
+		}
+		if (!q.packets.empty() && (!c.rate || q.tokens > 0)) total_weight += c.weight ? c.weight : 1;
+	}
+	if (!total_weight) return;
+	for (size_t ch = 0; ch < d.qos.size(); ch++) {
+		network_qos_queue& q = d.qos[ch];
+		const channel_qos& c = qos_settings[ch];
+		if (q.packets.empty() || (c.rate && q.tokens <= 0)) continue;
+		q.credit += allowance * (c.weight ? c.weight : 1) / total_weight;
+		if (q.credit > allowance) q.credit = allowance;
+	}
+	for (bool sent = true; sent && allowance > 0;) {
+		sent = false;
+		for (size_t ch = 0; ch < d.qos.size() && allowance > 0; ch++) {
+			network_qos_queue& q = d.qos[ch];
+			const channel_qos& c = qos_settings[ch];
+			if (q.packets.empty() || q.credit <= 0 || (c.rate && q.tokens <= 0)) continue;
+			ENetPacket* packet = q.packets.front();
+			q.packets.pop_front();
+			long long size = packet->dataLength;
+			q.credit -= size;
+			if (c.rate) q.tokens -= size;
+			allowance -= size;
+			d.qos_queued_bytes -= size;
+			qos_queued_bytes -= size;
+			enet_send(d, ch, packet); // If ENet refuses, dropping our reference destroys the packet.
+			release_queued_packet(packet);
+			sent = true;
+		}
+	}
+	for (network_qos_queue& q : d.qos) {
+		if (q.packets.empty() && q.credit > 0) q.credit = 0; // Idle channels don't save up credit.
+	}
+}
+void network::set_channel_qos(unsigned char channel, unsigned int weight, unsigned int max_bytes_per_second) {
+	auto lock = lock_host();
+	qos_settings[channel].weight = weight;
+	qos_settings[channel].rate = max_bytes_per_second;
+	qos_channels[channel] = weight || max_bytes_per_second; // Packets already queued on a channel that is no longer scheduled still drain through the scheduler.
+}
+bool network::setup_encryption() {
+	if (!encrypted) return true;
+	if (encryption_key.empty()) return network_crypto_key_pair(encryption_secret, encryption_public_key);
+	memcpy(encryption_secret, encryption_key.data(), 32);
+	memcpy(encryption_public_key, network_crypto_public_key(encryption_key).data(), 32);
+	return true;
+}
+// Both ends must agree from the first packet, so this can't change while the network is set up.
+bool network::set_encryption(bool enabled, const std::string& key) {
+	if (host || (!key.empty() && key.size() != 32)) return false;
+	encrypted = enabled;
+	encryption_key = enabled ? key : "";
+	return true;
+}
+bool network_token_bucket::take(double cost, double rate, double burst, enet_uint32 now) {
+	if (tokens < 0) tokens = burst;
+	else {
+		tokens += double(now - time) * rate / 1000;
+		if (tokens > burst) tokens = burst;
+	}
+	time = now;
+	if (tokens < cost && tokens < burst) return false;
+	tokens -= cost;
+	return true;
+}
+// Called by ENet for every datagram it receives, a return of 1 drops the datagram before ENet looks at it.
+int ENET_CALLBACK network::intercept(ENetHost* host, ENetEvent* event) {
+	network* self = g_servicing_network;
+	if (!self || self->host != host || !self->connection_rate || host->receivedDataLength < 2) return 0;
+	enet_uint16 peer_id;
+	memcpy(&peer_id, host->receivedData, 2);
+	peer_id = ENET_NET_TO_HOST_16(peer_id) & ~(ENET_PROTOCOL_HEADER_FLAG_MASK | ENET_PROTOCOL_HEADER_SESSION_MASK);
+	if (peer_id != ENET_PROTOCOL_MAXIMUM_PEER_ID) return 0; // Only connection requests aren't addressed to a peer yet.
+	if (self->admit_connection(host->receivedAddress)) return 0;
+	self->rate_limited_connections++;
+	return 1;
+}
+bool network::admit_connection(const ENetAddress& address) {
+	enet_uint32 now = host->serviceTime;
+	if (connection_buckets.size() >= network_connection_bucket_purge_size && now - connection_buckets_purge_time >= 1000) {
+		for (auto it = connection_buckets.begin(); it != connection_buckets.end();) {
+			if (it->second.full(connection_rate, connection_burst, now)) it = connection_buckets.erase(it);
+			else it++;
+		}
+		connection_buckets_purge_time = now;
+	}
+	return connection_buckets[std::string((const char*)&address.host, sizeof(address.host))].take(1, connection_rate, connection_burst, now);
+}
+bool network::admit_message(network_peer_data& d, size_t bytes) {
+	enet_uint32 now = host->serviceTime;
+	if (peer_message_rate && !d.message_bucket.take(1, peer_message_rate, peer_message_rate, now)) return false;
+	return !peer_byte_rate || d.byte_bucket.take(double(bytes), peer_byte_rate, peer_byte_rate, now);
+}
+void network::set_connection_rate_limit(unsigned int connections_per_second, unsigned int burst) {
+	auto lock = lock_host();
+	connection_rate = connections_per_second;
+	connection_burst = burst ? burst : connections_per_second;
+	connection_buckets.clear();
+}
+void network::set_peer_rate_limit(unsigned int messages_per_second, unsigned int bytes_per_second, int action) {
+	auto lock = lock_host();
+	peer_message_rate = messages_per_second;
+	peer_byte_rate = bytes_per_second;
+	rate_limit_action = action;
+}
+bool network::coalesce(asQWORD peer_id, const std::string& message, unsigned char channel) {
+	if (!io_thread.joinable() && peer_id && !get_peer(peer_id)) return false;
+	size_t limit = host->mtu > 256 ? host->mtu - 64 : 1200; // Room for ENet's protocol and command headers, so a full bundle still fits in one datagram.
+	std::lock_guard<std::mutex> lock(coalesce_mutex);
+	std::string& buffer = coalesce_buffers[peer_id << 8 | channel];
+	if (!buffer.empty() && buffer.size() + message.size() + 4 > limit) {
+		ENetPacket* packet = enet_packet_create(buffer.data(), buffer.size(), 0);
+		buffer.clear();
+		if (packet) {
+			packet->userData = &network_bundle_tag;
+			send_packet(peer_id, packet, channel);
+		}
+	}
+	write_varint(buffer, message.size());
+	buffer.append(message);
+	return true;
+}
+bool network::flush_coalesced() {
+	std::lock_guard<std::mutex> lock(coalesce_mutex);
+	bool any = false;
+	for (auto it = coalesce_buffers.begin(); it != coalesce_buffers.end();) {
+		if (it->second.empty()) {
+			it++;
+			continue;
+		}
+		any = true;
+		ENetPacket* packet = enet_packet_create(it->second.data(), it->second.size(), 0);
+		it->second.clear(); // Keeps its capacity for the next tick.
+		if (packet) packet->userData = &network_bundle_tag;
+		if (!packet || !send_packet(it->first >> 8, packet, it->first & 0xff)) it = coalesce_buffers.erase(it); // The peer is gone.
+		else it++;
+	}
+	return any;
+}
+bool network::flush() {
+	if (!host) return false;
+	auto lock = lock_host();
+	flush_coalesced();
+	if (!io_thread.joinable()) {
+		schedule_qos();
+		enet_host_flush(host);
+	}
+	return true;
+}
+// One packet is shared by every peer's outgoing queue, ENet reference counts it and frees it after the last peer has sent it. Only if no peer accepted it do we destroy it ourselves.
+unsigned int network::send_many(CScriptArray* peer_ids, const std::string& message, unsigned char channel, bool reliable) {
+	if (!peer_ids || !peer_ids->GetSize()) return 0;
+	return send_many((const asQWORD*)peer_ids->At(0), peer_ids->GetSize(), message, channel, reliable);
+}
+unsigned int network::send_many(const asQWORD* peer_ids, size_t count, const std::string& message, unsigned char channel, bool reliable) {
+	if (!host || !count || channel > channel_count) return 0;
+	auto lock = lock_host();
+	ENetPacket* packet = enet_packet_create(message.c_str(), message.size(), (reliable ? ENET_PACKET_FLAG_RELIABLE : 0));
+	if (!packet) return 0;
+	unsigned int sent = 0;
+	for (size_t i = 0; i < count; i++) {
+		network_peer_data* d = get_peer_data(peer_ids[i]);
+		if (!d || !peer_send(*d, channel, packet)) continue;
+		d->bytes_sent += message.size();
+		d->packets_sent++;
+		sent++;
+	}
+	if (packet->referenceCount == 0) enet_packet_destroy(packet);
+	return sent;
+}
 bool network::send_peer(asQWORD peer, const std::string& message, unsigned char channel, bool reliable) {
 	if (!host || channel > channel_count) return false;
+	auto lock = lock_host();
 	ENetPeer* peer_obj = reinterpret_cast<ENetPeer*>(peer);
 	if (!peer_obj) return false;
 	ENetPacket* packet = enet_packet_create(message.c_str(), message.size(), (reliable ? ENET_PACKET_FLAG_RELIABLE : 0));
 	if (!packet) return false;
-	bool r = enet_peer_send(peer_obj, channel, packet) == 0;
+	network_peer_data* d = peers.find(peer_obj);
+	bool r = d ? peer_send(*d, channel, packet) : !encrypted && enet_peer_send(peer_obj, channel, packet) == 0;
 	if (!r) enet_packet_destroy(packet);
 	return r;
 }
 
 bool network::disconnect_peer_softly(asQWORD peer_id) {
 	if (!host) return false;
+	auto lock = lock_host();
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return false;
+	drop_qos(*get_peer_data(peer_id), true); // Softly means after everything already sent.
 	enet_peer_disconnect_later(peer, 0);
-	peers.erase(peer_id);
+	peers.close(peer_id);
 	return true;
 }
 bool network::disconnect_peer(asQWORD peer_id) {
 	if (!host) return false;
+	auto lock = lock_host();
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return false;
+	drop_qos(*get_peer_data(peer_id));
 	enet_peer_disconnect(peer, 0);
-	peers.erase(peer_id);
+	peers.close(peer_id);
 	return true;
 }
 bool network::disconnect_peer_forcefully(asQWORD peer_id) {
 	if (!host) return false;
+	auto lock = lock_host();
 	ENetPeer* peer = get_peer(peer_id);
 	if (!peer) return false;
+	drop_qos(*get_peer_data(peer_id));
 	enet_peer_disconnect_now(peer, 0);
-	peers.erase(peer_id);
+	peers.release(peer); // ENet won't report this disconnection, so the slot is free straight away.
 	return true;
 }
 
@@ -212,54 +947,173 @@ CScriptArray* network::list_peers() {
 	asITypeInfo* arrayType = get_array_type("uint64[]");
 	CScriptArray* array = CScriptArray::Create(arrayType);
 	if (!host) return array;
+	auto lock = lock_host();
 	array->Reserve(peers.size());
-	for (std::unordered_map<asQWORD, ENetPeer*>::iterator it = peers.begin(); it != peers.end(); it++) {
-		asQWORD peer = it->first;
-		array->InsertLast(&peer);
-	}
+	peers.for_each([array](asQWORD peer_id, network_peer_data&) { array->InsertLast(&peer_id); });
 	return array;
 }
 
+bool network::set_packet_compression_zstd(int level, const std::string& dictionary) {
+	if (!host) return false;
+	auto lock = lock_host();
+	return enet_host_compress_with_zstd(host, level, dictionary);
+}
+
 bool network::set_bandwidth_limits(unsigned int incoming, unsigned int outgoing) {
 	if (!host) return false;
+	auto lock = lock_host();
 	enet_host_bandwidth_limit(host, incoming, outgoing);
 	return true;
 }
 void network::set_packet_compression(bool flag) {
 	if (!host) return;
+	auto lock = lock_host();
 	if (flag) enet_host_compress_with_range_coder(host);
 	else enet_host_compress(host, nullptr);
 }
 
 
-network_event::network_event() {
+// Released events go back here instead of to the allocator. The pool is capped so that a burst of thousands of retained events doesn't pin that memory forever once the script lets go of them.
+static std::mutex g_network_event_pool_mutex;
+static std::vector<network_event*> g_network_event_pool;
+const size_t g_network_event_pool_max = 1024;
+// Several events can share one packet when it carried a bundle of coalesced messages, so a packet's reference count is managed atomically here and the last event to let go of it destroys it. ENet hands received packets over with a count of 0.
+static void retain_packet(ENetPacket* p) {
+	std::atomic_ref<size_t>(p->referenceCount).fetch_add(1);
+}
+static void release_packet(ENetPacket* p) {
+	if (std::atomic_ref<size_t>(p->referenceCount).fetch_sub(1) == 1) enet_packet_destroy(p);
+}
+network_event::network_event() : packet(nullptr), packet_offset(0), packet_length(0), message_ready(true) {
 	type = 0;
+	peer = 0;
 	peer_id = 0;
 	channel = 0;
-	message = "";
 	RefCount = 1;
 }
+network_event::~network_event() {
+	if (packet) release_packet(packet);
+}
+network_event* network_event::acquire() {
+	{
+		std::lock_guard<std::mutex> lock(g_network_event_pool_mutex);
+		if (!g_network_event_pool.empty()) {
+			network_event* e = g_network_event_pool.back();
+			g_network_event_pool.pop_back();
+			e->RefCount = 1;
+			return e;
+		}
+	}
+	return new network_event();
+}
+void network_event::reset() {
+	if (packet) release_packet(packet);
+	packet = nullptr;
+	message.clear(); // Keeps its capacity, so pooled events that carried strings before rarely reallocate.
+	message_ready = true;
+	type = 0;
+	peer = peer_id = 0;
+	channel = 0;
+}
 void network_event::addRef() {
 	asAtomicInc(RefCount);
 }
 void network_event::release() {
-	if (asAtomicDec(RefCount) < 1)
-		delete this;
+	if (asAtomicDec(RefCount) > 0) return;
+	reset();
+	std::lock_guard<std::mutex> lock(g_network_event_pool_mutex);
+	if (g_network_event_pool.size() < g_network_event_pool_max) g_network_event_pool.push_back(this);
+	else delete this;
 }
 network_event& network_event::operator=(const network_event& e) {
+	if (&e == this) return *this;
 	type = e.type;
 	peer_id = e.peer_id;
 	channel = e.channel;
-	message = e.message;
+	if (packet) release_packet(packet);
+	packet = nullptr;
+	message = e.get_message();
+	message_ready = true;
 	return *this;
 }
+void network_event::set_packet(ENetPacket* p) {
+	set_packet(p, 0, p ? p->dataLength : 0);
+}
+void network_event::set_packet(ENetPacket* p, size_t offset, size_t length) {
+	if (p) retain_packet(p);
+	if (packet) release_packet(packet);
+	packet = p;
+	packet_offset = offset;
+	packet_length = length;
+	message.clear();
+	message_ready = !p;
+}
+const std::string& network_event::get_message() const {
+	if (!message_ready) {
+		message.assign((const char*)packet->data + packet_offset, packet_length);
+		message_ready = true;
+	}
+	return message;
+}
+void network_event::set_message(const std::string& msg) {
+	set_packet(nullptr);
+	message = msg;
+}
+unsigned int network_event::get_message_length() const {
+	return packet ? packet_length : message.size();
+}
+const char* network_event::get_message_data() const {
+	return packet ? (const char*)packet->data + packet_offset : message.data();
+}
+// The bytes a message stream reads from. A received message keeps its own reference to the packet, and anything else is copied, so the stream stays valid however the event is reassigned or recycled afterward.
+struct network_message_buffer {
+	ENetPacket* packet;
+	std::string message;
+};
+void network_event_stream_close(datastream* ds) {
+	network_message_buffer* buffer = reinterpret_cast<network_message_buffer*>(ds->user);
+	if (!buffer) return;
+	if (buffer->packet) release_packet(buffer->packet);
+	delete buffer;
+}
+datastream* network_event::get_message_stream(const std::string& encoding, int byteorder) const {
+	network_message_buffer* buffer = new network_message_buffer {packet};
+	const char* data;
+	if (packet) {
+		retain_packet(packet);
+		data = (const char*)packet->data + packet_offset;
+	} else {
+		buffer->message = message;
+		data = buffer->message.data();
+	}
+	datastream* ds = new datastream(new Poco::MemoryInputStream(data, get_message_length()), encoding, byteorder);
+	ds->user = buffer;
+	ds->set_close_callback(network_event_stream_close);
+	return ds;
+}
 
 
+network_peer_stats::network_peer_stats() : RefCount(1), peer_id(0), round_trip_time(0), round_trip_time_variance(0), packet_loss(0), packet_loss_variance(0), packet_throttle(0), reliable_bytes_in_transit(0), reliable_commands_in_flight(0), mtu(0), bytes_sent(0), bytes_received(0), packets_sent(0), packets_received(0) {
+	memset(rtt_histogram, 0, sizeof(rtt_histogram));
+}
+void network_peer_stats::addRef() {
+	asAtomicInc(RefCount);
+}
+void network_peer_stats::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+CScriptArray* network_peer_stats::get_rtt_histogram() const {
+	CScriptArray* array = CScriptArray::Create(get_array_type("uint[]"), network_rtt_histogram_buckets);
+	for (int i = 0; i < network_rtt_histogram_buckets; i++) *(unsigned int*)array->At(i) = rtt_histogram[i];
+	return array;
+}
+
 network* ScriptNetwork_Factory() {
 	return new network();
 }
 network_event* ScriptNetwork_event_Factory() {
-	return new network_event();
+	return network_event::acquire();
 }
 
 void RegisterScriptNetwork(asIScriptEngine* engine) {
@@ -269,6 +1123,9 @@ void RegisterScriptNetwork(asIScriptEngine* engine) {
 	engine->RegisterEnumValue("network_event_type", "event_disconnect", ENET_EVENT_TYPE_DISCONNECT);
 	engine->RegisterEnumValue("network_event_type", "event_disconnect_timeout", ENET_EVENT_TYPE_DISCONNECT_TIMEOUT);
 	engine->RegisterEnumValue("network_event_type", "event_receive", ENET_EVENT_TYPE_RECEIVE);
+	engine->RegisterEnum("network_rate_limit_action");
+	engine->RegisterEnumValue("network_rate_limit_action", "rate_limit_drop", rate_limit_drop);
+	engine->RegisterEnumValue("network_rate_limit_action", "rate_limit_disconnect", rate_limit_disconnect);
 	engine->RegisterObjectType(_O("network_event"), 0, asOBJ_REF);
 	engine->RegisterObjectBehaviour(_O("network_event"), asBEHAVE_FACTORY, _O("network_event @e()"), asFUNCTION(ScriptNetwork_event_Factory), asCALL_CDECL);
 	engine->RegisterObjectBehaviour(_O("network_event"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network_event, addRef), asCALL_THISCALL);
@@ -277,7 +1134,29 @@ void RegisterScriptNetwork(asIScriptEngine* engine) {
 	engine->RegisterObjectProperty(_O("network_event"), _O("const network_event_type type"), asOFFSET(network_event, type));
 	engine->RegisterObjectProperty(_O("network_event"), _O("const uint64 peer_id"), asOFFSET(network_event, peer_id));
 	engine->RegisterObjectProperty(_O("network_event"), _O("const uint channel"), asOFFSET(network_event, channel));
-	engine->RegisterObjectProperty(_O("network_event"), _O("const string message"), asOFFSET(network_event, message));
+	engine->RegisterObjectMethod(_O("network_event"), _O("const string& get_message() const property"), asMETHOD(network_event, get_message), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_event"), _O("uint get_message_length() const property"), asMETHOD(network_event, get_message_length), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_event"), _O("datastream@ get_message_stream(const string&in encoding = \"\", int byteorder = STREAM_BYTE_ORDER_NATIVE) const"), asMETHOD(network_event, get_message_stream), asCALL_THISCALL);
+	engine->RegisterGlobalFunction(_O("string network_encryption_public_key(const string&in private_key)"), asFUNCTION(network_crypto_public_key), asCALL_CDECL);
+	engine->RegisterGlobalFunction(_O("string network_train_compression_dictionary(const string[]@ samples, uint max_size = 16384)"), asFUNCTION(network_train_compression_dictionary), asCALL_CDECL);
+	engine->RegisterObjectType(_O("network_peer_stats"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("network_peer_stats"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network_peer_stats, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("network_peer_stats"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(network_peer_stats, release), asCALL_THISCALL);
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint64 peer_id"), asOFFSET(network_peer_stats, peer_id));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint round_trip_time"), asOFFSET(network_peer_stats, round_trip_time));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint round_trip_time_variance"), asOFFSET(network_peer_stats, round_trip_time_variance));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const float packet_loss"), asOFFSET(network_peer_stats, packet_loss));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const float packet_loss_variance"), asOFFSET(network_peer_stats, packet_loss_variance));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const float packet_throttle"), asOFFSET(network_peer_stats, packet_throttle));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint reliable_bytes_in_transit"), asOFFSET(network_peer_stats, reliable_bytes_in_transit));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint reliable_commands_in_flight"), asOFFSET(network_peer_stats, reliable_commands_in_flight));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint mtu"), asOFFSET(network_peer_stats, mtu));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint64 bytes_sent"), asOFFSET(network_peer_stats, bytes_sent));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint64 bytes_received"), asOFFSET(network_peer_stats, bytes_received));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint64 packets_sent"), asOFFSET(network_peer_stats, packets_sent));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint64 packets_received"), asOFFSET(network_peer_stats, packets_received));
+	engine->RegisterObjectProperty(_O("network_peer_stats"), _O("const uint64 queued_bytes"), asOFFSET(network_peer_stats, queued_bytes));
+	engine->RegisterObjectMethod(_O("network_peer_stats"), _O("uint[]@ get_rtt_histogram() const"), asMETHOD(network_peer_stats, get_rtt_histogram), asCALL_THISCALL);
 	engine->RegisterObjectType(_O("network"), 0, asOBJ_REF);
 	engine->RegisterObjectBehaviour(_O("network"), asBEHAVE_FACTORY, _O("network @n()"), asFUNCTION(ScriptNetwork_Factory), asCALL_CDECL);
 	engine->RegisterObjectBehaviour(_O("network"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network, addRef), asCALL_THISCALL);
@@ -288,11 +1167,17 @@ void RegisterScriptNetwork(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod(_O("network"), _O("bool setup_local_server(uint16 port, uint8 max_channels, uint16 max_peers)"), asMETHOD(network, setup_local_server), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("uint64 connect(const string& in host, uint16 port)"), asMETHOD(network, connect), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("const network_event@ request(uint timeout = 0)"), asMETHOD(network, request), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("network_event@[]@ request_batch(uint max_events = 0, uint timeout = 0)"), asMETHOD(network, request_batch), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint get_last_batch_receives() const property"), asMETHOD(network, get_last_batch_receives), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint64 get_last_batch_received_bytes() const property"), asMETHOD(network, get_last_batch_received_bytes), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("string get_peer_address(uint64 peer_id) const"), asMETHOD(network, get_peer_address), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("uint get_peer_average_round_trip_time(uint64 peer_id) const"), asMETHOD(network, get_peer_average_round_trip_time), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("network_peer_stats@ get_peer_stats(uint64 peer_id) const"), asMETHOD(network, get_peer_stats), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("network_peer_stats@[]@ get_peer_stats() const"), asMETHOD(network, get_all_peer_stats), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send(uint64 peer_id, const string& in message, uint8 channel, bool reliable = true)"), asMETHOD(network, send), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_reliable(uint64 peer_id, const string& in message, uint8 channel)"), asMETHOD(network, send_reliable), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_unreliable(uint64 peer_id, const string& in message, uint8 channel)"), asMETHOD(network, send_unreliable), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint send_many(const uint64[]@ peer_ids, const string& in message, uint8 channel, bool reliable = true)"), asMETHODPR(network, send_many, (CScriptArray*, const std::string&, unsigned char, bool), unsigned int), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_peer(uint64 peer_pointer, const string& in message, uint8 channel, bool reliable = true)"), asMETHOD(network, send_peer), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_reliable_peer(uint64 peer_pointer, const string& in message, uint8 channel)"), asMETHOD(network, send_reliable_peer), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool send_unreliable_peer(uint64 peer_pointer, const string& in message, uint8 channel)"), asMETHOD(network, send_unreliable_peer), asCALL_THISCALL);
@@ -303,6 +1188,7 @@ void RegisterScriptNetwork(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod(_O("network"), _O("uint64 get_connected_peers() const property"), asMETHOD(network, get_connected_peers), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool get_packet_compression() const property"), asMETHOD(network, get_packet_compression), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("void set_packet_compression(bool compressed) property"), asMETHOD(network, set_packet_compression), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool set_packet_compression_zstd(int level = 3, const string&in dictionary = \"\")"), asMETHOD(network, set_packet_compression_zstd), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("uint get_duplicate_peers() const property"), asMETHOD(network, get_duplicate_peers), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("void set_duplicate_peers(uint max_duplicates) property"), asMETHOD(network, set_duplicate_peers), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("uint get_bytes_received() const property"), asMETHOD(network, get_bytes_received), asCALL_THISCALL);
@@ -311,6 +1197,30 @@ void RegisterScriptNetwork(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod(_O("network"), _O("uint get_packets_sent() const property"), asMETHOD(network, get_packets_sent), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("void set_bandwidth_limits(uint max_incoming_bytes_per_second, uint max_outgoing_bytes_per_second)"), asMETHOD(network, set_bandwidth_limits), asCALL_THISCALL);
 	engine->RegisterObjectMethod(_O("network"), _O("bool get_active() const property"), asMETHOD(network, active), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool flush()"), asMETHOD(network, flush), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool set_coalescing(uint8 channel, bool enabled)"), asMETHOD(network, set_coalescing), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool get_coalescing(uint8 channel) const"), asMETHOD(network, get_coalescing), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("void set_channel_qos(uint8 channel, uint weight, uint max_bytes_per_second = 0)"), asMETHOD(network, set_channel_qos), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint get_channel_qos_weight(uint8 channel) const"), asMETHOD(network, get_channel_qos_weight), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint get_channel_qos_rate(uint8 channel) const"), asMETHOD(network, get_channel_qos_rate), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("void set_connection_rate_limit(uint connections_per_second, uint burst = 0)"), asMETHOD(network, set_connection_rate_limit), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("void set_peer_rate_limit(uint messages_per_second, uint bytes_per_second = 0, network_rate_limit_action action = rate_limit_drop)"), asMETHOD(network, set_peer_rate_limit), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint get_connection_rate_limit() const property"), asMETHOD(network, get_connection_rate_limit), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint get_peer_message_rate_limit() const property"), asMETHOD(network, get_peer_message_rate_limit), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint get_peer_byte_rate_limit() const property"), asMETHOD(network, get_peer_byte_rate_limit), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint64 get_rate_limited_connections() const property"), asMETHOD(network, get_rate_limited_connections), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint64 get_rate_limited_messages() const property"), asMETHOD(network, get_rate_limited_messages), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool set_encryption(bool enabled, const string&in key = \"\")"), asMETHOD(network, set_encryption), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool get_encryption() const property"), asMETHOD(network, get_encryption), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("string get_encryption_public_key() const property"), asMETHOD(network, get_encryption_public_key), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("uint64 get_decryption_failures() const property"), asMETHOD(network, get_decryption_failures), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("bool get_threaded() const property"), asMETHOD(network, get_threaded), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network"), _O("void set_threaded(bool threaded) property"), asMETHOD(network, set_threaded), asCALL_THISCALL);
 	engine->RegisterObjectProperty(_O("network"), _O("bool IPV6enabled"), asOFFSET(network, IPv6enabled));
 	engine->RegisterObjectProperty(_O("network"), _O("bool receive_timeout_event"), asOFFSET(network, receive_timeout_event));
+	RegisterScriptNetworkCluster(engine);
+	RegisterScriptSnapshotReplication(engine);
+	RegisterScriptNetworkSimulator(engine);
+	RegisterScriptNetworkStreams(engine);
+	RegisterScriptNetworkInterest(engine);
 }
@@ -19,21 +19,225 @@
 #else
 	#include <cstring>
 #endif
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <string>
+#include <vector>
 #include <angelscript.h>
 #include <scriptarray.h>
+#include "network_encryption.h"
 
 extern bool g_enet_initialized;
 class network_event;
+extern network_event g_enet_none_event;
+// A lock-free, intrusive, multiple producer single consumer queue. Producers push onto an atomic stack, and the consumer takes the whole stack at once and reverses it so that items still come out in the order they went in. T must have a T* queue_next member.
+template <class T> class network_mpsc_queue {
+	std::atomic<T*> head;
+	T* pending; // Only touched by the consumer.
+public:
+	network_mpsc_queue() : head(nullptr), pending(nullptr) {}
+	void push(T* item) {
+		T* h = head.load(std::memory_order_relaxed);
+		do item->queue_next = h;
+		while (!head.compare_exchange_weak(h, item, std::memory_order_release, std::memory_order_relaxed));
+	}
+	T* pop() {
+		if (!pending) {
+			T* list = head.exchange(nullptr, std::memory_order_acquire);
+			while (list) {
+				T* next = list->queue_next;
+				list->queue_next = pending;
+				pending = list;
+				list = next;
+			}
+		}
+		T* item = pending;
+		if (item) pending = item->queue_next;
+		return item;
+	}
+};
+// A packet waiting for the I/O thread to hand it to ENet, a peer_id of 0 broadcasts.
+struct network_outgoing_packet {
+	network_outgoing_packet* queue_next;
+	ENetPacket* packet;
+	asQWORD peer_id;
+	unsigned char channel;
+};
+// One peer's queue of packets on a scheduled channel, see network::schedule_peer.
+struct network_qos_queue {
+	std::deque<ENetPacket*> packets; // Each holds a reference of ours until it is handed to ENet.
+	long long credit = 0; // The channel's weighted share of the peer's allowance, negative while it repays a packet larger than its share.
+	long long tokens = 0; // For the channel's byte rate limit.
+};
+// A token bucket for rate limiting incoming traffic. It starts full and refills at rate tokens per second up to burst. A cost is allowed while the bucket holds that much, or while it is full so that one message larger than the burst can still get through.
+struct network_token_bucket {
+	double tokens = -1; // Negative until first used.
+	enet_uint32 time = 0;
+	bool take(double cost, double rate, double burst, enet_uint32 now);
+	bool full(double rate, double burst, enet_uint32 now) const {
+		return tokens < 0 || tokens + double(now - time) * rate / 1000 >= burst;
+	}
+};
+enum network_rate_limit_action { rate_limit_drop, rate_limit_disconnect };
+// Per peer bookkeeping beyond what ENet keeps itself. ENet's own data counters are reset by its bandwidth throttle, so payload totals are counted here.
+const int network_rtt_sample_count = 128;
+struct network_peer_data {
+	ENetPeer* peer = nullptr;
+	asQWORD bytes_sent = 0, bytes_received = 0, packets_sent = 0, packets_received = 0;
+	enet_uint32 last_rtt_sample_time = 0;
+	unsigned int rtt_sample_total = 0;
+	unsigned short rtt_samples[network_rtt_sample_count]; // A ring of round trip times taken at most once a second while the peer is sending us data.
+	std::vector<network_qos_queue> qos; // Indexed by channel, grown when a scheduled channel is first used.
+	size_t qos_queued_bytes = 0;
+	enet_uint32 qos_time = 0;
+	network_token_bucket message_bucket, byte_bucket;
+	bool rate_limited = false; // Disconnected for flooding, anything more it sends is dropped.
+	std::unique_ptr<network_peer_crypto> crypto; // Set on connection while encryption is enabled.
+	enet_uint32 framed_channels = 0; // Bit n set if every unreliable packet on channel n of this connection, in either direction, is a bundle. Fixed by the client when it connects.
+	bool frames(unsigned char channel) const {
+		return channel < 32 && (framed_channels >> channel & 1);
+	}
+};
+// Only the first 32 channels can be framed, since the client advertises them in ENet's 32 bit connect data.
+inline enet_uint32 network_framed_channel_mask(unsigned int channel_count) {
+	return channel_count >= 32 ? 0xffffffff : (enet_uint32(1) << channel_count) - 1;
+}
+// Peers live in a dense array of slots, so a lookup by ID is an index instead of a hash. A peer ID holds its slot index + 1 in the low 32 bits and the slot's generation in the 24 bits above, and the generation is bumped whenever a slot is freed, so an ID kept after its peer left can't reach whoever took the slot next. A fresh network still hands out 1, 2, 3 and so on. The top 8 bits stay clear for network_cluster.
+// ENet peers store their slot index + 1 in their data pointer. A slot whose peer we've asked to disconnect is closed: ID lookups no longer find it, but it isn't reused until ENet reports the disconnection, so that event still carries the right ID.
+class network_peer_table {
+	struct slot {
+		network_peer_data data;
+		asUINT generation = 0;
+		asUINT live_position = 0; // Index into live while the slot is live.
+		bool used = false, closed = false;
+	};
+	std::vector<slot> slots;
+	std::vector<asUINT> free_slots;
+	std::vector<asUINT> live; // Live slot indices, packed so that broadcasts and peer lists walk a dense array.
+	static asUINT index_of(const ENetPeer* peer) {
+		return asUINT(reinterpret_cast<uintptr_t>(peer->data)) - 1;
+	}
+	void unlink(asUINT index);
+public:
+	asQWORD id_of(asUINT index) const {
+		return asQWORD(slots[index].generation) << 32 | (index + 1);
+	}
+	asQWORD id_of(const ENetPeer* peer) const {
+		return peer->data ? id_of(index_of(peer)) : 0;
+	}
+	asQWORD insert(ENetPeer* peer);
+	network_peer_data* find(asQWORD peer_id) {
+		asUINT index = asUINT(peer_id) - 1, generation = asUINT(peer_id >> 32);
+		if (index >= slots.size()) return nullptr;
+		slot& s = slots[index];
+		return s.used && !s.closed && s.generation == generation ? &s.data : nullptr;
+	}
+	network_peer_data* find(const ENetPeer* peer) {
+		if (!peer->data) return nullptr;
+		slot& s = slots[index_of(peer)];
+		return s.closed ? nullptr : &s.data;
+	}
+	bool close(asQWORD peer_id);
+	void release(ENetPeer* peer);
+	void clear();
+	void reserve(size_t count) {
+		slots.reserve(count);
+		live.reserve(count);
+	}
+	size_t size() const {
+		return live.size();
+	}
+	template <class F> void for_each(F f) {
+		for (asUINT index : live) f(id_of(index), slots[index].data);
+	}
+};
+class network_peer_stats;
+class network_cluster;
 class network {
 	int RefCount;
 	ENetHost* host;
-	std::unordered_map<asQWORD, ENetPeer*> peers;
-	asQWORD next_peer;
+	// Threaded mode. The I/O thread services the host continuously, so acknowledgements and resends no longer wait on the script's frame rate. Sends and received events pass through the lock-free queues, and anything else that touches the host takes host_mutex, which the I/O thread only holds while servicing.
+	bool threaded;
+	std::thread io_thread;
+	std::atomic<bool> io_thread_stop;
+	std::mutex host_mutex;
+	std::mutex inbound_mutex; // Serializes consumers of the inbound queue and backs inbound_cv.
+	std::condition_variable inbound_cv;
+	std::mutex outbound_wait_mutex;
+	std::condition_variable outbound_cv;
+	network_mpsc_queue<network_event> inbound;
+	network_mpsc_queue<network_outgoing_packet> outbound;
+	friend class network_cluster;
+	network_cluster* cluster; // Set when this network is one shard of a cluster, whose queue then receives its events.
+	unsigned int shard_index;
+	void io_thread_func();
+	void start_io_thread();
+	void stop_io_thread();
+	bool service_outbound();
+	network_event* pop_event(uint32_t timeout);
+	std::unique_lock<std::mutex> lock_host() {
+		return io_thread.joinable() ? std::unique_lock<std::mutex>(host_mutex) : std::unique_lock<std::mutex>();
+	}
+	network_peer_table peers;
 	unsigned char channel_count;
 	ENetPeer* get_peer(asQWORD peer_id);
+	network_peer_data* get_peer_data(asQWORD peer_id);
+	void count_sent(asQWORD peer_id, size_t bytes);
+	network_peer_stats* make_peer_stats(asQWORD peer_id, const network_peer_data& data);
+	void queue_event(ENetEvent& event, std::deque<network_event*>& out);
+	network_event* next_event(uint32_t timeout, bool service);
+	std::deque<network_event*> ready_events; // Translated events not yet returned, usually the rest of a coalesced bundle.
+	bool send_packet(asQWORD peer_id, ENetPacket* packet, unsigned char channel);
+	// Quality of service. Packets on channels given a weight or a byte rate don't go to ENet directly, they wait in per peer queues from which the scheduler hands ENet only what it can put on the wire soon, sharing that between channels by weight. Channels without QoS skip the queues, which makes them the most urgent.
+	struct channel_qos {
+		unsigned int weight = 0, rate = 0;
+	} qos_settings[256];
+	std::bitset<256> qos_channels;
+	size_t qos_queued_bytes;
+	bool peer_send(network_peer_data& d, unsigned char channel, ENetPacket* packet);
+	void broadcast_packet(unsigned char channel, ENetPacket* packet);
+	void schedule_qos();
+	void schedule_peer(network_peer_data& d, enet_uint32 now);
+	void drop_qos(network_peer_data& d, bool send = false);
+	// Rate limiting. Connection attempts are limited per IP address in ENet's intercept callback, before ENet allocates a peer for them. Messages are limited per peer as ENet's events are translated, before any network_event is made for them.
+	unsigned int connection_rate, connection_burst, peer_message_rate, peer_byte_rate;
+	int rate_limit_action;
+	std::unordered_map<std::string, network_token_bucket> connection_buckets; // Keyed by the raw IP address.
+	enet_uint32 connection_buckets_purge_time;
+	std::atomic<asQWORD> rate_limited_connections, rate_limited_messages;
+	static int ENET_CALLBACK intercept(ENetHost* host, ENetEvent* event);
+	bool admit_connection(const ENetAddress& address);
+	bool admit_message(network_peer_data& d, size_t bytes);
+	// Encryption, see network_encryption.h. A server's static key pair is fixed at setup, from the key given to set_encryption() or at random. A client instead uses that key to check the server's.
+	bool encrypted;
+	std::string encryption_key;
+	unsigned char encryption_secret[32], encryption_public_key[32];
+	std::atomic<asQWORD> decryption_failures;
+	bool setup_encryption();
+	bool enet_send(network_peer_data& d, unsigned char channel, ENetPacket* packet);
+	bool enet_deliver(network_peer_data& d, unsigned char channel, ENetPacket* packet);
+	bool receive_encrypted(network_peer_data& d, ENetEvent& event, size_t& offset, size_t& length, std::deque<network_event*>& out);
+	// Coalescing. Unreliable messages on a coalescing channel are buffered per peer and channel and go out as one length prefixed bundle per MTU when the script next calls request() or flush(). Whether a packet is a bundle is never guessed from its contents: a client lists the channels it coalesces on in its connect data, and on those channels of that connection every unreliable packet in either direction is a bundle, possibly of one message. enet_send frames or splits packets to suit each connection, and the receiver splits only on channels the connection frames.
+	std::bitset<256> coalesced_channels;
+	enet_uint32 get_framed_channels() const {
+		enet_uint32 mask = 0;
+		for (unsigned int ch = 0; ch < 32 && ch < channel_count; ch++) mask |= enet_uint32(coalesced_channels[ch]) << ch;
+		return mask;
+	}
+	std::mutex coalesce_mutex;
+	std::unordered_map<asQWORD, std::string> coalesce_buffers; // Keyed by peer_id << 8 | channel.
+	bool coalesce(asQWORD peer_id, const std::string& message, unsigned char channel);
+	bool flush_coalesced();
+	unsigned int last_batch_receives;
+	asQWORD last_batch_received_bytes;
 	// Enet's total_sent/received counters are 32 bit integers that can overflow, work around that
 	asQWORD total_sent_data, total_sent_packets, total_received_data, total_received_packets;
 	void update_totals() {
@@ -59,8 +263,18 @@ public:
 	bool setup_local_server(unsigned short port, unsigned char max_channels, unsigned short max_peers);
 	asQWORD connect(const std::string& hostname, unsigned short port);
 	const network_event* request(uint32_t timeout = 0);
+	CScriptArray* request_batch(unsigned int max_events = 0, uint32_t timeout = 0);
+	unsigned int get_last_batch_receives() const {
+		return last_batch_receives;
+	}
+	asQWORD get_last_batch_received_bytes() const {
+		return last_batch_received_bytes;
+	}
+	bool has_peer(asQWORD peer_id);
 	std::string get_peer_address(asQWORD peer_id);
 	unsigned int get_peer_average_round_trip_time(asQWORD peer_id);
+	network_peer_stats* get_peer_stats(asQWORD peer_id);
+	CScriptArray* get_all_peer_stats();
 	bool send(asQWORD peer_id, const std::string& message, unsigned char channel, bool reliable = true);
 	bool send_reliable(asQWORD peer_id, const std::string& message, unsigned char channel) {
 		return send(peer_id, message, channel);
@@ -68,6 +282,8 @@ public:
 	bool send_unreliable(asQWORD peer_id, const std::string& message, unsigned char channel) {
 		return send(peer_id, message, channel, false);
 	}
+	unsigned int send_many(CScriptArray* peer_ids, const std::string& message, unsigned char channel, bool reliable = true);
+	unsigned int send_many(const asQWORD* peer_ids, size_t count, const std::string& message, unsigned char channel, bool reliable = true);
 	bool send_peer(asQWORD peer, const std::string& message, unsigned char channel, bool reliable = true);
 	bool send_reliable_peer(asQWORD peer, const std::string& message, unsigned char channel) {
 		return send_peer(peer, message, channel);
@@ -81,6 +297,7 @@ public:
 	CScriptArray* list_peers();
 	bool set_bandwidth_limits(unsigned int incoming, unsigned int outgoing);
 	void set_packet_compression(bool flag);
+	bool set_packet_compression_zstd(int level, const std::string& dictionary);
 	bool get_packet_compression() {
 		return host && host->compressor.context;
 	}
@@ -88,18 +305,22 @@ public:
 		return host ? host->connectedPeers : -1;
 	}
 	size_t get_bytes_received() {
+		auto lock = lock_host();
 		update_totals();
 		return host ? total_received_data : -1;
 	}
 	size_t get_bytes_sent() {
+		auto lock = lock_host();
 		update_totals();
 		return host ? total_sent_data : -1;
 	}
 	size_t get_packets_received() {
+		auto lock = lock_host();
 		update_totals();
 		return host ? total_received_packets : -1;
 	}
 	size_t get_packets_sent() {
+		auto lock = lock_host();
 		update_totals();
 		return host ? total_sent_packets : -1;
 	}
@@ -112,19 +333,99 @@ public:
 	bool active() {
 		return host != NULL;
 	}
+	bool get_threaded() const {
+		return threaded;
+	}
+	void set_threaded(bool enabled);
+	bool flush();
+	void set_channel_qos(unsigned char channel, unsigned int weight, unsigned int max_bytes_per_second = 0);
+	unsigned int get_channel_qos_weight(unsigned char channel) const {
+		return qos_settings[channel].weight;
+	}
+	unsigned int get_channel_qos_rate(unsigned char channel) const {
+		return qos_settings[channel].rate;
+	}
+	void set_connection_rate_limit(unsigned int connections_per_second, unsigned int burst = 0);
+	void set_peer_rate_limit(unsigned int messages_per_second, unsigned int bytes_per_second = 0, int action = rate_limit_drop);
+	unsigned int get_connection_rate_limit() const {
+		return connection_rate;
+	}
+	unsigned int get_peer_message_rate_limit() const {
+		return peer_message_rate;
+	}
+	unsigned int get_peer_byte_rate_limit() const {
+		return peer_byte_rate;
+	}
+	asQWORD get_rate_limited_connections() const {
+		return rate_limited_connections;
+	}
+	asQWORD get_rate_limited_messages() const {
+		return rate_limited_messages;
+	}
+	bool set_encryption(bool enabled, const std::string& key = "");
+	bool get_encryption() const {
+		return encrypted;
+	}
+	std::string get_encryption_public_key() const {
+		return host && encrypted && !is_client ? std::string((const char*)encryption_public_key, 32) : "";
+	}
+	asQWORD get_decryption_failures() const {
+		return decryption_failures;
+	}
+	bool set_coalescing(unsigned char channel, bool enabled) {
+		if (channel >= 32) return false;
+		coalesced_channels[channel] = enabled;
+		return true;
+	}
+	bool get_coalescing(unsigned char channel) const {
+		return coalesced_channels[channel];
+	}
 };
+// Events are recycled through a small pool rather than being allocated for every packet, and a received packet's bytes stay in the ENetPacket that carried them until something actually asks for the message string.
+class datastream;
 class network_event {
+	ENetPacket* packet;
+	size_t packet_offset, packet_length; // The message may be one slice of a coalesced packet.
+	mutable std::string message;
+	mutable bool message_ready;
+	void reset();
 public:
 	int type;
 	asQWORD peer;
 	asQWORD peer_id;
 	unsigned int channel;
-	std::string message;
 	int RefCount;
+	network_event* queue_next; // Used while the event waits in a threaded network's inbound queue.
 	network_event();
+	~network_event();
+	static network_event* acquire();
 	network_event& operator=(const network_event& e);
 	void addRef();
 	void release();
+	void set_packet(ENetPacket* p);
+	void set_packet(ENetPacket* p, size_t offset, size_t length);
+	const std::string& get_message() const;
+	void set_message(const std::string& msg);
+	unsigned int get_message_length() const;
+	const char* get_message_data() const;
+	datastream* get_message_stream(const std::string& encoding, int byteorder) const;
+};
+
+// A snapshot of one peer's transport statistics, taken in a single call so that monitoring many peers doesn't cost a trip into native code per number.
+const int network_rtt_histogram_buckets = 8; // Bucket upper bounds are 10, 20, 40, 80, 160, 320 and 640ms, the last bucket catches everything slower.
+class network_peer_stats {
+public:
+	int RefCount;
+	asQWORD peer_id;
+	unsigned int round_trip_time, round_trip_time_variance;
+	float packet_loss, packet_loss_variance, packet_throttle;
+	unsigned int reliable_bytes_in_transit, reliable_commands_in_flight, mtu;
+	asQWORD bytes_sent, bytes_received, packets_sent, packets_received, queued_bytes;
+	unsigned int rtt_histogram[network_rtt_histogram_buckets];
+	network_peer_stats();
+	void addRef();
+	void release();
+	CScriptArray* get_rtt_histogram() const;
 };
 
 void RegisterScriptNetwork(asIScriptEngine* engine);
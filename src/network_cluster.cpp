@@ -0,0 +1,213 @@
+/* network_cluster.cpp - a server spread across several threaded ENet hosts
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <chrono>
+#include <obfuscate.h>
+#include <scriptarray.h>
+#include "nvgt_angelscript.h" // get_array_type
+#include "network_cluster.h"
+
+network_cluster::network_cluster() : RefCount(1), first_port(0) {}
+network_cluster::~network_cluster() {
+	destroy();
+}
+void network_cluster::addRef() {
+	asAtomicInc(RefCount);
+}
+void network_cluster::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+
+// Called from each shard's I/O thread.
+void network_cluster::deliver(unsigned int shard, std::deque<network_event*>& events) {
+	if (events.empty()) return;
+	for (network_event* e : events) {
+		e->peer_id = global_peer_id(shard, e->peer_id);
+		inbound.push(e);
+	}
+	events.clear();
+	{ std::lock_guard<std::mutex> lock(inbound_mutex); } // See network::io_thread_func.
+	inbound_cv.notify_all();
+}
+network_event* network_cluster::pop_event(uint32_t timeout) {
+	std::unique_lock<std::mutex> lock(inbound_mutex);
+	network_event* e = inbound.pop();
+	if (!e && timeout > 0) inbound_cv.wait_for(lock, std::chrono::milliseconds(timeout), [&] { return (e = inbound.pop()) != nullptr; });
+	return e;
+}
+network* network_cluster::shard_for(asQWORD peer_id, asQWORD& local_id) const {
+	unsigned int shard = peer_id & 0xff;
+	local_id = peer_id >> 8;
+	return local_id && shard < shards.size() ? shards[shard] : nullptr;
+}
+
+bool network_cluster::setup(unsigned short port, unsigned int shard_count, unsigned char max_channels, unsigned short max_peers_per_shard, bool local) {
+	if (!shards.empty() || shard_count < 1 || shard_count > 256 || port + shard_count - 1 > 65535) return false;
+	for (unsigned int i = 0; i < shard_count; i++) {
+		network* n = new network();
+		n->cluster = this;
+		n->shard_index = i;
+		n->set_threaded(true);
+		shards.push_back(n);
+		if (!(local ? n->setup_local_server(port + i, max_channels, max_peers_per_shard) : n->setup_server(port + i, max_channels, max_peers_per_shard))) {
+			destroy(false);
+			return false;
+		}
+	}
+	first_port = port;
+	return true;
+}
+void network_cluster::destroy(bool flush) {
+	for (network* n : shards) {
+		n->destroy(flush); // Joins the shard's I/O thread, so nothing delivers to us after this.
+		n->cluster = nullptr;
+		n->release();
+	}
+	shards.clear();
+	std::lock_guard<std::mutex> lock(inbound_mutex);
+	while (network_event* e = inbound.pop()) e->release();
+}
+
+const network_event* network_cluster::request(uint32_t timeout) {
+	for (network* n : shards) n->flush_coalesced();
+	network_event* e = shards.empty() ? nullptr : pop_event(timeout);
+	if (e) return e;
+	g_enet_none_event.addRef();
+	return &g_enet_none_event;
+}
+CScriptArray* network_cluster::request_batch(unsigned int max_events, uint32_t timeout) {
+	CScriptArray* array = CScriptArray::Create(get_array_type("array<network_event@>"));
+	if (shards.empty()) return array;
+	for (network* n : shards) n->flush_coalesced();
+	network_event* e = pop_event(timeout);
+	while (e) {
+		array->InsertLast(&e);
+		e->release();
+		if (max_events && array->GetSize() >= max_events) break;
+		e = pop_event(0);
+	}
+	return array;
+}
+
+bool network_cluster::send(asQWORD peer_id, const std::string& message, unsigned char channel, bool reliable) {
+	if (!peer_id) {
+		bool r = !shards.empty();
+		for (network* n : shards) r = n->send(0, message, channel, reliable) && r;
+		return r;
+	}
+	asQWORD local_id;
+	network* n = shard_for(peer_id, local_id);
+	return n && n->send(local_id, message, channel, reliable);
+}
+// Splits the list by shard so that each shard still shares one packet between all of its recipients.
+unsigned int network_cluster::send_many(CScriptArray* peer_ids, const std::string& message, unsigned char channel, bool reliable) {
+	if (!peer_ids || shards.empty()) return 0;
+	std::vector<std::vector<asQWORD>> per_shard(shards.size());
+	for (asUINT i = 0; i < peer_ids->GetSize(); i++) {
+		asQWORD local_id;
+		network* n = shard_for(*(asQWORD*)peer_ids->At(i), local_id);
+		if (n) per_shard[n->shard_index].push_back(local_id);
+	}
+	unsigned int sent = 0;
+	for (size_t i = 0; i < per_shard.size(); i++) {
+		if (!per_shard[i].empty()) sent += shards[i]->send_many(per_shard[i].data(), per_shard[i].size(), message, channel, reliable);
+	}
+	return sent;
+}
+bool network_cluster::disconnect_peer(asQWORD peer_id) {
+	asQWORD local_id;
+	network* n = shard_for(peer_id, local_id);
+	return n && n->disconnect_peer(local_id);
+}
+bool network_cluster::disconnect_peer_softly(asQWORD peer_id) {
+	asQWORD local_id;
+	network* n = shard_for(peer_id, local_id);
+	return n && n->disconnect_peer_softly(local_id);
+}
+bool network_cluster::disconnect_peer_forcefully(asQWORD peer_id) {
+	asQWORD local_id;
+	network* n = shard_for(peer_id, local_id);
+	return n && n->disconnect_peer_forcefully(local_id);
+}
+std::string network_cluster::get_peer_address(asQWORD peer_id) {
+	asQWORD local_id;
+	network* n = shard_for(peer_id, local_id);
+	return n ? n->get_peer_address(local_id) : "";
+}
+unsigned int network_cluster::get_peer_average_round_trip_time(asQWORD peer_id) {
+	asQWORD local_id;
+	network* n = shard_for(peer_id, local_id);
+	return n ? n->get_peer_average_round_trip_time(local_id) : -1;
+}
+CScriptArray* network_cluster::list_peers() {
+	CScriptArray* array = CScriptArray::Create(get_array_type("uint64[]"));
+	for (network* n : shards) {
+		CScriptArray* local = n->list_peers();
+		array->Reserve(array->GetSize() + local->GetSize());
+		for (asUINT i = 0; i < local->GetSize(); i++) {
+			asQWORD id = global_peer_id(n->shard_index, *(asQWORD*)local->At(i));
+			array->InsertLast(&id);
+		}
+		local->Release();
+	}
+	return array;
+}
+size_t network_cluster::get_connected_peers() {
+	size_t total = 0;
+	for (network* n : shards) total += n->get_connected_peers();
+	return total;
+}
+bool network_cluster::flush() {
+	for (network* n : shards) n->flush();
+	return !shards.empty();
+}
+network* network_cluster::get_shard(unsigned int index) {
+	if (index >= shards.size()) return nullptr;
+	shards[index]->addRef();
+	return shards[index];
+}
+// Spreads clients evenly over the shards by a stable hash of something that identifies them, such as an account name, so that a reconnecting client lands on the same shard.
+unsigned short network_cluster::connect_port(const std::string& client_key) const {
+	if (shards.empty()) return 0;
+	asQWORD h = 1469598103934665603ULL;
+	for (unsigned char c : client_key) h = (h ^ c) * 1099511628211ULL;
+	return first_port + h % shards.size();
+}
+
+network_cluster* ScriptNetwork_cluster_Factory() {
+	return new network_cluster();
+}
+void RegisterScriptNetworkCluster(asIScriptEngine* engine) {
+	engine->RegisterObjectType(_O("network_cluster"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("network_cluster"), asBEHAVE_FACTORY, _O("network_cluster @c()"), asFUNCTION(ScriptNetwork_cluster_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("network_cluster"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network_cluster, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("network_cluster"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(network_cluster, release), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("bool setup(uint16 port, uint shard_count, uint8 max_channels, uint16 max_peers_per_shard, bool local = false)"), asMETHOD(network_cluster, setup), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("void destroy(bool flush = true)"), asMETHOD(network_cluster, destroy), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("const network_event@ request(uint timeout = 0)"), asMETHOD(network_cluster, request), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("network_event@[]@ request_batch(uint max_events = 0, uint timeout = 0)"), asMETHOD(network_cluster, request_batch), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("bool send(uint64 peer_id, const string& in message, uint8 channel, bool reliable = true)"), asMETHOD(network_cluster, send), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("uint send_many(const uint64[]@ peer_ids, const string& in message, uint8 channel, bool reliable = true)"), asMETHOD(network_cluster, send_many), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("bool disconnect_peer(uint64 peer_id)"), asMETHOD(network_cluster, disconnect_peer), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("bool disconnect_peer_softly(uint64 peer_id)"), asMETHOD(network_cluster, disconnect_peer_softly), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("bool disconnect_peer_forcefully(uint64 peer_id)"), asMETHOD(network_cluster, disconnect_peer_forcefully), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("string get_peer_address(uint64 peer_id)"), asMETHOD(network_cluster, get_peer_address), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("uint get_peer_average_round_trip_time(uint64 peer_id)"), asMETHOD(network_cluster, get_peer_average_round_trip_time), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("uint64[]@ get_peer_list()"), asMETHOD(network_cluster, list_peers), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("uint64 get_connected_peers() property"), asMETHOD(network_cluster, get_connected_peers), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("bool flush()"), asMETHOD(network_cluster, flush), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("uint get_shard_count() const property"), asMETHOD(network_cluster, get_shard_count), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("network@ get_shard(uint index)"), asMETHOD(network_cluster, get_shard), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("uint16 connect_port(const string&in client_key) const"), asMETHOD(network_cluster, connect_port), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_cluster"), _O("bool get_active() const property"), asMETHOD(network_cluster, active), asCALL_THISCALL);
+}
@@ -0,0 +1,70 @@
+/* network_cluster.h - a server spread across several threaded ENet hosts
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <angelscript.h>
+#include "network.h"
+
+class CScriptArray;
+
+// One ENet host is serviced by one thread, which caps how many peers a single network can handle. A cluster runs several threaded networks (shards) on consecutive ports so that packet processing spreads across cores, and merges their events into one stream.
+// Peer IDs are made unique across shards by storing the shard in their low 8 bits, so a cluster has at most 256 shards.
+// ENet creates and binds its socket in one step, leaving no chance to set SO_REUSEPORT, so shards listen on a port range and clients pick one, for example with the connect_port() helper.
+class network_cluster {
+	int RefCount;
+	std::vector<network*> shards;
+	network_mpsc_queue<network_event> inbound; // Fed by every shard's I/O thread.
+	std::mutex inbound_mutex;
+	std::condition_variable inbound_cv;
+	unsigned short first_port;
+	network_event* pop_event(uint32_t timeout);
+	network* shard_for(asQWORD peer_id, asQWORD& local_id) const;
+public:
+	network_cluster();
+	~network_cluster();
+	void addRef();
+	void release();
+	void deliver(unsigned int shard, std::deque<network_event*>& events);
+	static asQWORD global_peer_id(unsigned int shard, asQWORD local_id) {
+		return local_id ? local_id << 8 | shard : 0;
+	}
+	bool setup(unsigned short port, unsigned int shard_count, unsigned char max_channels, unsigned short max_peers_per_shard, bool local = false);
+	void destroy(bool flush = true);
+	const network_event* request(uint32_t timeout = 0);
+	CScriptArray* request_batch(unsigned int max_events = 0, uint32_t timeout = 0);
+	bool send(asQWORD peer_id, const std::string& message, unsigned char channel, bool reliable = true);
+	unsigned int send_many(CScriptArray* peer_ids, const std::string& message, unsigned char channel, bool reliable = true);
+	bool disconnect_peer(asQWORD peer_id);
+	bool disconnect_peer_softly(asQWORD peer_id);
+	bool disconnect_peer_forcefully(asQWORD peer_id);
+	std::string get_peer_address(asQWORD peer_id);
+	unsigned int get_peer_average_round_trip_time(asQWORD peer_id);
+	CScriptArray* list_peers();
+	size_t get_connected_peers();
+	bool flush();
+	unsigned int get_shard_count() const {
+		return shards.size();
+	}
+	network* get_shard(unsigned int index);
+	unsigned short connect_port(const std::string& client_key) const;
+	bool active() const {
+		return !shards.empty();
+	}
+};
+
+void RegisterScriptNetworkCluster(asIScriptEngine* engine);
@@ -0,0 +1,104 @@
+/* network_compression.cpp - zstd packet compression for ENet hosts
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <cstring>
+#include <vector>
+#include <scriptarray.h>
+#include "network_compression.h"
+
+#ifndef NVGT_NO_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+
+struct zstd_compressor {
+	ZSTD_CCtx* cctx;
+	ZSTD_DCtx* dctx;
+	ZSTD_CDict* cdict;
+	ZSTD_DDict* ddict;
+	std::vector<unsigned char> gather; // ENet hands us a datagram as several buffers, zstd wants one.
+};
+static void zstd_compressor_destroy(void* context) {
+	zstd_compressor* c = reinterpret_cast<zstd_compressor*>(context);
+	ZSTD_freeCCtx(c->cctx);
+	ZSTD_freeDCtx(c->dctx);
+	ZSTD_freeCDict(c->cdict);
+	ZSTD_freeDDict(c->ddict);
+	delete c;
+}
+// Returning 0 tells ENet to send the datagram uncompressed, which we do whenever compression doesn't actually make it smaller.
+static size_t zstd_compressor_compress(void* context, const ENetBuffer* in_buffers, size_t in_buffer_count, size_t in_limit, enet_uint8* out_data, size_t out_limit) {
+	zstd_compressor* c = reinterpret_cast<zstd_compressor*>(context);
+	c->gather.resize(in_limit);
+	size_t pos = 0;
+	for (size_t i = 0; i < in_buffer_count && pos < in_limit; i++) {
+		size_t len = in_buffers[i].dataLength < in_limit - pos ? in_buffers[i].dataLength : in_limit - pos;
+		memcpy(c->gather.data() + pos, in_buffers[i].data, len);
+		pos += len;
+	}
+	size_t r = ZSTD_compress2(c->cctx, out_data, out_limit, c->gather.data(), pos);
+	if (ZSTD_isError(r) || r >= pos) return 0;
+	return r;
+}
+static size_t zstd_compressor_decompress(void* context, const enet_uint8* in_data, size_t in_limit, enet_uint8* out_data, size_t out_limit) {
+	zstd_compressor* c = reinterpret_cast<zstd_compressor*>(context);
+	size_t r = c->ddict ? ZSTD_decompress_usingDDict(c->dctx, out_data, out_limit, in_data, in_limit, c->ddict) : ZSTD_decompressDCtx(c->dctx, out_data, out_limit, in_data, in_limit);
+	return ZSTD_isError(r) ? 0 : r;
+}
+
+bool enet_host_compress_with_zstd(ENetHost* host, int level, const std::string& dictionary) {
+	if (!host) return false;
+	zstd_compressor* c = new zstd_compressor();
+	c->cctx = ZSTD_createCCtx();
+	c->dctx = ZSTD_createDCtx();
+	c->cdict = dictionary.empty() ? nullptr : ZSTD_createCDict(dictionary.data(), dictionary.size(), level);
+	c->ddict = dictionary.empty() ? nullptr : ZSTD_createDDict(dictionary.data(), dictionary.size());
+	if (!c->cctx || !c->dctx || (!dictionary.empty() && (!c->cdict || !c->ddict))) {
+		zstd_compressor_destroy(c);
+		return false;
+	}
+	// Every byte of frame header matters on a packet of a few dozen bytes. ENet already knows the decompressed size and checksums datagrams itself, and both ends know which dictionary is in use.
+	ZSTD_CCtx_setParameter(c->cctx, ZSTD_c_compressionLevel, level);
+	ZSTD_CCtx_setParameter(c->cctx, ZSTD_c_contentSizeFlag, 0);
+	ZSTD_CCtx_setParameter(c->cctx, ZSTD_c_checksumFlag, 0);
+	ZSTD_CCtx_setParameter(c->cctx, ZSTD_c_dictIDFlag, 0);
+	if (c->cdict) ZSTD_CCtx_refCDict(c->cctx, c->cdict);
+	ENetCompressor compressor;
+	compressor.context = c;
+	compressor.compress = zstd_compressor_compress;
+	compressor.decompress = zstd_compressor_decompress;
+	compressor.destroy = zstd_compressor_destroy;
+	enet_host_compress(host, &compressor);
+	return true;
+}
+
+std::string network_train_compression_dictionary(CScriptArray* samples, unsigned int max_size) {
+	if (!samples || !samples->GetSize() || max_size < 256) return "";
+	std::string buffer;
+	std::vector<size_t> sizes;
+	sizes.reserve(samples->GetSize());
+	for (asUINT i = 0; i < samples->GetSize(); i++) {
+		const std::string& s = *reinterpret_cast<const std::string*>(samples->At(i));
+		if (s.empty()) continue; // ZDICT rejects empty samples.
+		buffer += s;
+		sizes.push_back(s.size());
+	}
+	if (sizes.empty()) return "";
+	std::string dictionary(max_size, '\0');
+	size_t r = ZDICT_trainFromBuffer(&dictionary[0], dictionary.size(), buffer.data(), sizes.data(), unsigned(sizes.size()));
+	if (ZDICT_isError(r)) return "";
+	dictionary.resize(r);
+	return dictionary;
+}
+#else
+bool enet_host_compress_with_zstd(ENetHost* host, int level, const std::string& dictionary) { return false; }
+std::string network_train_compression_dictionary(CScriptArray* samples, unsigned int max_size) { return ""; }
+#endif
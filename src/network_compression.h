@@ -0,0 +1,23 @@
+/* network_compression.h - zstd packet compression for ENet hosts
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <enet6/enet.h>
+
+class CScriptArray;
+
+// Installs an ENetCompressor that compresses each outgoing datagram with zstd, optionally primed with a dictionary trained on typical traffic. Game packets are too small for a general purpose compressor to find much redundancy on their own, but a dictionary supplies it up front. Both ends must use the same dictionary. Returns false if NVGT was built without zstd (NVGT_NO_ZSTD) or the dictionary couldn't be loaded.
+bool enet_host_compress_with_zstd(ENetHost* host, int level, const std::string& dictionary);
+// Trains a dictionary from sample messages, such as packets recorded from a play session. Returns an empty string on failure, usually because there were too few samples.
+std::string network_train_compression_dictionary(CScriptArray* samples, unsigned int max_size);
@@ -0,0 +1,132 @@
+/* network_encryption.cpp - authenticated encryption of network traffic
+ * Like crypto.cpp, this relies on Monocypher for the primitives and has not been reviewed by a cryptography expert. Please report any weakness you find.
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <cstring>
+#include <rng_get_bytes.h>
+#include "monocypher.h"
+#include "network.h"
+#include "network_encryption.h"
+
+network_peer_crypto::network_peer_crypto(unsigned char channels) : send_counters(channels ? channels : 1, 0), receive_counters(channels ? channels : 1, 0), connect_event(nullptr), ready(false) {
+	memset(secret, 0, sizeof(secret));
+	memset(public_key, 0, sizeof(public_key));
+	memset(send_key, 0, sizeof(send_key));
+	memset(receive_key, 0, sizeof(receive_key));
+}
+network_peer_crypto::~network_peer_crypto() {
+	for (auto& p : early) enet_packet_destroy(p.second);
+	if (connect_event) connect_event->release();
+	crypto_wipe(secret, sizeof(secret));
+	crypto_wipe(send_key, sizeof(send_key));
+	crypto_wipe(receive_key, sizeof(receive_key));
+}
+
+bool network_crypto_key_pair(unsigned char secret[32], unsigned char public_key[32]) {
+	if (rng_get_bytes(secret, 32) != 32) return false;
+	crypto_x25519_public_key(public_key, secret);
+	return true;
+}
+std::string network_crypto_public_key(const std::string& secret) {
+	if (secret.size() != 32) return "";
+	std::string result(32, '\0');
+	crypto_x25519_public_key((uint8_t*)&result[0], (const uint8_t*)secret.data());
+	return result;
+}
+// Hashes both shared secrets and every public key into 64 bytes, the client to server key followed by the server to client key.
+static void derive_keys(const unsigned char dh_static[32], const unsigned char dh_ephemeral[32], const unsigned char client_public[32], const unsigned char server_static[32], const unsigned char server_ephemeral[32], unsigned char keys[64]) {
+	unsigned char input[160];
+	memcpy(input, dh_static, 32);
+	memcpy(input + 32, dh_ephemeral, 32);
+	memcpy(input + 64, client_public, 32);
+	memcpy(input + 96, server_static, 32);
+	memcpy(input + 128, server_ephemeral, 32);
+	crypto_blake2b(keys, 64, input, sizeof(input));
+	crypto_wipe(input, sizeof(input));
+}
+
+std::string network_crypto_hello(network_peer_crypto& c) {
+	if (!network_crypto_key_pair(c.secret, c.public_key)) return "";
+	std::string hello(1, char(network_crypto_handshake));
+	hello.append((const char*)c.public_key, 32);
+	return hello;
+}
+bool network_crypto_accept(network_peer_crypto& c, const unsigned char static_secret[32], const unsigned char static_public[32], const unsigned char* hello, size_t size, std::string& reply) {
+	if (size != 33 || hello[0] != network_crypto_handshake || !network_crypto_key_pair(c.secret, c.public_key)) return false;
+	const unsigned char* client_public = hello + 1;
+	unsigned char dh_static[32], dh_ephemeral[32], keys[64];
+	crypto_x25519(dh_static, static_secret, client_public);
+	crypto_x25519(dh_ephemeral, c.secret, client_public);
+	derive_keys(dh_static, dh_ephemeral, client_public, static_public, c.public_key, keys);
+	memcpy(c.receive_key, keys, 32);
+	memcpy(c.send_key, keys + 32, 32);
+	crypto_wipe(dh_static, 32);
+	crypto_wipe(dh_ephemeral, 32);
+	crypto_wipe(keys, 64);
+	crypto_wipe(c.secret, 32);
+	reply.assign(1, char(network_crypto_handshake));
+	reply.append((const char*)static_public, 32);
+	reply.append((const char*)c.public_key, 32);
+	c.ready = true;
+	return true;
+}
+bool network_crypto_finish(network_peer_crypto& c, const unsigned char* reply, size_t size, const std::string& pinned_key) {
+	if (size != 65 || reply[0] != network_crypto_handshake) return false;
+	const unsigned char* server_static = reply + 1, *server_ephemeral = reply + 33;
+	if (!pinned_key.empty() && crypto_verify32(server_static, (const uint8_t*)pinned_key.data()) != 0) return false;
+	unsigned char dh_static[32], dh_ephemeral[32], keys[64];
+	crypto_x25519(dh_static, c.secret, server_static);
+	crypto_x25519(dh_ephemeral, c.secret, server_ephemeral);
+	derive_keys(dh_static, dh_ephemeral, c.public_key, server_static, server_ephemeral, keys);
+	memcpy(c.send_key, keys, 32);
+	memcpy(c.receive_key, keys + 32, 32);
+	crypto_wipe(dh_static, 32);
+	crypto_wipe(dh_ephemeral, 32);
+	crypto_wipe(keys, 64);
+	crypto_wipe(c.secret, 32);
+	c.ready = true;
+	return true;
+}
+
+static void make_nonce(unsigned char nonce[24], asQWORD counter, unsigned char channel) {
+	memset(nonce, 0, 24);
+	for (int i = 0; i < 8; i++) nonce[i] = (unsigned char)(counter >> (i * 8));
+	nonce[8] = channel;
+}
+ENetPacket* network_crypto_seal(network_peer_crypto& c, unsigned char channel, const ENetPacket* packet) {
+	if (!c.ready || channel >= c.send_counters.size()) return nullptr;
+	ENetPacket* sealed = enet_packet_create(nullptr, packet->dataLength + network_crypto_overhead, packet->flags & (ENET_PACKET_FLAG_RELIABLE | ENET_PACKET_FLAG_UNSEQUENCED | ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT));
+	if (!sealed) return nullptr;
+	asQWORD counter = ++c.send_counters[channel];
+	unsigned char* out = sealed->data;
+	out[0] = network_crypto_sealed;
+	for (int i = 0; i < 8; i++) out[1 + i] = (unsigned char)(counter >> (i * 8));
+	unsigned char nonce[24];
+	make_nonce(nonce, counter, channel);
+	crypto_aead_lock(out + 9, out + 9 + packet->dataLength, c.send_key, nonce, nullptr, 0, packet->data, packet->dataLength);
+	return sealed;
+}
+bool network_crypto_open(network_peer_crypto& c, unsigned char channel, ENetPacket* packet, size_t& offset, size_t& length) {
+	if (!c.ready || channel >= c.receive_counters.size() || packet->dataLength < network_crypto_overhead || packet->data[0] != network_crypto_sealed) return false;
+	unsigned char* data = packet->data;
+	asQWORD counter = 0;
+	for (int i = 0; i < 8; i++) counter |= asQWORD(data[1 + i]) << (i * 8);
+	if (counter <= c.receive_counters[channel]) return false; // Replayed, or older than a packet we already accepted.
+	size_t size = packet->dataLength - network_crypto_overhead;
+	unsigned char nonce[24];
+	make_nonce(nonce, counter, channel);
+	if (crypto_aead_unlock(data + 9, data + 9 + size, c.receive_key, nonce, nullptr, 0, data + 9, size) != 0) return false;
+	c.receive_counters[channel] = counter;
+	offset = 9;
+	length = size;
+	return true;
+}
@@ -0,0 +1,52 @@
+/* network_encryption.h - authenticated encryption of network traffic
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <angelscript.h>
+#include <enet6/enet.h>
+
+class network_event;
+
+// When a network has encryption enabled, the client opens every connection with an X25519 handshake. It sends an ephemeral public key, and the server answers with its static public key and an ephemeral one of its own. Both sides hash the two resulting shared secrets into a key for each direction. Clients may pin the server's static key, which stops anyone else from completing the handshake in its place.
+// After that, every packet is sealed with XChaCha20-Poly1305. The nonce is a per channel counter, which is sent with the packet. ENet delivers each channel in order, so a receiver rejects any counter that isn't higher than the last one it accepted on that channel, and that stops replays.
+// Wire format: a kind byte. A handshake is followed by its keys. A sealed packet is followed by an 8 byte little endian counter, the ciphertext and a 16 byte MAC.
+const unsigned char network_crypto_handshake = 0, network_crypto_sealed = 1;
+const size_t network_crypto_overhead = 1 + 8 + 16;
+const size_t network_crypto_max_early_packets = 64; // Sealed packets a client keeps while it waits for the server's half of the handshake.
+struct network_peer_crypto {
+	unsigned char secret[32], public_key[32]; // Our ephemeral key pair for the handshake.
+	unsigned char send_key[32], receive_key[32];
+	std::vector<asQWORD> send_counters, receive_counters; // Indexed by channel.
+	std::deque<std::pair<unsigned char, ENetPacket*>> early; // Channel and packet.
+	network_event* connect_event; // Held back from the script until the handshake is done.
+	bool ready;
+	network_peer_crypto(unsigned char channels);
+	~network_peer_crypto();
+};
+
+bool network_crypto_key_pair(unsigned char secret[32], unsigned char public_key[32]);
+std::string network_crypto_public_key(const std::string& secret);
+// The client's opening message.
+std::string network_crypto_hello(network_peer_crypto& c);
+// Server side. Derives the session keys from a client's hello and fills reply with the answer.
+bool network_crypto_accept(network_peer_crypto& c, const unsigned char static_secret[32], const unsigned char static_public[32], const unsigned char* hello, size_t size, std::string& reply);
+// Client side. Derives the session keys from the server's answer. Fails if pinned_key isn't empty and doesn't match the server's static key.
+bool network_crypto_finish(network_peer_crypto& c, const unsigned char* reply, size_t size, const std::string& pinned_key);
+// Returns a new sealed copy of packet for the given channel, or null on failure.
+ENetPacket* network_crypto_seal(network_peer_crypto& c, unsigned char channel, const ENetPacket* packet);
+// Verifies and decrypts a sealed packet in place. On success, offset and length locate the plaintext within the packet.
+bool network_crypto_open(network_peer_crypto& c, unsigned char channel, ENetPacket* packet, size_t& offset, size_t& length);
@@ -0,0 +1,148 @@
+/* network_interest.cpp - area of interest management implementation
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <obfuscate.h>
+#include <Poco/Exception.h>
+#include <scriptarray.h>
+#include "nvgt_angelscript.h" // get_array_type
+#include "network.h"
+#include "network_interest.h"
+
+const int interest_max_cell_coordinate = 1 << 30; // Cell coordinates are clamped to this, far beyond any sensible world.
+
+network_interest_grid::network_interest_grid(network* net, float cell_size) : RefCount(1), net(net), cell_size(cell_size) {
+	if (!net) throw Poco::InvalidArgumentException("network_interest_grid requires a network");
+	if (!(cell_size > 0)) throw Poco::InvalidArgumentException("cell size must be greater than 0");
+	net->addRef();
+}
+network_interest_grid::~network_interest_grid() {
+	net->release();
+}
+void network_interest_grid::addRef() {
+	asAtomicInc(RefCount);
+}
+void network_interest_grid::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+
+int network_interest_grid::cell_coordinate(float v) const {
+	double c = std::floor(double(v) / cell_size);
+	if (!(c > -interest_max_cell_coordinate)) return c != c ? 0 : -interest_max_cell_coordinate; // NaN goes in cell 0.
+	if (c > interest_max_cell_coordinate) return interest_max_cell_coordinate;
+	return int(c);
+}
+// 21 bits per axis. Coordinates far enough apart to wrap onto the same key only share a cell list, the distance check still tells their peers apart.
+asQWORD network_interest_grid::cell_key(int cx, int cy, int cz) const {
+	return (asQWORD(cx) & 0x1fffff) << 42 | (asQWORD(cy) & 0x1fffff) << 21 | (asQWORD(cz) & 0x1fffff);
+}
+void network_interest_grid::unlink(asQWORD peer_id, const peer_entry& e) {
+	auto it = cells.find(e.cell);
+	std::vector<asQWORD>& list = it->second;
+	asQWORD moved = list.back();
+	list[e.cell_position] = moved;
+	peers[moved].cell_position = e.cell_position;
+	list.pop_back();
+	if (list.empty()) cells.erase(it);
+}
+
+void network_interest_grid::set_peer(asQWORD peer_id, float x, float y, float z, float radius) {
+	asQWORD key = cell_key(cell_coordinate(x), cell_coordinate(y), cell_coordinate(z));
+	auto it = peers.find(peer_id);
+	if (it != peers.end() && it->second.cell != key) {
+		unlink(peer_id, it->second);
+		peers.erase(it);
+		it = peers.end();
+	}
+	if (it == peers.end()) {
+		std::vector<asQWORD>& list = cells[key];
+		it = peers.emplace(peer_id, peer_entry {0, 0, 0, 0, key, list.size()}).first;
+		list.push_back(peer_id);
+	}
+	peer_entry& e = it->second;
+	e.x = x;
+	e.y = y;
+	e.z = z;
+	e.radius = radius;
+}
+bool network_interest_grid::remove_peer(asQWORD peer_id) {
+	auto it = peers.find(peer_id);
+	if (it == peers.end()) return false;
+	unlink(peer_id, it->second);
+	peers.erase(it);
+	return true;
+}
+void network_interest_grid::clear() {
+	peers.clear();
+	cells.clear();
+}
+
+// Fills found with the peers within radius of the point, leaving out any peer whose own radius is set and doesn't reach the point.
+void network_interest_grid::query(float x, float y, float z, float radius, asQWORD exclude_peer_id) {
+	found.clear();
+	if (!(radius >= 0)) return;
+	double r2 = double(radius) * radius;
+	auto consider = [&](asQWORD peer_id, const peer_entry& e) {
+		if (peer_id == exclude_peer_id) return;
+		double dx = e.x - x, dy = e.y - y, dz = e.z - z, d2 = dx * dx + dy * dy + dz * dz;
+		if (d2 > r2 || (e.radius > 0 && d2 > double(e.radius) * e.radius)) return;
+		found.push_back(peer_id);
+	};
+	int x0 = cell_coordinate(x - radius), x1 = cell_coordinate(x + radius);
+	int y0 = cell_coordinate(y - radius), y1 = cell_coordinate(y + radius);
+	int z0 = cell_coordinate(z - radius), z1 = cell_coordinate(z + radius);
+	double span = (double(x1) - x0 + 1) * (double(y1) - y0 + 1) * (double(z1) - z0 + 1);
+	if (span > cells.size()) {
+		// The sphere touches more cells than are occupied, so checking every peer is cheaper.
+		for (const auto& it : peers) consider(it.first, it.second);
+		return;
+	}
+	for (int cx = x0; cx <= x1; cx++) {
+		for (int cy = y0; cy <= y1; cy++) {
+			for (int cz = z0; cz <= z1; cz++) {
+				auto it = cells.find(cell_key(cx, cy, cz));
+				if (it == cells.end()) continue;
+				for (asQWORD peer_id : it->second) consider(peer_id, peers[peer_id]);
+			}
+		}
+	}
+}
+CScriptArray* network_interest_grid::get_nearby(float x, float y, float z, float radius, asQWORD exclude_peer_id) {
+	query(x, y, z, radius, exclude_peer_id);
+	CScriptArray* array = CScriptArray::Create(get_array_type("uint64[]"), found.size());
+	if (!found.empty()) memcpy(array->At(0), found.data(), found.size() * sizeof(asQWORD));
+	return array;
+}
+unsigned int network_interest_grid::send_nearby(float x, float y, float z, float radius, const std::string& message, unsigned char channel, bool reliable, asQWORD exclude_peer_id) {
+	query(x, y, z, radius, exclude_peer_id);
+	return net->send_many(found.data(), found.size(), message, channel, reliable);
+}
+
+network_interest_grid* ScriptNetwork_interest_grid_Factory(network* net, float cell_size) {
+	return new network_interest_grid(net, cell_size);
+}
+void RegisterScriptNetworkInterest(asIScriptEngine* engine) {
+	engine->RegisterObjectType(_O("network_interest_grid"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("network_interest_grid"), asBEHAVE_FACTORY, _O("network_interest_grid @g(network@+ net, float cell_size = 32)"), asFUNCTION(ScriptNetwork_interest_grid_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("network_interest_grid"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network_interest_grid, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("network_interest_grid"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(network_interest_grid, release), asCALL_THISCALL);
+	engine->RegisterObjectProperty(_O("network_interest_grid"), _O("const float cell_size"), asOFFSET(network_interest_grid, cell_size));
+	engine->RegisterObjectMethod(_O("network_interest_grid"), _O("void set_peer(uint64 peer_id, float x, float y, float z = 0, float radius = 0)"), asMETHOD(network_interest_grid, set_peer), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_interest_grid"), _O("bool remove_peer(uint64 peer_id)"), asMETHOD(network_interest_grid, remove_peer), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_interest_grid"), _O("bool has_peer(uint64 peer_id) const"), asMETHOD(network_interest_grid, has_peer), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_interest_grid"), _O("void clear()"), asMETHOD(network_interest_grid, clear), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_interest_grid"), _O("uint get_peer_count() const property"), asMETHOD(network_interest_grid, get_peer_count), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_interest_grid"), _O("uint64[]@ get_nearby(float x, float y, float z, float radius, uint64 exclude_peer_id = 0)"), asMETHOD(network_interest_grid, get_nearby), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_interest_grid"), _O("uint send_nearby(float x, float y, float z, float radius, const string& in message, uint8 channel, bool reliable = true, uint64 exclude_peer_id = 0)"), asMETHOD(network_interest_grid, send_nearby), asCALL_THISCALL);
+}
@@ -0,0 +1,58 @@
+/* network_interest.h - area of interest management for proximity based broadcasts
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <angelscript.h>
+
+class CScriptArray;
+class network;
+
+// Tracks where each peer is in a uniform grid of cubic cells, so that finding the peers near a point only looks at the cells the query's sphere touches rather than at every peer. send_nearby() then hands the recipients to network::send_many(), which shares one packet between them.
+class network_interest_grid {
+	struct peer_entry {
+		float x, y, z, radius;
+		asQWORD cell;
+		size_t cell_position; // Index into the cell's peer list.
+	};
+	int RefCount;
+	network* net;
+	std::unordered_map<asQWORD, peer_entry> peers;
+	std::unordered_map<asQWORD, std::vector<asQWORD>> cells; // Peer IDs by cell key, empty cells are removed.
+	std::vector<asQWORD> found; // Reused between queries.
+	asQWORD cell_key(int cx, int cy, int cz) const;
+	int cell_coordinate(float v) const;
+	void unlink(asQWORD peer_id, const peer_entry& e);
+	void query(float x, float y, float z, float radius, asQWORD exclude_peer_id);
+public:
+	float cell_size;
+	network_interest_grid(network* net, float cell_size);
+	~network_interest_grid();
+	void addRef();
+	void release();
+	void set_peer(asQWORD peer_id, float x, float y, float z, float radius);
+	bool remove_peer(asQWORD peer_id);
+	bool has_peer(asQWORD peer_id) const {
+		return peers.count(peer_id) > 0;
+	}
+	void clear();
+	unsigned int get_peer_count() const {
+		return peers.size();
+	}
+	CScriptArray* get_nearby(float x, float y, float z, float radius, asQWORD exclude_peer_id);
+	unsigned int send_nearby(float x, float y, float z, float radius, const std::string& message, unsigned char channel, bool reliable, asQWORD exclude_peer_id);
+};
+
+void RegisterScriptNetworkInterest(asIScriptEngine* engine);
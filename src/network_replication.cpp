@@ -0,0 +1,217 @@
+/* network_replication.cpp - snapshot delta replication implementation
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <obfuscate.h>
+#include <Poco/Exception.h>
+#include "network.h"
+#include "network_replication.h"
+
+// Message layout: a kind byte, then for snapshots the sequence, baseline sequence (0 for none) and snapshot length as 7 bit encoded integers followed by the packed delta, or for acknowledgements just the sequence.
+enum snapshot_message_kind { snapshot_message_snapshot = 1, snapshot_message_ack = 2 };
+const asQWORD snapshot_max_length = 16 * 1024 * 1024; // Unchanged data packs down to almost nothing, so the claimed length has to be capped before we allocate it.
+
+static void write_varint(std::string& out, asQWORD value) {
+	while (value >= 0x80) {
+		out.push_back(char((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.push_back(char(value));
+}
+static bool read_varint(const unsigned char*& data, const unsigned char* end, asQWORD& value) {
+	value = 0;
+	for (int shift = 0; data < end && shift < 64; shift += 7) {
+		unsigned char b = *data++;
+		value |= asQWORD(b & 0x7f) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+// The XOR of a snapshot with its baseline is mostly zero bytes. It is written in groups of 8 bytes, each led by a mask of which bytes are nonzero and followed by only those bytes. A zero mask is followed by a count of further all-zero groups, so a long unchanged stretch collapses to 2 or 3 bytes.
+void snapshot_delta_encode(const std::string& snapshot, const std::string& baseline, std::string& output) {
+	size_t size = snapshot.size();
+	auto delta = [&](size_t i) -> unsigned char { return (unsigned char)snapshot[i] ^ (i < baseline.size() ? (unsigned char)baseline[i] : 0); };
+	size_t groups = (size + 7) / 8;
+	for (size_t g = 0; g < groups;) {
+		unsigned char mask = 0;
+		size_t begin = g * 8, end = begin + 8 < size ? begin + 8 : size;
+		for (size_t i = begin; i < end; i++) {
+			if (delta(i)) mask |= 1 << (i - begin);
+		}
+		output.push_back(char(mask));
+		if (mask) {
+			for (size_t i = begin; i < end; i++) {
+				unsigned char d = delta(i);
+				if (d) output.push_back(char(d));
+			}
+			g++;
+			continue;
+		}
+		size_t run = 1;
+		for (; g + run < groups; run++) {
+			bool zero = true;
+			size_t rb = (g + run) * 8, re = rb + 8 < size ? rb + 8 : size;
+			for (size_t i = rb; i < re && zero; i++) zero = !delta(i);
+			if (!zero) break;
+		}
+		write_varint(output, run - 1);
+		g += run;
+	}
+}
+bool snapshot_delta_decode(const unsigned char* data, size_t size, const std::string& baseline, size_t snapshot_length, std::string& output) {
+	const unsigned char* end = data + size;
+	output.assign(snapshot_length, '\0');
+	size_t groups = (snapshot_length + 7) / 8;
+	for (size_t g = 0; g < groups;) {
+		if (data >= end) return false;
+		unsigned char mask = *data++;
+		if (!mask) {
+			asQWORD skip;
+			if (!read_varint(data, end, skip) || skip >= groups - g) return false;
+			g += skip + 1;
+			continue;
+		}
+		size_t begin = g * 8, group_end = begin + 8 < snapshot_length ? begin + 8 : snapshot_length;
+		if (mask >> (group_end - begin)) return false;
+		for (size_t i = begin; i < group_end; i++) {
+			if (!(mask & (1 << (i - begin)))) continue;
+			if (data >= end) return false;
+			output[i] = char(*data++);
+		}
+		g++;
+	}
+	if (data != end) return false;
+	size_t common = baseline.size() < snapshot_length ? baseline.size() : snapshot_length;
+	for (size_t i = 0; i < common; i++) output[i] ^= baseline[i];
+	return true;
+}
+
+snapshot_replicator::snapshot_replicator(network* net, unsigned char channel) : RefCount(1), net(net), channel(channel), raw_bytes(0), encoded_bytes(0) {
+	if (!net) throw Poco::InvalidArgumentException("snapshot_replicator requires a network");
+	net->addRef();
+}
+snapshot_replicator::~snapshot_replicator() {
+	net->release();
+}
+void snapshot_replicator::addRef() {
+	asAtomicInc(RefCount);
+}
+void snapshot_replicator::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+
+bool snapshot_replicator::send(asQWORD peer_id, const std::string& snapshot) {
+	bool known = peers.find(peer_id) != peers.end();
+	peer_state& p = peers[peer_id];
+	asUINT sequence = p.next_sequence;
+	const std::string* baseline = p.find(p.send_history, p.acknowledged);
+	std::string message;
+	message.reserve(16 + snapshot.size() / 4);
+	message.push_back(char(snapshot_message_snapshot));
+	write_varint(message, sequence);
+	write_varint(message, baseline ? p.acknowledged : 0);
+	write_varint(message, snapshot.size());
+	snapshot_delta_encode(snapshot, baseline ? *baseline : std::string(), message);
+	if (!net->send(peer_id, message, channel, false)) {
+		if (!known) peers.erase(peer_id); // Don't keep state around for peers that never existed.
+		return false;
+	}
+	snapshot_entry& h = p.send_history[sequence % snapshot_history_size];
+	h.sequence = sequence;
+	h.data = snapshot;
+	p.next_sequence++;
+	raw_bytes += snapshot.size();
+	encoded_bytes += message.size();
+	return true;
+}
+bool snapshot_replicator::handle_snapshot(asQWORD peer_id, const unsigned char* data, size_t size) {
+	const unsigned char* end = data + size;
+	asQWORD sequence, baseline_sequence, length;
+	if (!read_varint(data, end, sequence) || !read_varint(data, end, baseline_sequence) || !read_varint(data, end, length) || !sequence || sequence > 0xffffffff) return false;
+	peer_state& p = peers[peer_id];
+	if (sequence <= p.latest) return true; // Arrived out of order behind a newer snapshot, nothing to do with it.
+	const std::string* baseline = nullptr;
+	if (baseline_sequence) {
+		baseline = p.find(p.receive_history, asUINT(baseline_sequence));
+		if (!baseline) return true; // We've lost the baseline, the sender will fall back to a full snapshot once its own history runs out.
+	}
+	std::string snapshot;
+	if (length > snapshot_max_length || !snapshot_delta_decode(data, end - data, baseline ? *baseline : std::string(), length, snapshot)) return true; // Malformed, drop it.
+	snapshot_entry& h = p.receive_history[sequence % snapshot_history_size];
+	h.sequence = asUINT(sequence);
+	h.data = std::move(snapshot);
+	p.previous = p.latest;
+	p.latest = asUINT(sequence);
+	std::string ack;
+	ack.push_back(char(snapshot_message_ack));
+	write_varint(ack, sequence);
+	net->send(peer_id, ack, channel, false);
+	return true;
+}
+// Returns true if the event was replication traffic and has been dealt with, in which case the script should ignore it. Disconnections clear the peer's state but aren't consumed.
+bool snapshot_replicator::receive(const network_event* event) {
+	if (!event) return false;
+	if (event->type == ENET_EVENT_TYPE_DISCONNECT || event->type == ENET_EVENT_TYPE_DISCONNECT_TIMEOUT) {
+		peers.erase(event->peer_id);
+		return false;
+	}
+	if (event->type != ENET_EVENT_TYPE_RECEIVE || event->channel != channel || event->get_message_length() < 2) return false;
+	const unsigned char* data = (const unsigned char*)event->get_message_data();
+	const unsigned char* end = data + event->get_message_length();
+	unsigned char kind = *data++;
+	if (kind == snapshot_message_snapshot) return handle_snapshot(event->peer_id, data, end - data);
+	if (kind != snapshot_message_ack) return false;
+	asQWORD sequence;
+	if (!read_varint(data, end, sequence)) return false;
+	auto it = peers.find(event->peer_id);
+	if (it != peers.end() && sequence > it->second.acknowledged && sequence < it->second.next_sequence) it->second.acknowledged = asUINT(sequence);
+	return true;
+}
+std::string snapshot_replicator::get_snapshot(asQWORD peer_id) const {
+	auto it = peers.find(peer_id);
+	if (it == peers.end()) return "";
+	const std::string* s = it->second.find(it->second.receive_history, it->second.latest);
+	return s ? *s : "";
+}
+std::string snapshot_replicator::get_previous_snapshot(asQWORD peer_id) const {
+	auto it = peers.find(peer_id);
+	if (it == peers.end()) return "";
+	const std::string* s = it->second.find(it->second.receive_history, it->second.previous);
+	return s ? *s : "";
+}
+asUINT snapshot_replicator::get_sequence(asQWORD peer_id) const {
+	auto it = peers.find(peer_id);
+	return it == peers.end() ? 0 : it->second.latest;
+}
+void snapshot_replicator::forget_peer(asQWORD peer_id) {
+	peers.erase(peer_id);
+}
+
+snapshot_replicator* ScriptSnapshot_replicator_Factory(network* net, unsigned char channel) {
+	return new snapshot_replicator(net, channel);
+}
+void RegisterScriptSnapshotReplication(asIScriptEngine* engine) {
+	engine->RegisterObjectType(_O("snapshot_replicator"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("snapshot_replicator"), asBEHAVE_FACTORY, _O("snapshot_replicator @r(network@+ net, uint8 channel)"), asFUNCTION(ScriptSnapshot_replicator_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("snapshot_replicator"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(snapshot_replicator, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("snapshot_replicator"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(snapshot_replicator, release), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("snapshot_replicator"), _O("bool send(uint64 peer_id, const string&in snapshot)"), asMETHOD(snapshot_replicator, send), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("snapshot_replicator"), _O("bool receive(const network_event@+ event)"), asMETHOD(snapshot_replicator, receive), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("snapshot_replicator"), _O("string get_snapshot(uint64 peer_id) const"), asMETHOD(snapshot_replicator, get_snapshot), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("snapshot_replicator"), _O("string get_previous_snapshot(uint64 peer_id) const"), asMETHOD(snapshot_replicator, get_previous_snapshot), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("snapshot_replicator"), _O("uint get_sequence(uint64 peer_id) const"), asMETHOD(snapshot_replicator, get_sequence), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("snapshot_replicator"), _O("void forget_peer(uint64 peer_id)"), asMETHOD(snapshot_replicator, forget_peer), asCALL_THISCALL);
+	engine->RegisterObjectProperty(_O("snapshot_replicator"), _O("const uint8 channel"), asOFFSET(snapshot_replicator, channel));
+	engine->RegisterObjectProperty(_O("snapshot_replicator"), _O("const uint64 raw_bytes"), asOFFSET(snapshot_replicator, raw_bytes));
+	engine->RegisterObjectProperty(_O("snapshot_replicator"), _O("const uint64 encoded_bytes"), asOFFSET(snapshot_replicator, encoded_bytes));
+}
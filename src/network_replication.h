@@ -0,0 +1,62 @@
+/* network_replication.h - snapshot delta replication on top of the network class
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <angelscript.h>
+
+class network;
+class network_event;
+
+// Encodes snapshot against baseline (XOR, then zero-skipping bitmasks) and appends the result to output. The decoder needs the snapshot's length, which the replicator sends in its header.
+void snapshot_delta_encode(const std::string& snapshot, const std::string& baseline, std::string& output);
+bool snapshot_delta_decode(const unsigned char* data, size_t size, const std::string& baseline, size_t snapshot_length, std::string& output);
+
+// Sends each peer a game state snapshot encoded against the newest snapshot that peer has acknowledged, so that only what changed since then crosses the wire. Unchanged state costs a couple of bytes however large it is. Snapshots go out unreliably, and the receiving replicator acknowledges each one it decodes so that the sender can move its baseline forward. The same class is used on both ends, and one replicator can send snapshots to a peer while receiving others from it.
+const int snapshot_history_size = 32; // Baselines older than this many snapshots are forgotten and the next snapshot is sent in full.
+class snapshot_replicator {
+	struct snapshot_entry {
+		asUINT sequence = 0;
+		std::string data;
+	};
+	struct peer_state {
+		asUINT next_sequence = 1, acknowledged = 0; // Sending side.
+		asUINT latest = 0, previous = 0; // Receiving side.
+		// Each direction numbers its snapshots from 1, so a replicator that both sends to and receives from a peer must keep them apart.
+		snapshot_entry send_history[snapshot_history_size], receive_history[snapshot_history_size];
+		static const std::string* find(const snapshot_entry (&history)[snapshot_history_size], asUINT sequence) {
+			const snapshot_entry& e = history[sequence % snapshot_history_size];
+			return sequence && e.sequence == sequence ? &e.data : nullptr;
+		}
+	};
+	int RefCount;
+	network* net;
+	std::unordered_map<asQWORD, peer_state> peers;
+	bool handle_snapshot(asQWORD peer_id, const unsigned char* data, size_t size);
+public:
+	unsigned char channel;
+	asQWORD raw_bytes, encoded_bytes;
+	snapshot_replicator(network* net, unsigned char channel);
+	~snapshot_replicator();
+	void addRef();
+	void release();
+	bool send(asQWORD peer_id, const std::string& snapshot);
+	bool receive(const network_event* event);
+	std::string get_snapshot(asQWORD peer_id) const;
+	std::string get_previous_snapshot(asQWORD peer_id) const;
+	asUINT get_sequence(asQWORD peer_id) const;
+	void forget_peer(asQWORD peer_id);
+};
+
+void RegisterScriptSnapshotReplication(asIScriptEngine* engine);
@@ -0,0 +1,188 @@
+/* network_simulator.cpp - an in-process relay that imposes latency, jitter, loss and bandwidth limits on UDP traffic
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <map>
+#include <obfuscate.h>
+#include <Poco/Exception.h>
+#include <Poco/Timespan.h>
+#include "network_simulator.h"
+
+using namespace Poco::Net;
+
+const std::chrono::seconds simulator_max_queue_delay(1); // When bandwidth is limited, datagrams that would wait longer than this for the link are dropped, like a full router queue.
+const int simulator_max_reads_per_socket = 256; // Per wakeup, so that one busy client can't starve the others.
+
+network_simulator::network_simulator() : RefCount(1), next_order(0), stop_requested(false), latency(0), jitter(0), bandwidth(0), loss(0), forwarded_packets(0), forwarded_bytes(0), dropped_packets(0), seed(0) {}
+network_simulator::~network_simulator() {
+	stop();
+}
+void network_simulator::addRef() {
+	asAtomicInc(RefCount);
+}
+void network_simulator::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+
+bool network_simulator::start(unsigned short port, unsigned short target_port, const std::string& target_host) {
+	if (active()) return false;
+	try {
+		target = SocketAddress(target_host, target_port);
+		front = DatagramSocket();
+		front.bind(SocketAddress("127.0.0.1", port));
+		front.setBlocking(false);
+	} catch (Poco::Exception&) {
+		front.close();
+		return false;
+	}
+	rng.seed(seed ? seed : std::random_device()());
+	stop_requested = false;
+	relay_thread = std::thread(&network_simulator::relay_thread_func, this);
+	return true;
+}
+void network_simulator::stop() {
+	if (!active()) return;
+	stop_requested = true;
+	relay_thread.join();
+	pending = decltype(pending)(); // Datagrams still in flight are lost, as they would be if a real link went down.
+	clients.clear();
+	front.close();
+}
+void network_simulator::reset_statistics() {
+	forwarded_packets = forwarded_bytes = dropped_packets = 0;
+}
+
+bool network_simulator::forward(client& c, bool upstream, const char* data, int size, clock::time_point now) {
+	double l = loss;
+	if (l > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < l) {
+		dropped_packets++;
+		return false;
+	}
+	clock::time_point departure = now;
+	unsigned int bw = bandwidth;
+	if (bw) {
+		link_state& link = upstream ? c.up : c.down;
+		if (link.busy_until > now) departure = link.busy_until;
+		if (departure - now > simulator_max_queue_delay) {
+			dropped_packets++;
+			return false;
+		}
+		departure += std::chrono::microseconds(asQWORD(size) * 1000000 / bw);
+		link.busy_until = departure;
+	}
+	clock::duration delay = std::chrono::milliseconds(latency);
+	unsigned int j = jitter;
+	if (j) delay += std::chrono::microseconds(std::uniform_int_distribution<unsigned int>(0, j * 1000)(rng));
+	pending.push(datagram {departure + delay, next_order++, upstream ? &c.upstream : &front, upstream ? target : c.address, std::string(data, size)});
+	forwarded_packets++;
+	forwarded_bytes += size;
+	return true;
+}
+
+void network_simulator::relay_thread_func() {
+	std::map<Socket, client*> by_socket;
+	std::vector<char> buffer(65536);
+	Socket::SocketList readable, writable, failed;
+	while (!stop_requested) {
+		clock::time_point now = clock::now();
+		while (!pending.empty() && pending.top().due <= now) {
+			const datagram& d = pending.top();
+			try {
+				d.socket->sendTo(d.data.data(), int(d.data.size()), d.destination);
+			} catch (Poco::Exception&) {} // Like the real thing, UDP gives no guarantee and the endpoint may be gone.
+			pending.pop();
+		}
+		Poco::Timespan wait(0, 1000);
+		if (!pending.empty() && pending.top().due - now < std::chrono::milliseconds(1))
+			wait = Poco::Timespan(0, long(std::chrono::duration_cast<std::chrono::microseconds>(pending.top().due - now).count()));
+		readable.clear();
+		writable.clear();
+		failed.clear();
+		readable.push_back(front);
+		for (const auto& s : by_socket) readable.push_back(s.first);
+		try {
+			if (!Socket::select(readable, writable, failed, wait)) continue;
+		} catch (Poco::Exception&) {
+			continue;
+		}
+		now = clock::now();
+		for (Socket& s : readable) {
+			if (s == front) {
+				for (int i = 0; i < simulator_max_reads_per_socket; i++) {
+					SocketAddress from;
+					int size;
+					try {
+						size = front.receiveFrom(buffer.data(), int(buffer.size()), from);
+					} catch (Poco::Exception&) {
+						break;
+					}
+					if (size < 0) break;
+					std::unique_ptr<client>& c = clients[from.toString()];
+					if (!c) {
+						c = std::make_unique<client>();
+						c->address = from;
+						try {
+							c->upstream.bind(SocketAddress(target.host().family() == IPAddress::IPv6 ? "::" : "0.0.0.0", 0));
+							c->upstream.setBlocking(false);
+						} catch (Poco::Exception&) {
+							clients.erase(from.toString());
+							break;
+						}
+						by_socket[c->upstream] = c.get();
+					}
+					forward(*c, true, buffer.data(), size, now);
+				}
+				continue;
+			}
+			auto it = by_socket.find(s);
+			if (it == by_socket.end()) continue;
+			client& c = *it->second;
+			for (int i = 0; i < simulator_max_reads_per_socket; i++) {
+				SocketAddress from;
+				int size;
+				try {
+					size = c.upstream.receiveFrom(buffer.data(), int(buffer.size()), from);
+				} catch (Poco::Exception&) {
+					break;
+				}
+				if (size < 0) break;
+				forward(c, false, buffer.data(), size, now);
+			}
+		}
+	}
+}
+
+network_simulator* ScriptNetwork_simulator_Factory() {
+	return new network_simulator();
+}
+void RegisterScriptNetworkSimulator(asIScriptEngine* engine) {
+	engine->RegisterObjectType(_O("network_simulator"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("network_simulator"), asBEHAVE_FACTORY, _O("network_simulator @s()"), asFUNCTION(ScriptNetwork_simulator_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("network_simulator"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network_simulator, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("network_simulator"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(network_simulator, release), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("bool start(uint16 port, uint16 target_port, const string&in target_host = \"127.0.0.1\")"), asMETHOD(network_simulator, start), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("void stop()"), asMETHOD(network_simulator, stop), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("bool get_active() const property"), asMETHOD(network_simulator, active), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("uint get_latency() const property"), asMETHOD(network_simulator, get_latency), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("void set_latency(uint ms) property"), asMETHOD(network_simulator, set_latency), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("uint get_jitter() const property"), asMETHOD(network_simulator, get_jitter), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("void set_jitter(uint ms) property"), asMETHOD(network_simulator, set_jitter), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("double get_loss() const property"), asMETHOD(network_simulator, get_loss), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("void set_loss(double fraction) property"), asMETHOD(network_simulator, set_loss), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("uint get_bandwidth() const property"), asMETHOD(network_simulator, get_bandwidth), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("void set_bandwidth(uint bytes_per_second) property"), asMETHOD(network_simulator, set_bandwidth), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("uint64 get_forwarded_packets() const property"), asMETHOD(network_simulator, get_forwarded_packets), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("uint64 get_forwarded_bytes() const property"), asMETHOD(network_simulator, get_forwarded_bytes), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("uint64 get_dropped_packets() const property"), asMETHOD(network_simulator, get_dropped_packets), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_simulator"), _O("void reset_statistics()"), asMETHOD(network_simulator, reset_statistics), asCALL_THISCALL);
+	engine->RegisterObjectProperty(_O("network_simulator"), _O("uint seed"), asOFFSET(network_simulator, seed));
+}
@@ -0,0 +1,112 @@
+/* network_simulator.h - an in-process relay that imposes latency, jitter, loss and bandwidth limits on UDP traffic
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <angelscript.h>
+#include <Poco/Net/DatagramSocket.h>
+#include <Poco/Net/SocketAddress.h>
+
+// Sits between network clients and a server on the loopback interface. Clients connect to the simulator's port, and every datagram is forwarded to the server (and back) after passing through a simulated link, so that network code can be tested and benchmarked against bad connections without leaving the machine. Each client is given its own upstream socket, so the server still sees one peer per client.
+// ENet opens and binds its own sockets, so the simulator relays real datagrams rather than replacing ENet's transport; loopback sockets work on machines with no network connection at all.
+class network_simulator {
+	typedef std::chrono::steady_clock clock;
+	struct datagram {
+		clock::time_point due;
+		asQWORD order; // Keeps datagrams due at the same moment in the order they were sent.
+		Poco::Net::DatagramSocket* socket;
+		Poco::Net::SocketAddress destination;
+		std::string data;
+		bool operator>(const datagram& other) const {
+			return due != other.due ? due > other.due : order > other.order;
+		}
+	};
+	// One direction of one client's link. A datagram occupies the link for its size divided by the bandwidth, so bursts queue up behind each other as they would at a real bottleneck.
+	struct link_state {
+		clock::time_point busy_until;
+	};
+	struct client {
+		Poco::Net::SocketAddress address;
+		Poco::Net::DatagramSocket upstream;
+		link_state up, down;
+	};
+	int RefCount;
+	Poco::Net::DatagramSocket front;
+	Poco::Net::SocketAddress target;
+	std::unordered_map<std::string, std::unique_ptr<client>> clients; // Keyed by the client's address, only touched by the relay thread.
+	std::priority_queue<datagram, std::vector<datagram>, std::greater<datagram>> pending;
+	asQWORD next_order;
+	std::mt19937_64 rng;
+	std::thread relay_thread;
+	std::atomic<bool> stop_requested;
+	std::atomic<unsigned int> latency, jitter, bandwidth;
+	std::atomic<double> loss;
+	std::atomic<asQWORD> forwarded_packets, forwarded_bytes, dropped_packets;
+	void relay_thread_func();
+	bool forward(client& c, bool upstream, const char* data, int size, clock::time_point now);
+public:
+	unsigned int seed;
+	network_simulator();
+	~network_simulator();
+	void addRef();
+	void release();
+	bool start(unsigned short port, unsigned short target_port, const std::string& target_host = "127.0.0.1");
+	void stop();
+	bool active() const {
+		return relay_thread.joinable();
+	}
+	unsigned int get_latency() const {
+		return latency;
+	}
+	void set_latency(unsigned int ms) {
+		latency = ms;
+	}
+	unsigned int get_jitter() const {
+		return jitter;
+	}
+	void set_jitter(unsigned int ms) {
+		jitter = ms;
+	}
+	double get_loss() const {
+		return loss;
+	}
+	void set_loss(double fraction) {
+		loss = fraction < 0 ? 0 : fraction > 1 ? 1 : fraction;
+	}
+	unsigned int get_bandwidth() const {
+		return bandwidth;
+	}
+	void set_bandwidth(unsigned int bytes_per_second) {
+		bandwidth = bytes_per_second;
+	}
+	asQWORD get_forwarded_packets() const {
+		return forwarded_packets;
+	}
+	asQWORD get_forwarded_bytes() const {
+		return forwarded_bytes;
+	}
+	asQWORD get_dropped_packets() const {
+		return dropped_packets;
+	}
+	void reset_statistics();
+};
+
+void RegisterScriptNetworkSimulator(asIScriptEngine* engine);
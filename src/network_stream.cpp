@@ -0,0 +1,447 @@
+/* network_stream.cpp - windowed transfer of large messages on top of the network class
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <istream>
+#include <streambuf>
+#include <obfuscate.h>
+#include <Poco/Exception.h>
+#include "datastreams.h"
+#include "network.h"
+#include "network_stream.h"
+
+// Every message starts with a kind byte and the stream ID as a 7 bit encoded integer. Streams are numbered by their sender, so cancellations say which side they came from.
+enum network_stream_message_kind {
+	stream_message_open = 1, // Followed by the total size, 0 if unknown.
+	stream_message_data, // Followed by one chunk.
+	stream_message_end,
+	stream_message_ack, // Followed by the number of chunks the receiving script has read so far.
+	stream_message_cancel, // From the sender.
+	stream_message_reject // From the receiver.
+};
+
+static void write_varint(std::string& out, asQWORD value) {
+	while (value >= 0x80) {
+		out.push_back(char((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.push_back(char(value));
+}
+static bool read_varint(const unsigned char*& data, const unsigned char* end, asQWORD& value) {
+	value = 0;
+	for (int shift = 0; data < end && shift < 64; shift += 7) {
+		unsigned char b = *data++;
+		value |= asQWORD(b & 0x7f) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+// Reads an incoming stream's chunks as they arrive, taking each one off the stream's queue when reading reaches it. Running out of chunks before the stream is complete looks like the end of it, until the next chunk arrives and clears the reader's state.
+class network_chunk_buf : public std::streambuf {
+	network_incoming_stream* stream;
+	std::string current;
+public:
+	network_chunk_buf(network_incoming_stream* stream) : stream(stream) {}
+protected:
+	int_type underflow() override {
+		while (stream->next_chunk(current)) {
+			if (current.empty()) continue;
+			setg(current.data(), current.data(), current.data() + current.size());
+			return traits_type::to_int_type(*gptr());
+		}
+		return traits_type::eof();
+	}
+	std::streamsize showmanyc() override {
+		return std::streamsize(stream->bytes_buffered);
+	}
+};
+class network_chunk_istream : public std::istream {
+	network_chunk_buf buf;
+public:
+	network_chunk_istream(network_incoming_stream* stream) : std::istream(nullptr), buf(stream) {
+		rdbuf(&buf);
+	}
+};
+void network_incoming_stream_close(datastream* ds) {
+	network_incoming_stream* s = reinterpret_cast<network_incoming_stream*>(ds->user);
+	if (!s) return;
+	s->reader = nullptr;
+	s->release();
+}
+
+network_outgoing_stream::network_outgoing_stream() : RefCount(1), owner(nullptr), source(nullptr), chunks_acknowledged(0), source_done(false), end_sent(false), id(0), peer_id(0), size(0), bytes_sent(0), bytes_acknowledged(0), complete(false), failed(false) {}
+network_outgoing_stream::~network_outgoing_stream() {
+	if (source) source->release();
+}
+void network_outgoing_stream::addRef() {
+	asAtomicInc(RefCount);
+}
+void network_outgoing_stream::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+double network_outgoing_stream::get_progress() const {
+	if (complete) return 1;
+	return size ? double(bytes_acknowledged) / size : -1;
+}
+void network_outgoing_stream::finish(bool success) {
+	complete = success;
+	failed = !success;
+	if (source) source->release();
+	source = nullptr;
+	if (owner) owner->forget(this); // May drop the last reference.
+}
+bool network_outgoing_stream::cancel() {
+	if (!owner || complete || failed) return false;
+	owner->send_control(peer_id, stream_message_cancel, id);
+	addRef();
+	finish(false);
+	release();
+	return true;
+}
+
+network_incoming_stream::network_incoming_stream() : RefCount(1), owner(nullptr), chunks_read(0), accepted(false), bytes_buffered(0), reader(nullptr), id(0), peer_id(0), size(0), bytes_received(0), complete(false), failed(false) {}
+void network_incoming_stream::addRef() {
+	asAtomicInc(RefCount);
+}
+void network_incoming_stream::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+double network_incoming_stream::get_progress() const {
+	if (complete) return 1;
+	return size ? double(bytes_received) / size : -1;
+}
+// There can only be one reader at a time, since reading takes the chunks off the queue.
+datastream* network_incoming_stream::get_stream(const std::string& encoding, int byteorder) {
+	if (failed || reader) return nullptr;
+	network_chunk_istream* is = new network_chunk_istream(this);
+	datastream* ds = new datastream(is, encoding, byteorder);
+	reader = is;
+	addRef();
+	ds->user = this;
+	ds->set_close_callback(network_incoming_stream_close);
+	return ds;
+}
+bool network_incoming_stream::cancel() {
+	if (!owner || failed) return false; // A complete stream can still be cancelled while the sender waits for the script to read it.
+	owner->send_control(peer_id, stream_message_reject, id);
+	failed = true;
+	owner->forget(this);
+	return true;
+}
+// Takes the oldest unread chunk for the reader from get_stream(), and acknowledges it so that the sender can send another.
+bool network_incoming_stream::next_chunk(std::string& out) {
+	if (chunks.empty()) return false;
+	out = std::move(chunks.front());
+	chunks.pop_front();
+	bytes_buffered -= out.size();
+	chunks_read++;
+	if (owner) owner->chunk_read(this); // May forget the stream once it has been read to its end.
+	return true;
+}
+
+network_stream_channel::network_stream_channel(network* net, unsigned char channel, unsigned int chunk_size, unsigned int window) : RefCount(1), net(net), next_stream_id(1), channel(channel), chunk_size(chunk_size), window(window), max_incoming_size(256 * 1024 * 1024), max_incoming_streams(16), max_buffered_bytes(16 * 1024 * 1024) {
+	if (!net) throw Poco::InvalidArgumentException("network_stream_channel requires a network");
+	if (chunk_size < 256 || chunk_size > 1024 * 1024) throw Poco::InvalidArgumentException("chunk size must be between 256 bytes and 1 MB");
+	if (window < 1) throw Poco::InvalidArgumentException("window must be at least 1 chunk");
+	net->addRef();
+}
+network_stream_channel::~network_stream_channel() {
+	for (auto& it : outgoing) {
+		it.second->owner = nullptr;
+		it.second->release();
+	}
+	for (auto& it : incoming) {
+		it.second->owner = nullptr;
+		it.second->release();
+	}
+	for (network_incoming_stream* s : opened) s->release();
+	net->release();
+}
+void network_stream_channel::addRef() {
+	asAtomicInc(RefCount);
+}
+void network_stream_channel::release() {
+	if (asAtomicDec(RefCount) < 1)
+		delete this;
+}
+
+bool network_stream_channel::send_control(asQWORD peer_id, unsigned char kind, asUINT stream_id, asQWORD value, bool with_value) {
+	std::string message;
+	message.push_back(char(kind));
+	write_varint(message, stream_id);
+	if (with_value) write_varint(message, value);
+	return net->send(peer_id, message, channel, true);
+}
+void network_stream_channel::forget(network_outgoing_stream* s) {
+	auto it = outgoing.find(std::make_pair(s->peer_id, s->id));
+	if (it == outgoing.end() || it->second != s) return;
+	outgoing.erase(it);
+	s->owner = nullptr;
+	s->release();
+}
+void network_stream_channel::forget(network_incoming_stream* s) {
+	auto it = incoming.find(std::make_pair(s->peer_id, s->id));
+	if (it == incoming.end() || it->second != s) return;
+	incoming.erase(it);
+	s->chunks.clear(); // Only a stream that failed can still hold chunks here, and nothing will read them now.
+	s->bytes_buffered = 0;
+	s->owner = nullptr;
+	s->release();
+}
+void network_stream_channel::chunk_read(network_incoming_stream* s) {
+	send_control(s->peer_id, stream_message_ack, s->id, s->chunks_read, true);
+	if (s->complete && s->chunks.empty()) forget(s);
+}
+// Counts the streams a peer has open toward us and the bytes they hold that the script hasn't read.
+void network_stream_channel::peer_usage(asQWORD peer_id, unsigned int& streams, asQWORD& bytes) const {
+	streams = 0;
+	bytes = 0;
+	for (auto it = incoming.lower_bound(std::make_pair(peer_id, asUINT(0))); it != incoming.end() && it->first.first == peer_id; it++) {
+		streams++;
+		bytes += it->second->bytes_buffered;
+	}
+}
+
+// Returns true if a send to the stream's peer failed only for now, such as while an encrypted connection is still being set up, so that it should be retried. Otherwise the peer is gone and the stream is finished.
+bool network_stream_channel::retry_later(network_outgoing_stream* s) {
+	if (net->has_peer(s->peer_id)) return true;
+	s->finish(false);
+	return false;
+}
+// Sends chunks until the window is full or the source runs out, and the end marker after the last one. A message the network refuses is kept and sent again on the next call, before anything else, so the receiver sees chunks in order. Returns false once the stream is finished, which may have released it.
+bool network_stream_channel::pump(network_outgoing_stream* s) {
+	if (!s->unsent.empty()) {
+		if (!net->send(s->peer_id, s->unsent, channel, true)) return retry_later(s);
+		s->unsent.clear();
+		s->bytes_sent += s->in_flight.back();
+	}
+	while (!s->source_done && s->in_flight.size() < window) {
+		std::istream* is = s->source->get_istr();
+		std::string message;
+		message.push_back(char(stream_message_data));
+		write_varint(message, s->id);
+		size_t header = message.size();
+		message.resize(header + chunk_size);
+		std::streamsize n = 0;
+		if (is) {
+			is->read(&message[header], chunk_size);
+			n = is->gcount();
+		}
+		if (!is || !is->good()) s->source_done = true;
+		if (n <= 0) break;
+		message.resize(header + n);
+		s->in_flight.push_back(n);
+		if (!net->send(s->peer_id, message, channel, true)) {
+			s->unsent = std::move(message);
+			return retry_later(s);
+		}
+		s->bytes_sent += n;
+	}
+	if (s->source_done && !s->end_sent) {
+		if (!send_control(s->peer_id, stream_message_end, s->id)) return retry_later(s);
+		s->end_sent = true;
+	}
+	if (s->end_sent && s->in_flight.empty()) {
+		s->finish(true);
+		return false;
+	}
+	return true;
+}
+network_outgoing_stream* network_stream_channel::open_stream(asQWORD peer_id, datastream* source, asQWORD size) {
+	if (!source || !source->get_istr() || !net->active()) return nullptr;
+	std::istream* is = source->get_istr();
+	if (!size) {
+		// Seekable sources, such as files, can tell us how much is left so that the receiver can show progress.
+		std::streampos pos = is->tellg();
+		if (pos != std::streampos(-1) && is->seekg(0, std::ios::end)) {
+			std::streampos end = is->tellg();
+			if (end != std::streampos(-1) && end > pos) size = end - pos;
+			is->seekg(pos);
+		}
+		is->clear();
+	}
+	asUINT id = next_stream_id++;
+	if (!send_control(peer_id, stream_message_open, id, size, true)) return nullptr;
+	network_outgoing_stream* s = new network_outgoing_stream();
+	s->owner = this;
+	s->source = source;
+	source->duplicate();
+	s->id = id;
+	s->peer_id = peer_id;
+	s->size = size;
+	outgoing[std::make_pair(peer_id, id)] = s;
+	s->addRef(); // For the script.
+	pump(s);
+	return s;
+}
+
+bool network_stream_channel::handle_message(asQWORD peer_id, const unsigned char* data, size_t size) {
+	const unsigned char* end = data + size;
+	unsigned char kind = *data++;
+	asQWORD id, value = 0;
+	if (kind < stream_message_open || kind > stream_message_reject || !read_varint(data, end, id) || id > 0xffffffff) return false;
+	if ((kind == stream_message_open || kind == stream_message_ack) && !read_varint(data, end, value)) return true; // Malformed, drop it.
+	std::pair<asQWORD, asUINT> key(peer_id, asUINT(id));
+	if (kind == stream_message_open) {
+		if (incoming.count(key)) return true;
+		unsigned int streams;
+		asQWORD buffered;
+		peer_usage(peer_id, streams, buffered);
+		if (streams >= max_incoming_streams) {
+			send_control(peer_id, stream_message_reject, asUINT(id));
+			return true;
+		}
+		network_incoming_stream* s = new network_incoming_stream();
+		s->owner = this;
+		s->id = asUINT(id);
+		s->peer_id = peer_id;
+		s->size = value;
+		incoming[key] = s;
+		s->addRef();
+		opened.push_back(s);
+		if (value > max_incoming_size) s->cancel();
+		return true;
+	}
+	if (kind == stream_message_ack || kind == stream_message_reject) {
+		auto it = outgoing.find(key);
+		if (it == outgoing.end()) return true;
+		network_outgoing_stream* s = it->second;
+		if (kind == stream_message_reject) {
+			s->finish(false);
+			return true;
+		}
+		while (s->chunks_acknowledged < value && !s->in_flight.empty()) {
+			s->bytes_acknowledged += s->in_flight.front();
+			s->in_flight.pop_front();
+			s->chunks_acknowledged++;
+		}
+		pump(s);
+		return true;
+	}
+	auto it = incoming.find(key);
+	if (it == incoming.end()) return true; // Probably one we cancelled.
+	network_incoming_stream* s = it->second;
+	if (s->complete) return true; // Nothing may follow the end marker.
+	if (kind == stream_message_data) {
+		size_t n = end - data;
+		unsigned int streams;
+		asQWORD buffered;
+		peer_usage(peer_id, streams, buffered);
+		if (s->bytes_received + n > max_incoming_size || buffered + n > max_buffered_bytes) {
+			s->cancel();
+			return true;
+		}
+		s->chunks.emplace_back((const char*)data, n);
+		s->bytes_buffered += n;
+		s->bytes_received += n;
+		if (s->reader) s->reader->clear(); // Reading can go on from where it ran out.
+	} else if (kind == stream_message_end) {
+		s->complete = true;
+		if (s->chunks.empty()) forget(s);
+	} else {
+		s->failed = true;
+		forget(s);
+	}
+	return true;
+}
+void network_stream_channel::fail_peer(asQWORD peer_id) {
+	std::vector<network_outgoing_stream*> out;
+	for (auto& it : outgoing) {
+		if (it.first.first == peer_id) out.push_back(it.second);
+	}
+	for (network_outgoing_stream* s : out) s->finish(false);
+	std::vector<network_incoming_stream*> in;
+	for (auto& it : incoming) {
+		if (it.first.first == peer_id) in.push_back(it.second);
+	}
+	for (network_incoming_stream* s : in) {
+		s->failed = true;
+		forget(s);
+	}
+}
+// Returns true if the event was stream traffic and has been dealt with, in which case the script should ignore it. Disconnections fail the peer's streams but aren't consumed.
+bool network_stream_channel::receive(const network_event* event) {
+	if (!event) return false;
+	if (event->type == ENET_EVENT_TYPE_DISCONNECT || event->type == ENET_EVENT_TYPE_DISCONNECT_TIMEOUT) {
+		fail_peer(event->peer_id);
+		return false;
+	}
+	if (event->type != ENET_EVENT_TYPE_RECEIVE || event->channel != channel || event->get_message_length() < 2) return false;
+	return handle_message(event->peer_id, (const unsigned char*)event->get_message_data(), event->get_message_length());
+}
+// Acknowledgements already refill the window as they arrive, but a message the network refused is only sent again from here or from the next acknowledgement, which may never come while the window is waiting on it. An accepted stream the script has let go of can never be read, so it is cancelled here rather than holding its sender up.
+void network_stream_channel::update() {
+	for (auto it = outgoing.begin(); it != outgoing.end();) {
+		network_outgoing_stream* s = it->second;
+		it++; // pump() may remove s from the map.
+		pump(s);
+	}
+	for (auto it = incoming.begin(); it != incoming.end();) {
+		network_incoming_stream* s = it->second;
+		it++;
+		if (s->accepted && s->RefCount == 1) s->cancel();
+	}
+}
+network_incoming_stream* network_stream_channel::accept() {
+	if (opened.empty()) return nullptr;
+	network_incoming_stream* s = opened.front();
+	opened.pop_front();
+	s->accepted = true;
+	return s; // The queue's reference passes to the script.
+}
+
+network_stream_channel* ScriptNetwork_stream_channel_Factory(network* net, unsigned char channel, unsigned int chunk_size, unsigned int window) {
+	return new network_stream_channel(net, channel, chunk_size, window);
+}
+void RegisterScriptNetworkStreams(asIScriptEngine* engine) {
+	engine->RegisterObjectType(_O("network_outgoing_stream"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("network_outgoing_stream"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network_outgoing_stream, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("network_outgoing_stream"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(network_outgoing_stream, release), asCALL_THISCALL);
+	engine->RegisterObjectProperty(_O("network_outgoing_stream"), _O("const uint id"), asOFFSET(network_outgoing_stream, id));
+	engine->RegisterObjectProperty(_O("network_outgoing_stream"), _O("const uint64 peer_id"), asOFFSET(network_outgoing_stream, peer_id));
+	engine->RegisterObjectProperty(_O("network_outgoing_stream"), _O("const uint64 size"), asOFFSET(network_outgoing_stream, size));
+	engine->RegisterObjectProperty(_O("network_outgoing_stream"), _O("const uint64 bytes_sent"), asOFFSET(network_outgoing_stream, bytes_sent));
+	engine->RegisterObjectProperty(_O("network_outgoing_stream"), _O("const uint64 bytes_acknowledged"), asOFFSET(network_outgoing_stream, bytes_acknowledged));
+	engine->RegisterObjectProperty(_O("network_outgoing_stream"), _O("const bool complete"), asOFFSET(network_outgoing_stream, complete));
+	engine->RegisterObjectProperty(_O("network_outgoing_stream"), _O("const bool failed"), asOFFSET(network_outgoing_stream, failed));
+	engine->RegisterObjectMethod(_O("network_outgoing_stream"), _O("double get_progress() const property"), asMETHOD(network_outgoing_stream, get_progress), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_outgoing_stream"), _O("bool cancel()"), asMETHOD(network_outgoing_stream, cancel), asCALL_THISCALL);
+	engine->RegisterObjectType(_O("network_incoming_stream"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("network_incoming_stream"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network_incoming_stream, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("network_incoming_stream"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(network_incoming_stream, release), asCALL_THISCALL);
+	engine->RegisterObjectProperty(_O("network_incoming_stream"), _O("const uint id"), asOFFSET(network_incoming_stream, id));
+	engine->RegisterObjectProperty(_O("network_incoming_stream"), _O("const uint64 peer_id"), asOFFSET(network_incoming_stream, peer_id));
+	engine->RegisterObjectProperty(_O("network_incoming_stream"), _O("const uint64 size"), asOFFSET(network_incoming_stream, size));
+	engine->RegisterObjectProperty(_O("network_incoming_stream"), _O("const uint64 bytes_received"), asOFFSET(network_incoming_stream, bytes_received));
+	engine->RegisterObjectProperty(_O("network_incoming_stream"), _O("const bool complete"), asOFFSET(network_incoming_stream, complete));
+	engine->RegisterObjectProperty(_O("network_incoming_stream"), _O("const bool failed"), asOFFSET(network_incoming_stream, failed));
+	engine->RegisterObjectMethod(_O("network_incoming_stream"), _O("double get_progress() const property"), asMETHOD(network_incoming_stream, get_progress), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_incoming_stream"), _O("datastream@ get_stream(const string&in encoding = \"\", int byteorder = STREAM_BYTE_ORDER_NATIVE)"), asMETHOD(network_incoming_stream, get_stream), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_incoming_stream"), _O("bool cancel()"), asMETHOD(network_incoming_stream, cancel), asCALL_THISCALL);
+	engine->RegisterObjectType(_O("network_stream_channel"), 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour(_O("network_stream_channel"), asBEHAVE_FACTORY, _O("network_stream_channel @c(network@+ net, uint8 channel, uint chunk_size = 16384, uint window = 8)"), asFUNCTION(ScriptNetwork_stream_channel_Factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour(_O("network_stream_channel"), asBEHAVE_ADDREF, _O("void f()"), asMETHOD(network_stream_channel, addRef), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour(_O("network_stream_channel"), asBEHAVE_RELEASE, _O("void f()"), asMETHOD(network_stream_channel, release), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_stream_channel"), _O("network_outgoing_stream@ open_stream(uint64 peer_id, datastream@+ source, uint64 size = 0)"), asMETHOD(network_stream_channel, open_stream), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_stream_channel"), _O("bool receive(const network_event@+ event)"), asMETHOD(network_stream_channel, receive), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_stream_channel"), _O("void update()"), asMETHOD(network_stream_channel, update), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_stream_channel"), _O("network_incoming_stream@ accept()"), asMETHOD(network_stream_channel, accept), asCALL_THISCALL);
+	engine->RegisterObjectMethod(_O("network_stream_channel"), _O("uint get_active_streams() const property"), asMETHOD(network_stream_channel, get_active_streams), asCALL_THISCALL);
+	engine->RegisterObjectProperty(_O("network_stream_channel"), _O("const uint8 channel"), asOFFSET(network_stream_channel, channel));
+	engine->RegisterObjectProperty(_O("network_stream_channel"), _O("const uint chunk_size"), asOFFSET(network_stream_channel, chunk_size));
+	engine->RegisterObjectProperty(_O("network_stream_channel"), _O("const uint window"), asOFFSET(network_stream_channel, window));
+	engine->RegisterObjectProperty(_O("network_stream_channel"), _O("uint64 max_incoming_size"), asOFFSET(network_stream_channel, max_incoming_size));
+	engine->RegisterObjectProperty(_O("network_stream_channel"), _O("uint max_incoming_streams"), asOFFSET(network_stream_channel, max_incoming_streams));
+	engine->RegisterObjectProperty(_O("network_stream_channel"), _O("uint64 max_buffered_bytes"), asOFFSET(network_stream_channel, max_buffered_bytes));
+}
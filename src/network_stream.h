@@ -0,0 +1,108 @@
+/* network_stream.h - windowed transfer of large messages on top of the network class
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#pragma once
+
+#include <deque>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <angelscript.h>
+
+class datastream;
+class network;
+class network_event;
+class network_stream_channel;
+
+// Sending a multi-megabyte message with network.send() makes ENet hold and fragment all of it at once, on both ends. A stream channel instead reads the source a chunk at a time and keeps at most a window of chunks unacknowledged, so the sender never reads further ahead than the receiver has caught up with. The receiver queues the chunks as they arrive and hands them out through a datastream that the script can read while the transfer is still going. A chunk is only acknowledged once the script has read it, so the sender's window also bounds what the receiver holds in memory.
+class network_outgoing_stream {
+	friend class network_stream_channel;
+	int RefCount;
+	network_stream_channel* owner; // Cleared if the channel goes away first.
+	datastream* source;
+	std::deque<unsigned int> in_flight; // Sizes of sent chunks not yet acknowledged, oldest first.
+	std::string unsent; // A data message the network refused, sent again before anything else. Its chunk is already the last entry in in_flight.
+	asUINT chunks_acknowledged;
+	bool source_done, end_sent;
+	void finish(bool success);
+public:
+	asUINT id;
+	asQWORD peer_id, size, bytes_sent, bytes_acknowledged;
+	bool complete, failed;
+	network_outgoing_stream();
+	~network_outgoing_stream();
+	void addRef();
+	void release();
+	double get_progress() const;
+	bool cancel();
+};
+class network_incoming_stream {
+	friend class network_stream_channel;
+	int RefCount;
+	network_stream_channel* owner; // Cleared once the stream has failed or been read to its end.
+	asUINT chunks_read;
+	bool accepted;
+public:
+	std::deque<std::string> chunks; // Received but not yet read.
+	asQWORD bytes_buffered; // The total size of chunks.
+	std::istream* reader; // Of the datastream from get_stream() while it is open.
+	asUINT id;
+	asQWORD peer_id, size, bytes_received;
+	bool complete, failed;
+	network_incoming_stream();
+	void addRef();
+	void release();
+	double get_progress() const;
+	datastream* get_stream(const std::string& encoding, int byteorder);
+	bool cancel();
+	bool next_chunk(std::string& out);
+};
+
+class network_stream_channel {
+	int RefCount;
+	network* net;
+	asUINT next_stream_id;
+	std::map<std::pair<asQWORD, asUINT>, network_outgoing_stream*> outgoing; // Keyed by peer and stream ID, each holds a reference.
+	std::map<std::pair<asQWORD, asUINT>, network_incoming_stream*> incoming;
+	std::deque<network_incoming_stream*> opened; // Waiting for accept(), each holds a reference.
+	bool retry_later(network_outgoing_stream* s);
+	bool pump(network_outgoing_stream* s);
+	bool handle_message(asQWORD peer_id, const unsigned char* data, size_t size);
+	void fail_peer(asQWORD peer_id);
+	void peer_usage(asQWORD peer_id, unsigned int& streams, asQWORD& bytes) const;
+public:
+	unsigned char channel;
+	unsigned int chunk_size, window;
+	asQWORD max_incoming_size;
+	// Limits on what one peer can make us hold. A stream counts until it fails or the script has read all of it.
+	unsigned int max_incoming_streams;
+	asQWORD max_buffered_bytes;
+	network_stream_channel(network* net, unsigned char channel, unsigned int chunk_size, unsigned int window);
+	~network_stream_channel();
+	void addRef();
+	void release();
+	bool send_control(asQWORD peer_id, unsigned char kind, asUINT stream_id, asQWORD value = 0, bool with_value = false);
+	void forget(network_outgoing_stream* s);
+	void forget(network_incoming_stream* s);
+	void chunk_read(network_incoming_stream* s);
+	network_outgoing_stream* open_stream(asQWORD peer_id, datastream* source, asQWORD size);
+	bool receive(const network_event* event);
+	void update();
+	network_incoming_stream* accept();
+	unsigned int get_active_streams() const {
+		return outgoing.size() + incoming.size();
+	}
+};
+
+void RegisterScriptNetworkStreams(asIScriptEngine* engine);
@@ -39,6 +39,7 @@
 #include "nvgt_angelscript.h" // nvgt's angelscript implementation
 #include "bundling.h"
 #include "input.h"
+#include "internet.h" // http_async_shutdown
 #include "misc_functions.h" // ChDir
 #include "nvgt.h"
 #ifndef NVGT_USER_CONFIG
@@ -51,6 +52,7 @@
 #include "serialize.h" // current location of g_StringTypeid (subject to change)
 #include "sound.h"
 #include "srspeech.h"
+#include "tts.h" // tts_stop_streams
 #include "UI.h" // message
 #include "version.h"
 #include "xplatform.h"
@@ -359,9 +361,11 @@ protected:
 		#endif
 		ScreenReaderUnload();
 		InputDestroy();
+		tts_stop_streams();
 		uninit_sound();
 		anticheat_deinit();
 		cleanup_default_random();
+		http_async_shutdown();
 		if (g_ScriptEngine)
 			g_ScriptEngine->ShutDownAndRelease();
 		g_ScriptEngine = nullptr;
@@ -13,6 +13,8 @@
 #define NOMINMAX
 #include <memory>
 #include <string>
+#include <chrono>
+#include <stdexcept>
 #include <thread>
 #include <vector>
 #include <Poco/FileStream.h>
@@ -28,6 +30,8 @@
 #include "nvgt_plugin.h"      // pack_interface
 #include "sound.h"
 #include "sound_nodes.h"
+#include "sound_opus.h"
+#include "sound_seek_index.h"
 #include "pack.h"
 #include <miniaudio_wdl_resampler.h>
 #include <atomic>
@@ -75,8 +79,11 @@ bool init_sound() {
 	// And access to packs, et al:
 	g_sound_service->register_protocol(pack_protocol::get_instance(), g_pack_protocol_slot);
 	g_sound_service->register_protocol(memory_protocol::get_instance(), g_memory_protocol_slot);
-	// Install default decoders into miniaudio.
+	// Install default decoders into miniaudio. The seek indexed ones decline files below sound_seek_index_threshold, so they must come first.
+	add_decoder(ma_decoding_backend_indexed_vorbis);
+	add_decoder(ma_decoding_backend_indexed_mp3);
 	add_decoder(ma_decoding_backend_libvorbis);
+	add_decoder(ma_decoding_backend_opus);
 	g_soundsystem_initialized.test_and_set();
 	refresh_audio_devices();
 	g_audio_engine = new_audio_engine(audio_engine::PERCENTAGE_ATTRIBUTES);
@@ -541,9 +548,10 @@ protected:
 	splitter_node* reverb_attachment;
 	audio_node_chain* node_chain;
 	audio_node_chain* effects_chain;
+	pitch_resampler_node* resampler; // Only exists while sinc resampler quality is selected.
 	bool hrtf_desired;
 public:
-	mixer_impl(audio_engine *e, bool sound_group = true) : audio_node_impl(), engine(static_cast<audio_engine_impl *>(e)), snd(nullptr), shape(nullptr), reverb(nullptr), reverb_attachment(nullptr), node_chain(audio_node_chain::create(nullptr, nullptr, e)), effects_chain(nullptr), parent_mixer(nullptr), monitor(mixer_monitor_node::create(this)), hrtf(nullptr), hrtf_desired(true) {
+	mixer_impl(audio_engine *e, bool sound_group = true) : audio_node_impl(), engine(static_cast<audio_engine_impl *>(e)), snd(nullptr), shape(nullptr), reverb(nullptr), reverb_attachment(nullptr), node_chain(audio_node_chain::create(nullptr, nullptr, e)), effects_chain(nullptr), resampler(nullptr), parent_mixer(nullptr), monitor(mixer_monitor_node::create(this)), hrtf(nullptr), hrtf_desired(true) {
 		init_sound();
 		node_chain->add_node(monitor);
 		node_chain->set_endpoint(e->get_endpoint());
@@ -574,6 +582,8 @@ public:
 			node_chain->release();
 		if (effects_chain)
 			effects_chain->release();
+		if (resampler)
+			resampler->release();
 		if (shape) {
 			if (shape->connected_sound) unregister_blocking_sound_shape(shape);
 			shape->release();
@@ -719,12 +729,49 @@ public:
 		return snd ? ma_sound_get_pan_mode(&*snd) : ma_pan_mode_balance;
 	}
 	void set_pitch(float pitch) override {
-		if (snd)
-			ma_sound_set_pitch(&*snd, engine->flags & audio_engine::PERCENTAGE_ATTRIBUTES ? pitch / 100.0f : pitch);
+		if (!snd)
+			return;
+		if (engine->flags & audio_engine::PERCENTAGE_ATTRIBUTES)
+			pitch /= 100.0f;
+		if (resampler)
+			resampler->set_pitch(pitch);
+		else
+			ma_sound_set_pitch(&*snd, pitch);
 	}
 	float get_pitch() const override {
-		return snd ? (engine->flags & audio_engine::PERCENTAGE_ATTRIBUTES ? ma_sound_get_pitch(&*snd) * 100 : ma_sound_get_pitch(&*snd)) : NAN;
+		if (!snd)
+			return NAN;
+		float pitch = resampler ? resampler->get_pitch() : ma_sound_get_pitch(&*snd);
+		return engine->flags & audio_engine::PERCENTAGE_ATTRIBUTES ? pitch * 100 : pitch;
+	}
+	bool set_resampler_quality(audio_resampler_quality quality) override {
+		if (quality == AUDIO_RESAMPLER_QUALITY_SINC && !resampler) {
+			try {
+				resampler = pitch_resampler_node::create(engine, engine->get_channels());
+			} catch (std::exception &) {
+				resampler = nullptr;
+				return false;
+			}
+			if (!node_chain->add_node(resampler)) { // Must be the first node in the chain so that effects and hrtf process at the output rate.
+				resampler->release();
+				resampler = nullptr;
+				return false;
+			}
+			if (snd) {
+				resampler->set_pitch(ma_sound_get_pitch(&*snd));
+				ma_sound_set_pitch(&*snd, 1.0f);
+			}
+		} else if (quality == AUDIO_RESAMPLER_QUALITY_LINEAR && resampler) {
+			if (snd)
+				ma_sound_set_pitch(&*snd, resampler->get_pitch());
+			node_chain->remove_node(resampler);
+			resampler->release();
+			resampler = nullptr;
+		} else if (quality != AUDIO_RESAMPLER_QUALITY_LINEAR && quality != AUDIO_RESAMPLER_QUALITY_SINC)
+			return false;
+		return true;
 	}
+	audio_resampler_quality get_resampler_quality() const override { return resampler ? AUDIO_RESAMPLER_QUALITY_SINC : AUDIO_RESAMPLER_QUALITY_LINEAR; }
 	void set_spatialization_enabled(bool enabled) override {
 		if (snd)
 			ma_sound_set_spatialization_enabled(&*snd, enabled);
@@ -965,6 +1012,110 @@ public:
 		return snd ? ma_sound_is_playing(&*snd) : false;
 	}
 };
+// The data source behind pcm_stream. We don't use ma_pcm_rb's own data source because it never ends, it just keeps producing silence once drained.
+typedef struct {
+	ma_data_source_base base;
+	ma_pcm_rb rb;
+	ma_uint32 frame_size;
+	ma_uint64 cursor;
+	std::atomic<bool> finished;
+	std::atomic<bool> cancelled;
+} ma_pcm_stream;
+static ma_result ma_pcm_stream_read(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead) {
+	ma_pcm_stream *ps = (ma_pcm_stream *)pDataSource;
+	// Sample the finished flag before draining, otherwise the producer could write its last frames and finish between our read and the check.
+	bool finished = ps->finished || ps->cancelled;
+	ma_uint64 total = 0;
+	while (total < frameCount) {
+		ma_uint32 count = (ma_uint32)std::min<ma_uint64>(frameCount - total, 0xFFFFFFFF);
+		void *buffer;
+		if (ma_pcm_rb_acquire_read(&ps->rb, &count, &buffer) != MA_SUCCESS || count == 0)
+			break;
+		memcpy((char *)pFramesOut + total * ps->frame_size, buffer, count * ps->frame_size);
+		ma_pcm_rb_commit_read(&ps->rb, count);
+		total += count;
+	}
+	if (total < frameCount && !finished) {
+		// The producer is running behind, play silence rather than ending the sound.
+		ma_silence_pcm_frames((char *)pFramesOut + total * ps->frame_size, frameCount - total, ps->rb.format, ps->rb.channels);
+		total = frameCount;
+	}
+	ps->cursor += total;
+	if (pFramesRead)
+		*pFramesRead = total;
+	return total == 0 ? MA_AT_END : MA_SUCCESS;
+}
+static ma_result ma_pcm_stream_get_data_format(ma_data_source *pDataSource, ma_format *pFormat, ma_uint32 *pChannels, ma_uint32 *pSampleRate, ma_channel *pChannelMap, size_t channelMapCap) {
+	ma_pcm_stream *ps = (ma_pcm_stream *)pDataSource;
+	if (pFormat)
+		*pFormat = ps->rb.format;
+	if (pChannels)
+		*pChannels = ps->rb.channels;
+	if (pSampleRate)
+		*pSampleRate = ps->rb.sampleRate;
+	if (pChannelMap)
+		ma_channel_map_init_standard(ma_standard_channel_map_default, pChannelMap, channelMapCap, ps->rb.channels);
+	return MA_SUCCESS;
+}
+static ma_result ma_pcm_stream_get_cursor(ma_data_source *pDataSource, ma_uint64 *pCursor) {
+	*pCursor = ((ma_pcm_stream *)pDataSource)->cursor;
+	return MA_SUCCESS;
+}
+static ma_data_source_vtable ma_pcm_stream_vtable = {ma_pcm_stream_read, nullptr, ma_pcm_stream_get_data_format, ma_pcm_stream_get_cursor, nullptr, nullptr, 0};
+class pcm_stream_impl final : public pcm_stream {
+	ma_pcm_stream ps;
+
+public:
+	pcm_stream_impl(ma_format format, int samplerate, int channels, unsigned int buffer_frames) {
+		if (buffer_frames == 0)
+			buffer_frames = samplerate;
+		ps.frame_size = ma_get_bytes_per_frame(format, channels);
+		ps.cursor = 0;
+		ps.finished = false;
+		ps.cancelled = false;
+		if ((g_soundsystem_last_error = ma_pcm_rb_init(format, channels, buffer_frames, nullptr, nullptr, &ps.rb)) != MA_SUCCESS)
+			throw std::runtime_error("unable to create pcm_stream buffer");
+		ma_pcm_rb_set_sample_rate(&ps.rb, samplerate);
+		ma_data_source_config cfg = ma_data_source_config_init();
+		cfg.vtable = &ma_pcm_stream_vtable;
+		if ((g_soundsystem_last_error = ma_data_source_init(&cfg, &ps)) != MA_SUCCESS) {
+			ma_pcm_rb_uninit(&ps.rb);
+			throw std::runtime_error("unable to create pcm_stream data source");
+		}
+	}
+	~pcm_stream_impl() {
+		ma_data_source_uninit(&ps);
+		ma_pcm_rb_uninit(&ps.rb);
+	}
+	ma_data_source *get_data_source() override { return &ps; }
+	bool write(const void *frames, unsigned long long frame_count) override {
+		const char *src = (const char *)frames;
+		while (frame_count > 0) {
+			if (ps.cancelled)
+				return false;
+			ma_uint32 count = (ma_uint32)std::min<unsigned long long>(frame_count, 0xFFFFFFFF);
+			void *buffer;
+			if (ma_pcm_rb_acquire_write(&ps.rb, &count, &buffer) != MA_SUCCESS)
+				return false;
+			if (count == 0) {
+				// Full, wait for the audio thread to make some room.
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				continue;
+			}
+			memcpy(buffer, src, count * ps.frame_size);
+			ma_pcm_rb_commit_write(&ps.rb, count);
+			src += count * ps.frame_size;
+			frame_count -= count;
+		}
+		return true;
+	}
+	void finish() override { ps.finished = true; }
+	void cancel() override { ps.cancelled = true; }
+	bool is_cancelled() const override { return ps.cancelled; }
+};
+std::shared_ptr<pcm_stream> pcm_stream::create(ma_format format, int samplerate, int channels, unsigned int buffer_frames) {
+	return std::make_shared<pcm_stream_impl>(format, samplerate, channels, buffer_frames);
+}
 class sound_impl final : public mixer_impl, public virtual sound {
 	// The following is so that MiniAudio can notify us when it finishes loading a sound. We also use a fence, but sometimes we just want to check without having to commit to blocking.
 	typedef struct {
@@ -973,6 +1124,7 @@ class sound_impl final : public mixer_impl, public virtual sound {
 	} async_notification_callbacks;
 	std::string pcm_buffer;      // When loading from raw PCM (like TTS) we store the intermediate wav data here so we can take advantage of async loading to return quickly. Makes a substantial difference in the responsiveness of TTS calls.
 	std::string loaded_filename; // Contains the loaded filename as passed in the load/stream method, used just for convenience.
+	std::shared_ptr<pcm_stream> pcm_source; // Set when playing from load_pcm_stream, cancelled on close so that the producer stops waiting on us.
 	ma_fence fence;
 	async_notification_callbacks notification_callbacks;
 	mutable std::atomic_flag load_completed;
@@ -1006,6 +1158,20 @@ public:
 			}
 		}
 	}
+	// Applies our defaults to a freshly initialized ma_sound and connects it to the node chain.
+	void setup_loaded_sound() {
+		node = (ma_node_base *)&*snd;
+		if (resampler) {
+			// A freshly loaded sound starts at its natural pitch regardless of the resampler in use.
+			resampler->set_pitch(1.0f);
+			resampler->reset();
+		}
+		set_spatialization_enabled(false);                  // The user must call set_position_3d or manually enable spatialization or else their ambience and UI sounds will be spatialized.
+		// set_attenuation_model(ma_attenuation_model_linear); // If spatialization is enabled however lets use linear attenuation by default so that we focus more on hearing objects from further out in audio games as opposed to complete but hard to hear realism. At least lets do it once ma_attenuation_model_linear actually works.
+		set_rolloff(0.75);
+		set_directional_attenuation_factor(1);
+		attach_output_bus(0, node_chain, 0);
+	}
 	bool load_special(const std::string &filename, const size_t protocol_slot = 0, directive_t protocol_directive = nullptr, const size_t filter_slot = 0, directive_t filter_directive = nullptr, ma_uint32 ma_flags = MA_SOUND_FLAG_DECODE) override {
 		if (snd)
 			close();
@@ -1047,12 +1213,7 @@ public:
 			snd.reset();
 		else {
 			loaded_filename = filename;
-			node = (ma_node_base *)&*snd;
-			set_spatialization_enabled(false);                  // The user must call set_position_3d or manually enable spatialization or else their ambience and UI sounds will be spatialized.
-			// set_attenuation_model(ma_attenuation_model_linear); // If spatialization is enabled however lets use linear attenuation by default so that we focus more on hearing objects from further out in audio games as opposed to complete but hard to hear realism. At least lets do it once ma_attenuation_model_linear actually works.
-			set_rolloff(0.75);
-			set_directional_attenuation_factor(1);
-			attach_output_bus(0, node_chain, 0);
+			setup_loaded_sound();
 			// If we didn't load our sound asynchronously or if we streamed it, then we simply mark it as load_completed or we'll end up with a deadlock at destruction time.
 			if (!(cfg.flags & MA_SOUND_FLAG_ASYNC))
 				load_completed.test_and_set();
@@ -1107,17 +1268,36 @@ public:
 			return false;
 		return load_pcm(buffer->GetBuffer(), buffer->GetSize() * buffer->GetElementSize(), format, samplerate, channels);
 	}
+	bool load_pcm_stream(std::shared_ptr<pcm_stream> source) override {
+		if (snd)
+			close();
+		if (!source)
+			return false;
+		snd = make_unique < ma_sound > ();
+		if ((g_soundsystem_last_error = ma_sound_init_from_data_source(engine->get_ma_engine(), source->get_data_source(), 0, nullptr, &*snd)) != MA_SUCCESS) {
+			snd.reset();
+			return false;
+		}
+		pcm_source = source;
+		loaded_filename = ":stream";
+		setup_loaded_sound();
+		load_completed.test_and_set();
+		return true;
+	}
 	bool is_load_completed() const override {
 		return load_completed.test();
 	}
 	bool close() override {
 		if (snd) {
+			if (pcm_source)
+				pcm_source->cancel();
 			// It's possible that this sound could still be loading in a job thread when we try to destroy it. Unfortunately there isn't a way to cancel this, so we have to just wait.
 			if (!load_completed.test())
 				ma_fence_wait(&fence);
 			ma_sound_uninit(&*snd);
 			snd.reset();
 			node = nullptr;
+			pcm_source.reset();
 			pcm_buffer.resize(0);
 			loaded_filename.clear();
 			load_completed.clear();
@@ -1504,6 +1684,8 @@ void RegisterSoundsystemMixer(asIScriptEngine *engine, const string &type) {
 	engine->RegisterObjectMethod(type.c_str(), "audio_pan_mode get_pan_mode() const property", asFUNCTION((virtual_call < T, &T::get_pan_mode, ma_pan_mode >)), asCALL_CDECL_OBJFIRST);
 	engine->RegisterObjectMethod(type.c_str(), "void set_pitch(float pitch) property", asFUNCTION((virtual_call < T, &T::set_pitch, void, float >)), asCALL_CDECL_OBJFIRST);
 	engine->RegisterObjectMethod(type.c_str(), "float get_pitch() const property", asFUNCTION((virtual_call < T, &T::get_pitch, float >)), asCALL_CDECL_OBJFIRST);
+	engine->RegisterObjectMethod(type.c_str(), "bool set_resampler_quality(audio_resampler_quality quality)", asFUNCTION((virtual_call < T, &T::set_resampler_quality, bool, audio_resampler_quality >)), asCALL_CDECL_OBJFIRST);
+	engine->RegisterObjectMethod(type.c_str(), "audio_resampler_quality get_resampler_quality() const property", asFUNCTION((virtual_call < T, &T::get_resampler_quality, audio_resampler_quality >)), asCALL_CDECL_OBJFIRST);
 	engine->RegisterObjectMethod(type.c_str(), "void set_spatialization_enabled(bool enabled) property", asFUNCTION((virtual_call < T, &T::set_spatialization_enabled, void, bool >)), asCALL_CDECL_OBJFIRST);
 	engine->RegisterObjectMethod(type.c_str(), "bool get_spatialization_enabled() const property", asFUNCTION((virtual_call < T, &T::get_spatialization_enabled, bool >)), asCALL_CDECL_OBJFIRST);
 	engine->RegisterObjectMethod(type.c_str(), "void set_pinned_listener(uint index) property", asFUNCTION((virtual_call < T, &T::set_pinned_listener, void, unsigned int >)), asCALL_CDECL_OBJFIRST);
@@ -1642,6 +1824,13 @@ void RegisterSoundsystemNodes(asIScriptEngine *engine) {
 	engine->RegisterObjectMethod("audio_freeverb_node", "float get_input_width() const property", asFUNCTION((virtual_call < freeverb_node, &freeverb_node::get_input_width, float >)), asCALL_CDECL_OBJFIRST);
 	engine->RegisterObjectMethod("audio_freeverb_node", "void set_frozen(bool frozen) property", asFUNCTION((virtual_call < freeverb_node, &freeverb_node::set_frozen, void, bool >)), asCALL_CDECL_OBJFIRST);
 	engine->RegisterObjectMethod("audio_freeverb_node", "bool get_frozen() const property", asFUNCTION((virtual_call < freeverb_node, &freeverb_node::get_frozen, bool >)), asCALL_CDECL_OBJFIRST);
+	RegisterSoundsystemAudioNode <tone_synth_node> (engine, "tone_synth_node");
+	engine->RegisterObjectMethod("tone_synth_node", "void set_looping(bool looping) property", asFUNCTION((virtual_call < tone_synth_node, &tone_synth_node::set_looping, void, bool >)), asCALL_CDECL_OBJFIRST);
+	engine->RegisterObjectMethod("tone_synth_node", "bool get_looping() const property", asFUNCTION((virtual_call < tone_synth_node, &tone_synth_node::get_looping, bool >)), asCALL_CDECL_OBJFIRST);
+	engine->RegisterObjectMethod("tone_synth_node", "bool get_finished() const property", asFUNCTION((virtual_call < tone_synth_node, &tone_synth_node::get_finished, bool >)), asCALL_CDECL_OBJFIRST);
+	engine->RegisterObjectMethod("tone_synth_node", "uint64 get_position_ms() const property", asFUNCTION((virtual_call < tone_synth_node, &tone_synth_node::get_position_ms, unsigned long long >)), asCALL_CDECL_OBJFIRST);
+	engine->RegisterObjectMethod("tone_synth_node", "uint64 get_length_ms() const property", asFUNCTION((virtual_call < tone_synth_node, &tone_synth_node::get_length_ms, unsigned long long >)), asCALL_CDECL_OBJFIRST);
+	engine->RegisterObjectMethod("tone_synth_node", "void rewind()", asFUNCTION((virtual_call < tone_synth_node, &tone_synth_node::rewind, void >)), asCALL_CDECL_OBJFIRST);
 	engine->RegisterObjectBehaviour("reverb3d", asBEHAVE_FACTORY, "reverb3d@ n(audio_node@ reverb, mixer@ destination = mixer(), audio_engine@+ engine = sound_default_engine)", asFUNCTION(reverb3d::create), asCALL_CDECL);
 	engine->RegisterObjectMethod("reverb3d", "void set_reverb(audio_node@ reverb) property", asFUNCTION((virtual_call < reverb3d, &reverb3d::set_reverb, void, audio_node*>)), asCALL_CDECL_OBJFIRST);
 	engine->RegisterObjectMethod("reverb3d", "audio_node@+ get_reverb() const property", asFUNCTION((virtual_call < reverb3d, &reverb3d::get_reverb, audio_node*>)), asCALL_CDECL_OBJFIRST);
@@ -1757,6 +1946,9 @@ void RegisterSoundsystem(asIScriptEngine *engine) {
 	engine->RegisterEnum("audio_pan_mode");
 	engine->RegisterEnumValue("audio_pan_mode", "AUDIO_PAN_MODE_BALANCE", ma_pan_mode_balance);
 	engine->RegisterEnumValue("audio_pan_mode", "AUDIO_PAN_MODE_PAN", ma_pan_mode_pan);
+	engine->RegisterEnum("audio_resampler_quality");
+	engine->RegisterEnumValue("audio_resampler_quality", "AUDIO_RESAMPLER_QUALITY_LINEAR", AUDIO_RESAMPLER_QUALITY_LINEAR);
+	engine->RegisterEnumValue("audio_resampler_quality", "AUDIO_RESAMPLER_QUALITY_SINC", AUDIO_RESAMPLER_QUALITY_SINC);
 	engine->RegisterEnum("audio_positioning_mode");
 	engine->RegisterEnumValue("audio_positioning_mode", "AUDIO_POSITIONING_ABSOLUTE", ma_positioning_absolute);
 	engine->RegisterEnumValue("audio_positioning_mode", "AUDIO_POSITIONING_RELATIVE", ma_positioning_relative);
@@ -1836,5 +2028,8 @@ void RegisterSoundsystem(asIScriptEngine *engine) {
 	engine->RegisterGlobalFunction("pack_interface@ get_sound_default_pack() property", asFUNCTION(get_sound_default_storage), asCALL_CDECL);
 	engine->RegisterGlobalFunction("void set_sound_master_volume(float db) property", asFUNCTION(set_sound_master_volume), asCALL_CDECL);
 	engine->RegisterGlobalFunction("float get_sound_master_volume() property", asFUNCTION(get_sound_master_volume), asCALL_CDECL);
+	engine->RegisterGlobalFunction("void set_sound_seek_index_threshold(uint bytes) property", asFUNCTION(set_sound_seek_index_threshold), asCALL_CDECL);
+	engine->RegisterGlobalFunction("uint get_sound_seek_index_threshold() property", asFUNCTION(get_sound_seek_index_threshold), asCALL_CDECL);
+	engine->RegisterGlobalFunction("void clear_sound_seek_index_cache()", asFUNCTION(clear_sound_seek_index_cache), asCALL_CDECL);
 	engine->RegisterGlobalFunction("audio_error_state get_SOUNDSYSTEM_LAST_ERROR() property", asFUNCTION(get_soundsystem_last_error), asCALL_CDECL);
 }
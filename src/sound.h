@@ -38,6 +38,12 @@ void uninit_sound();
 bool refresh_audio_devices();
 void garbage_collect_inline_sounds();
 
+// Selects the algorithm used to apply mixer::set_pitch. Linear uses miniaudio's built-in pitch resampler, sinc inserts a windowed sinc resampler node at the head of the mixer's internal node chain.
+enum audio_resampler_quality {
+	AUDIO_RESAMPLER_QUALITY_LINEAR = 0,
+	AUDIO_RESAMPLER_QUALITY_SINC = 1
+};
+
 class audio_node {
 public:
 	virtual void duplicate() = 0; // reference counting
@@ -170,6 +176,8 @@ public:
 	virtual ma_pan_mode get_pan_mode() const = 0;
 	virtual void set_pitch(float pitch) = 0;
 	virtual float get_pitch() const = 0;
+	virtual bool set_resampler_quality(audio_resampler_quality quality) = 0;
+	virtual audio_resampler_quality get_resampler_quality() const = 0;
 	virtual void set_spatialization_enabled(bool enabled) = 0;
 	virtual bool get_spatialization_enabled() const = 0;
 	virtual void set_pinned_listener(unsigned int index) = 0;
@@ -221,6 +229,19 @@ public:
 	virtual ma_uint64 get_time_in_milliseconds() const = 0;
 	virtual bool get_playing() const = 0;
 };
+// A thread safe queue of raw PCM exposed as a MiniAudio data source so that a sound can begin playing audio that is still being produced, for example by a speech synthesizer. One producer thread calls write and then finish, while the sound that loaded the stream consumes it from the audio thread. The stream pads with silence if the producer falls behind and reports its end once finished and drained.
+class pcm_stream {
+public:
+	virtual ~pcm_stream() = default;
+	virtual ma_data_source *get_data_source() = 0;
+	// Blocks while the buffer is full. Returns false if the stream was cancelled, usually because the sound playing it was closed.
+	virtual bool write(const void *frames, unsigned long long frame_count) = 0;
+	virtual void finish() = 0;
+	virtual void cancel() = 0;
+	virtual bool is_cancelled() const = 0;
+	// If buffer_frames is 0, one second of audio is buffered.
+	static std::shared_ptr<pcm_stream> create(ma_format format, int samplerate, int channels, unsigned int buffer_frames = 0);
+};
 class sound : public virtual mixer {
 public:
 	/**
@@ -254,6 +275,8 @@ public:
 	static bool pcm_to_wav(const void *buffer, unsigned int size, ma_format format, int samplerate, int channels, void *output);
 	virtual bool load_pcm(void *buffer, unsigned int size, ma_format format, int samplerate, int channels) = 0;
 	virtual bool load_pcm_script(CScriptArray *buffer, int samplerate, int channels) = 0;
+	// Plays audio from a pcm_stream as it is written. The sound holds a reference to the stream and cancels it when closed. Seeking and length queries are unavailable on such sounds.
+	virtual bool load_pcm_stream(std::shared_ptr<pcm_stream> stream) = 0;
 	virtual bool close() = 0;
 	virtual void set_autoclose(bool enabled = true) = 0;
 	virtual bool get_autoclose() const = 0;
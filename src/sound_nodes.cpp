@@ -11,13 +11,26 @@
  * 3. This notice may not be removed or altered from any source distribution.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <exception>
 #include <memory>
+#include <vector>
 #include <Poco/NotificationQueue.h>
 #include <Poco/Thread.h>
 #include <ma_reverb_node.h>
 #include "misc_functions.h" // range_convert
 #include "sound_nodes.h"
+#include "tonesynth.h"
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define NVGT_NODES_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+	#include <arm_neon.h>
+	#define NVGT_NODES_NEON
+#endif
 
 using namespace std;
 
@@ -266,6 +279,459 @@ mixer_monitor_node* mixer_monitor_node::create(mixer* m) { return new mixer_moni
 // This is OK as a global because even when a listener update on engine B causes sounds to update for engine A, this is still quite far less extraneous than each frame recalculating the listener direction needlessly every time.
 void set_sound_position_changed() { g_sound_position_changed += 1; if (g_sound_position_changed == -1) g_sound_position_changed += 1; }
 
+// High quality pitch shifting. Miniaudio applies ma_sound_set_pitch with a linear resampler inside of the engine node which aliases badly on sounds that are pitched up heavily, so when a mixer requests sinc quality we leave the engine node's pitch at 1.0 and do the resampling ourselves in this node instead.
+// The filter is a polyphase windowed sinc with linear interpolation between phases. Since a pitch above 1 is a decimation, the cutoff must drop to 1 / pitch to avoid aliasing, so we precompute tables for a handful of ratio buckets and pick the first bucket at or above the current ratio.
+#define SINC_TAPS 32 // Must be a multiple of 4 for the vectorized kernels.
+#define SINC_HALF (SINC_TAPS / 2)
+#define SINC_PHASES 64
+#define SINC_HISTORY_FRAMES 2048 // Per channel, comfortably larger than miniaudio's node cache so that we rarely need to compact.
+static const double sinc_pi = 3.14159265358979323846;
+static const float g_sinc_ratio_buckets[] = {1.0f, 1.25f, 1.5f, 2.0f, 3.0f, 4.0f, 6.0f, 8.0f};
+static const int g_sinc_ratio_bucket_count = sizeof(g_sinc_ratio_buckets) / sizeof(float);
+struct sinc_table {
+	alignas(16) float coeffs[SINC_PHASES][SINC_TAPS];
+	alignas(16) float deltas[SINC_PHASES][SINC_TAPS]; // coeffs[phase + 1] - coeffs[phase], so that interpolating between phases is a single multiply add per tap.
+};
+static vector<sinc_table> build_sinc_tables() {
+	vector<sinc_table> tables(g_sinc_ratio_bucket_count);
+	vector<double> row(SINC_TAPS), next(SINC_TAPS);
+	for (int b = 0; b < g_sinc_ratio_bucket_count; b++) {
+		double cutoff = 0.95 / g_sinc_ratio_buckets[b]; // Leave a little transition band below nyquist.
+		auto compute_row = [cutoff](int phase, vector<double>& out) {
+			double frac = double(phase) / SINC_PHASES, sum = 0;
+			for (int k = 0; k < SINC_TAPS; k++) {
+				double t = (k - SINC_HALF + 1) - frac;
+				double x = sinc_pi * cutoff * t;
+				double sinc = fabs(x) < 1e-9 ? 1.0 : sin(x) / x;
+				double u = t / SINC_HALF; // Blackman window over [-1, 1].
+				double window = 0.42 + 0.5 * cos(sinc_pi * u) + 0.08 * cos(2 * sinc_pi * u);
+				out[k] = sinc * window;
+				sum += out[k];
+			}
+			for (int k = 0; k < SINC_TAPS; k++) out[k] /= sum; // Unity gain at DC for every phase.
+		};
+		compute_row(0, row);
+		for (int p = 0; p < SINC_PHASES; p++) {
+			compute_row(p + 1, next);
+			for (int k = 0; k < SINC_TAPS; k++) {
+				tables[b].coeffs[p][k] = float(row[k]);
+				tables[b].deltas[p][k] = float(next[k] - row[k]);
+			}
+			row.swap(next);
+		}
+	}
+	return tables;
+}
+static const sinc_table& get_sinc_table(double ratio) {
+	static const vector<sinc_table> tables = build_sinc_tables();
+	int b = 0;
+	while (b < g_sinc_ratio_bucket_count - 1 && g_sinc_ratio_buckets[b] < ratio) b++;
+	return tables[b];
+}
+// Convolve SINC_TAPS contiguous input samples with the filter for a given phase, f being the position between this phase and the next.
+static inline float sinc_convolve(const float* x, const float* c, const float* d, float f) {
+	#if defined(NVGT_NODES_SSE)
+	__m128 acc = _mm_setzero_ps(), fv = _mm_set1_ps(f);
+	for (int k = 0; k < SINC_TAPS; k += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_add_ps(_mm_load_ps(c + k), _mm_mul_ps(fv, _mm_load_ps(d + k)))));
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+	return _mm_cvtss_f32(acc);
+	#elif defined(NVGT_NODES_NEON)
+	float32x4_t acc = vdupq_n_f32(0);
+	for (int k = 0; k < SINC_TAPS; k += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(x + k), vmlaq_n_f32(vld1q_f32(c + k), vld1q_f32(d + k), f));
+	float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	return vget_lane_f32(vpadd_f32(sum, sum), 0);
+	#else
+	float acc = 0;
+	for (int k = 0; k < SINC_TAPS; k++) acc += x[k] * (c[k] + f * d[k]);
+	return acc;
+	#endif
+}
+typedef struct {
+	ma_node_base base;
+	ma_uint32 channels;
+	atomic<float> pitch;
+	atomic<bool> reset_requested;
+	double position; // Fractional read position within history in frames, always at least SINC_HALF - 1 so that there is a full window behind it.
+	ma_uint32 filled; // Frames of history currently buffered per channel.
+	vector<float> history; // Planar so that each channel's window is contiguous for the convolution kernel.
+} ma_pitch_resampler_node;
+static void ma_pitch_resampler_node_reset(ma_pitch_resampler_node* rn) {
+	fill(rn->history.begin(), rn->history.end(), 0.0f);
+	rn->position = SINC_HALF - 1;
+	rn->filled = SINC_HALF - 1; // Zeroed lead in, the first real input frame lands exactly at position.
+}
+static double ma_pitch_resampler_node_get_ratio(ma_pitch_resampler_node* rn) { return clamp(double(rn->pitch.load()), 1.0 / 16, 16.0); }
+static void ma_pitch_resampler_node_process_pcm_frames(ma_node* pNode, const float** ppFramesIn, ma_uint32* pFrameCountIn, float** ppFramesOut, ma_uint32* pFrameCountOut) {
+	ma_pitch_resampler_node* rn = (ma_pitch_resampler_node*)pNode;
+	if (rn->reset_requested.exchange(false)) ma_pitch_resampler_node_reset(rn);
+	const ma_uint32 channels = rn->channels;
+	const double ratio = ma_pitch_resampler_node_get_ratio(rn);
+	const sinc_table& table = get_sinc_table(ratio);
+	const float* in = ppFramesIn ? ppFramesIn[0] : nullptr;
+	ma_uint32 in_available = in ? *pFrameCountIn : 0, in_consumed = 0, out_produced = 0;
+	float* out = ppFramesOut[0];
+	float* history = rn->history.data();
+	while (out_produced < *pFrameCountOut) {
+		ma_uint32 i0 = ma_uint32(rn->position);
+		if (i0 + SINC_HALF >= rn->filled) {
+			if (in_consumed >= in_available) break;
+			if (rn->filled == SINC_HISTORY_FRAMES) {
+				// Drop everything that is behind the current window.
+				ma_uint32 discard = min(i0 - SINC_HALF + 1, rn->filled);
+				for (ma_uint32 c = 0; c < channels; c++) memmove(history + c * SINC_HISTORY_FRAMES, history + c * SINC_HISTORY_FRAMES + discard, (rn->filled - discard) * sizeof(float));
+				rn->filled -= discard;
+				rn->position -= discard;
+			}
+			ma_uint32 count = min(in_available - in_consumed, SINC_HISTORY_FRAMES - rn->filled);
+			const float* src = in + in_consumed * channels;
+			for (ma_uint32 c = 0; c < channels; c++) {
+				float* dest = history + c * SINC_HISTORY_FRAMES + rn->filled;
+				for (ma_uint32 i = 0; i < count; i++) dest[i] = src[i * channels + c];
+			}
+			rn->filled += count;
+			in_consumed += count;
+			continue;
+		}
+		double phase = (rn->position - i0) * SINC_PHASES;
+		int p = int(phase);
+		float f = float(phase - p);
+		for (ma_uint32 c = 0; c < channels; c++)
+			out[out_produced * channels + c] = sinc_convolve(history + c * SINC_HISTORY_FRAMES + i0 - SINC_HALF + 1, table.coeffs[p], table.deltas[p], f);
+		out_produced++;
+		rn->position += ratio;
+	}
+	*pFrameCountIn = in_consumed;
+	*pFrameCountOut = out_produced;
+}
+static ma_result ma_pitch_resampler_node_get_required_input_frame_count(ma_node* pNode, ma_uint32 outputFrameCount, ma_uint32* pInputFrameCount) {
+	ma_pitch_resampler_node* rn = (ma_pitch_resampler_node*)pNode;
+	double end = rn->position + outputFrameCount * ma_pitch_resampler_node_get_ratio(rn) + SINC_HALF + 1;
+	*pInputFrameCount = end > rn->filled ? ma_uint32(ceil(end - rn->filled)) : 1;
+	return MA_SUCCESS;
+}
+static ma_node_vtable ma_pitch_resampler_node_vtable = { ma_pitch_resampler_node_process_pcm_frames, ma_pitch_resampler_node_get_required_input_frame_count, 1, 1, MA_NODE_FLAG_DIFFERENT_PROCESSING_RATES };
+class pitch_resampler_node_impl : public audio_node_impl, public virtual pitch_resampler_node {
+	unique_ptr<ma_pitch_resampler_node> rn;
+	public:
+	pitch_resampler_node_impl(audio_engine* e, int channels) : rn(make_unique<ma_pitch_resampler_node>()), audio_node_impl(nullptr, e) {
+		get_sinc_table(1.0); // Build the filter tables now rather than in the audio thread.
+		rn->channels = channels;
+		rn->pitch = 1.0f;
+		rn->reset_requested = false;
+		rn->history.resize(SINC_HISTORY_FRAMES * channels);
+		ma_pitch_resampler_node_reset(&*rn);
+		ma_node_config cfg = ma_node_config_init();
+		ma_uint32 ch = channels;
+		cfg.vtable          = &ma_pitch_resampler_node_vtable;
+		cfg.pInputChannels  = &ch;
+		cfg.pOutputChannels = &ch;
+		if ((g_soundsystem_last_error = ma_node_init(ma_engine_get_node_graph(e->get_ma_engine()), &cfg, nullptr, (ma_node_base*)&*rn)) != MA_SUCCESS) throw std::runtime_error("failed to create pitch_resampler_node");
+		node = (ma_node_base*)&*rn;
+	}
+	~pitch_resampler_node_impl() {
+		if (node) ma_node_uninit(node, nullptr);
+	}
+	void set_pitch(float pitch) override { if (pitch > 0) rn->pitch = pitch; }
+	float get_pitch() const override { return rn->pitch; }
+	void reset() override { rn->reset_requested = true; }
+};
+pitch_resampler_node* pitch_resampler_node::create(audio_engine* e, int channels) { return new pitch_resampler_node_impl(e, channels); }
+
+// Streaming tone_synth playback. Every recorded tone becomes a voice that is synthesized block by block as the node is read. The oscillator phase is accumulated serially because pitch bends change the phase step every frame, after which the waveform is shaped from those phases 4 frames at a time. The waveforms including their polyBLEP band limiting match those in dep/tonar.c.
+#define TONE_SYNTH_BLOCK_FRAMES 256
+#if defined(NVGT_NODES_SSE)
+	typedef __m128 simd_float4;
+	typedef __m128 simd_mask4;
+	static inline simd_float4 simd_set1(float v) { return _mm_set1_ps(v); }
+	static inline simd_float4 simd_load(const float* p) { return _mm_load_ps(p); }
+	static inline void simd_store(float* p, simd_float4 v) { _mm_store_ps(p, v); }
+	static inline simd_float4 simd_add(simd_float4 a, simd_float4 b) { return _mm_add_ps(a, b); }
+	static inline simd_float4 simd_sub(simd_float4 a, simd_float4 b) { return _mm_sub_ps(a, b); }
+	static inline simd_float4 simd_mul(simd_float4 a, simd_float4 b) { return _mm_mul_ps(a, b); }
+	static inline simd_float4 simd_min(simd_float4 a, simd_float4 b) { return _mm_min_ps(a, b); }
+	static inline simd_float4 simd_max(simd_float4 a, simd_float4 b) { return _mm_max_ps(a, b); }
+	static inline simd_mask4 simd_lt(simd_float4 a, simd_float4 b) { return _mm_cmplt_ps(a, b); }
+	static inline simd_mask4 simd_gt(simd_float4 a, simd_float4 b) { return _mm_cmpgt_ps(a, b); }
+	static inline simd_float4 simd_select(simd_mask4 m, simd_float4 a, simd_float4 b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+	#define NVGT_NODES_SIMD
+#elif defined(NVGT_NODES_NEON)
+	typedef float32x4_t simd_float4;
+	typedef uint32x4_t simd_mask4;
+	static inline simd_float4 simd_set1(float v) { return vdupq_n_f32(v); }
+	static inline simd_float4 simd_load(const float* p) { return vld1q_f32(p); }
+	static inline void simd_store(float* p, simd_float4 v) { vst1q_f32(p, v); }
+	static inline simd_float4 simd_add(simd_float4 a, simd_float4 b) { return vaddq_f32(a, b); }
+	static inline simd_float4 simd_sub(simd_float4 a, simd_float4 b) { return vsubq_f32(a, b); }
+	static inline simd_float4 simd_mul(simd_float4 a, simd_float4 b) { return vmulq_f32(a, b); }
+	static inline simd_float4 simd_min(simd_float4 a, simd_float4 b) { return vminq_f32(a, b); }
+	static inline simd_float4 simd_max(simd_float4 a, simd_float4 b) { return vmaxq_f32(a, b); }
+	static inline simd_mask4 simd_lt(simd_float4 a, simd_float4 b) { return vcltq_f32(a, b); }
+	static inline simd_mask4 simd_gt(simd_float4 a, simd_float4 b) { return vcgtq_f32(a, b); }
+	static inline simd_float4 simd_select(simd_mask4 m, simd_float4 a, simd_float4 b) { return vbslq_f32(m, a, b); }
+	#define NVGT_NODES_SIMD
+#endif
+// sin(2 * pi * x) for x in [-0.25, 0.25], a Taylor series that is accurate to roughly 4e-6 at the edges of that range.
+#define TONE_SYNTH_SIN_C1 6.28318531f
+#define TONE_SYNTH_SIN_C3 -41.3417022f
+#define TONE_SYNTH_SIN_C5 81.6052492f
+#define TONE_SYNTH_SIN_C7 -76.7058597f
+#define TONE_SYNTH_SIN_C9 42.0586939f
+static inline float tone_synth_poly_blep(float t, float dt, float inv_dt) {
+	if (t < dt) {
+		t *= inv_dt;
+		return t + t - t * t - 1.0f;
+	} else if (t > 1.0f - dt) {
+		t = (t - 1.0f) * inv_dt;
+		return t * t + t + t + 1.0f;
+	}
+	return 0.0f;
+}
+static inline float tone_synth_shape_sample(int waveform, float p, float dt, float inv_dt) {
+	switch (waveform) {
+		case el_tonar_waveform_sine: {
+			float x = p - 0.5f; // sin(2 * pi * p) = -sin(2 * pi * (p - 0.5)), then fold into the quarter period the polynomial covers.
+			x = max(min(x, 0.5f - x), -0.5f - x);
+			float x2 = x * x;
+			return -x * (TONE_SYNTH_SIN_C1 + x2 * (TONE_SYNTH_SIN_C3 + x2 * (TONE_SYNTH_SIN_C5 + x2 * (TONE_SYNTH_SIN_C7 + x2 * TONE_SYNTH_SIN_C9))));
+		}
+		case el_tonar_waveform_triangle:
+			return 1.0f - 4.0f * fabsf(p - 0.5f);
+		case el_tonar_waveform_square: {
+			float p2 = p + 0.5f;
+			if (p2 >= 1.0f) p2 -= 1.0f;
+			return (p >= 0.5f ? -1.0f : 1.0f) + tone_synth_poly_blep(p, dt, inv_dt) - tone_synth_poly_blep(p2, dt, inv_dt);
+		}
+		case el_tonar_waveform_saw:
+			return 2.0f * p - 1.0f - tone_synth_poly_blep(p, dt, inv_dt);
+	}
+	return 0.0f;
+}
+#ifdef NVGT_NODES_SIMD
+static inline simd_float4 tone_synth_poly_blep4(simd_float4 t, simd_float4 dt, simd_float4 inv_dt) {
+	const simd_float4 one = simd_set1(1.0f);
+	simd_float4 a = simd_mul(t, inv_dt), b = simd_mul(simd_sub(t, one), inv_dt);
+	simd_float4 rising = simd_sub(simd_sub(simd_add(a, a), simd_mul(a, a)), one);
+	simd_float4 falling = simd_add(simd_add(simd_mul(b, b), simd_add(b, b)), one);
+	return simd_select(simd_lt(t, dt), rising, simd_select(simd_gt(t, simd_sub(one, dt)), falling, simd_set1(0.0f)));
+}
+#endif
+static void tone_synth_shape(int waveform, const float* phase, const float* dt, const float* inv_dt, float* output, ma_uint32 count) {
+	ma_uint32 i = 0;
+	#ifdef NVGT_NODES_SIMD
+	const simd_float4 zero = simd_set1(0.0f), half = simd_set1(0.5f), one = simd_set1(1.0f), two = simd_set1(2.0f), four = simd_set1(4.0f);
+	for (; i + 4 <= count; i += 4) {
+		simd_float4 p = simd_load(phase + i), v;
+		if (waveform == el_tonar_waveform_sine) {
+			simd_float4 x = simd_sub(p, half);
+			x = simd_max(simd_min(x, simd_sub(half, x)), simd_sub(simd_sub(zero, half), x));
+			simd_float4 x2 = simd_mul(x, x);
+			v = simd_add(simd_set1(TONE_SYNTH_SIN_C7), simd_mul(x2, simd_set1(TONE_SYNTH_SIN_C9)));
+			v = simd_add(simd_set1(TONE_SYNTH_SIN_C5), simd_mul(x2, v));
+			v = simd_add(simd_set1(TONE_SYNTH_SIN_C3), simd_mul(x2, v));
+			v = simd_add(simd_set1(TONE_SYNTH_SIN_C1), simd_mul(x2, v));
+			v = simd_mul(simd_sub(zero, x), v);
+		} else if (waveform == el_tonar_waveform_triangle) {
+			simd_float4 d = simd_sub(p, half);
+			v = simd_sub(one, simd_mul(four, simd_max(d, simd_sub(zero, d))));
+		} else if (waveform == el_tonar_waveform_square) {
+			simd_float4 d = simd_load(dt + i), inv = simd_load(inv_dt + i), p2 = simd_add(p, half);
+			p2 = simd_select(simd_lt(p2, one), p2, simd_sub(p2, one));
+			v = simd_select(simd_lt(p, half), one, simd_sub(zero, one));
+			v = simd_sub(simd_add(v, tone_synth_poly_blep4(p, d, inv)), tone_synth_poly_blep4(p2, d, inv));
+		} else if (waveform == el_tonar_waveform_saw)
+			v = simd_sub(simd_sub(simd_mul(two, p), one), tone_synth_poly_blep4(p, simd_load(dt + i), simd_load(inv_dt + i)));
+		else v = zero;
+		simd_store(output + i, v);
+	}
+	#endif
+	for (; i < count; i++) output[i] = tone_synth_shape_sample(waveform, phase[i], dt[i], inv_dt[i]);
+}
+struct tone_synth_voice {
+	ma_uint64 start; // All positions in output frames.
+	ma_uint64 frames;
+	ma_uint64 bend_start;
+	ma_uint64 bend_end;
+	ma_uint64 fade_in;
+	ma_uint64 fade_out;
+	double start_step; // Phase increments per frame.
+	double target_step;
+	double bend_multiplier; // Applied to the step every frame during a bend, which produces tonar's exponential curve.
+	float left; // Volume and pan.
+	float right;
+	int waveform;
+};
+struct tone_synth_voice_state {
+	const tone_synth_voice* voice;
+	double phase;
+	double bend_step;
+};
+static void tone_synth_render_voice(tone_synth_voice_state& state, ma_uint64 position, ma_uint32 count, float* output, ma_uint32 channels) {
+	const tone_synth_voice& v = *state.voice;
+	ma_uint32 offset = v.start > position ? ma_uint32(v.start - position) : 0;
+	if (offset >= count) return;
+	ma_uint64 x0 = position + offset - v.start;
+	if (x0 >= v.frames) return;
+	ma_uint32 n = ma_uint32(min<ma_uint64>(count - offset, v.frames - x0));
+	alignas(16) float phase[TONE_SYNTH_BLOCK_FRAMES], dt[TONE_SYNTH_BLOCK_FRAMES], inv_dt[TONE_SYNTH_BLOCK_FRAMES], samples[TONE_SYNTH_BLOCK_FRAMES];
+	double last_step = 0, last_inv = 0;
+	for (ma_uint32 i = 0; i < n; i++) {
+		ma_uint64 x = x0 + i;
+		double step;
+		if (x < v.bend_start) step = v.start_step;
+		else if (x >= v.bend_end) step = v.target_step;
+		else {
+			step = state.bend_step;
+			state.bend_step *= v.bend_multiplier;
+		}
+		if (step != last_step) {
+			last_step = step;
+			last_inv = 1.0 / step;
+		}
+		phase[i] = float(state.phase);
+		dt[i] = float(step);
+		inv_dt[i] = float(last_inv);
+		state.phase += step;
+		if (state.phase >= 1.0) state.phase -= 1.0;
+	}
+	tone_synth_shape(v.waveform, phase, dt, inv_dt, samples, n);
+	if (x0 < v.fade_in || x0 + n > v.frames - v.fade_out) {
+		for (ma_uint32 i = 0; i < n; i++) {
+			ma_uint64 x = x0 + i;
+			if (x < v.fade_in) samples[i] *= float(x) / v.fade_in;
+			if (x >= v.frames - v.fade_out) samples[i] *= float(v.frames - x) / v.fade_out;
+		}
+	}
+	output += offset * channels;
+	if (channels == 1) {
+		for (ma_uint32 i = 0; i < n; i++) output[i] += samples[i] * v.left;
+	} else {
+		for (ma_uint32 i = 0; i < n; i++) {
+			output[i * channels] += samples[i] * v.left;
+			output[i * channels + 1] += samples[i] * v.right;
+		}
+	}
+}
+typedef struct {
+	ma_node_base base;
+	ma_uint32 channels;
+	vector<tone_synth_voice> voices; // Sorted by start.
+	vector<tone_synth_voice_state> active; // Capacity is reserved up front so that the audio thread never allocates.
+	size_t next_voice;
+	ma_uint64 position;
+	ma_uint64 length;
+	atomic<ma_uint64> reported_position;
+	atomic<bool> looping;
+	atomic<bool> finished;
+	atomic<bool> rewind_requested;
+} ma_tone_synth_node;
+static void ma_tone_synth_node_rewind(ma_tone_synth_node* tn) {
+	tn->active.clear();
+	tn->next_voice = 0;
+	tn->position = 0;
+	tn->finished = false;
+}
+static void ma_tone_synth_node_process_pcm_frames(ma_node* pNode, const float** ppFramesIn, ma_uint32* pFrameCountIn, float** ppFramesOut, ma_uint32* pFrameCountOut) {
+	ma_tone_synth_node* tn = (ma_tone_synth_node*)pNode;
+	float* out = ppFramesOut[0];
+	ma_uint32 frame_count = *pFrameCountOut, done = 0;
+	memset(out, 0, frame_count * tn->channels * sizeof(float));
+	if (tn->rewind_requested.exchange(false)) ma_tone_synth_node_rewind(tn);
+	while (done < frame_count) {
+		if (tn->position >= tn->length) {
+			if (!tn->looping || tn->length == 0) {
+				tn->finished = true;
+				break;
+			}
+			ma_tone_synth_node_rewind(tn);
+		}
+		ma_uint32 count = ma_uint32(min<ma_uint64>(min<ma_uint64>(frame_count - done, TONE_SYNTH_BLOCK_FRAMES), tn->length - tn->position));
+		while (tn->next_voice < tn->voices.size() && tn->voices[tn->next_voice].start < tn->position + count) {
+			const tone_synth_voice& v = tn->voices[tn->next_voice++];
+			tn->active.push_back({&v, 0.0, v.start_step});
+		}
+		for (size_t i = 0; i < tn->active.size();) {
+			tone_synth_render_voice(tn->active[i], tn->position, count, out + done * tn->channels, tn->channels);
+			const tone_synth_voice* v = tn->active[i].voice;
+			if (v->start + v->frames <= tn->position + count) {
+				tn->active[i] = tn->active.back();
+				tn->active.pop_back();
+			} else i++;
+		}
+		tn->position += count;
+		done += count;
+	}
+	tn->reported_position = tn->position;
+}
+static ma_node_vtable ma_tone_synth_node_vtable = { ma_tone_synth_node_process_pcm_frames, nullptr, 0, 1, 0 };
+// Matches elz_tonar_calculate_fade_start and elz_tonar_calculate_fade_end.
+static int tone_synth_fade_ms(int fade, int other_fade, int length) {
+	if (fade <= 0) return 0;
+	int total = fade + other_fade;
+	if (length > total) return fade;
+	return int(double(fade) / total * length);
+}
+class tone_synth_node_impl : public audio_node_impl, public virtual tone_synth_node {
+	unique_ptr<ma_tone_synth_node> tn;
+	ma_uint32 sample_rate;
+	ma_uint64 ms_to_frames(int ms) const { return ms > 0 ? ma_uint64(double(sample_rate) / 1000 * ms) : 0; }
+	public:
+	tone_synth_node_impl(audio_engine* e, const vector<tone_synth_event>& events, int length, int synth_sample_rate, int channels) : tn(make_unique<ma_tone_synth_node>()), audio_node_impl(nullptr, e) {
+		if (!e) throw std::runtime_error("no audio engine for tone_synth_node");
+		if (channels < 1 || channels > 2 || synth_sample_rate < 1) throw std::invalid_argument("unsupported tone_synth format");
+		sample_rate = ma_engine_get_sample_rate(e->get_ma_engine());
+		double ratio = double(sample_rate) / synth_sample_rate;
+		tn->channels = channels;
+		tn->length = ma_uint64(max(length, 0) * ratio);
+		tn->voices.reserve(events.size());
+		for (const tone_synth_event& ev : events) {
+			tone_synth_voice v;
+			v.start = ma_uint64(ev.start * ratio);
+			if (v.start >= tn->length) continue;
+			v.frames = min(ms_to_frames(ev.length), tn->length - v.start);
+			v.bend_start = ms_to_frames(ev.bend_start);
+			v.bend_end = ms_to_frames(min(ev.bend_start + ev.bend_length, ev.length));
+			v.fade_in = ms_to_frames(tone_synth_fade_ms(ev.fade_start, ev.fade_end, ev.length));
+			v.fade_out = min(ms_to_frames(tone_synth_fade_ms(ev.fade_end, ev.fade_start, ev.length)), v.frames);
+			v.start_step = ev.freq / sample_rate;
+			v.target_step = (ev.freq + ev.bend_amount) / sample_rate;
+			v.bend_multiplier = v.bend_end > v.bend_start ? pow(v.target_step / v.start_step, 1.0 / (v.bend_end - v.bend_start)) : 1.0;
+			double amplitude = pow(10.0, ev.volume / 20.0);
+			double angle = (ev.pan + 100) * sinc_pi / 4 / 100;
+			v.left = float(channels == 1 ? amplitude : amplitude * cos(angle));
+			v.right = float(channels == 1 ? amplitude : amplitude * sin(angle));
+			v.waveform = ev.waveform;
+			tn->voices.push_back(v);
+		}
+		stable_sort(tn->voices.begin(), tn->voices.end(), [](const tone_synth_voice& a, const tone_synth_voice& b) { return a.start < b.start; });
+		tn->active.reserve(tn->voices.size());
+		tn->next_voice = 0;
+		tn->position = 0;
+		tn->reported_position = 0;
+		tn->looping = false;
+		tn->finished = false;
+		tn->rewind_requested = false;
+		ma_node_config cfg = ma_node_config_init();
+		ma_uint32 ch = channels;
+		cfg.vtable          = &ma_tone_synth_node_vtable;
+		cfg.pOutputChannels = &ch;
+		if ((g_soundsystem_last_error = ma_node_init(ma_engine_get_node_graph(e->get_ma_engine()), &cfg, nullptr, (ma_node_base*)&*tn)) != MA_SUCCESS) throw std::runtime_error("failed to create tone_synth_node");
+		node = (ma_node_base*)&*tn;
+	}
+	~tone_synth_node_impl() {
+		if (node) ma_node_uninit(node, nullptr);
+	}
+	void set_looping(bool looping) override { tn->looping = looping; }
+	bool get_looping() const override { return tn->looping; }
+	bool get_finished() const override { return tn->finished; }
+	unsigned long long get_position_ms() const override { return tn->reported_position * 1000 / sample_rate; }
+	unsigned long long get_length_ms() const override { return tn->length * 1000 / sample_rate; }
+	void rewind() override { tn->rewind_requested = true; }
+};
+tone_synth_node* tone_synth_node::create(audio_engine* e, const vector<tone_synth_event>& events, int length, int sample_rate, int channels) { return new tone_synth_node_impl(e, events, length, sample_rate, channels); }
+
 class splitter_node_impl : public audio_node_impl, public virtual splitter_node {
 	unique_ptr<ma_splitter_node> sn;
 	public:
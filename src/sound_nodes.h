@@ -11,6 +11,7 @@
 */
 
 #include <exception>
+#include <vector>
 #include <angelscript.h> // asAtomic
 #include <miniaudio_phonon.h>
 #include "sound.h"
@@ -90,6 +91,26 @@ class mixer_monitor_node : public virtual audio_node {
 	static mixer_monitor_node* create(mixer* m);
 	virtual void set_position_changed() = 0;
 };
+// A windowed sinc resampler used for high quality pitch shifting, see mixer::set_resampler_quality.
+class pitch_resampler_node : public virtual audio_node {
+	public:
+	static pitch_resampler_node* create(audio_engine* engine, int channels);
+	virtual void set_pitch(float pitch) = 0;
+	virtual float get_pitch() const = 0;
+	virtual void reset() = 0; // Discards buffered history, for example after the source sound is reloaded.
+};
+// Synthesizes a tone_synth score on the fly, see tone_synth::create_node. Memory use depends only on the number of notes, and playback begins with the first callback rather than after the whole sequence has been rendered.
+struct tone_synth_event;
+class tone_synth_node : public virtual audio_node {
+	public:
+	static tone_synth_node* create(audio_engine* engine, const std::vector<tone_synth_event>& events, int length, int sample_rate, int channels);
+	virtual void set_looping(bool looping) = 0;
+	virtual bool get_looping() const = 0;
+	virtual bool get_finished() const = 0;
+	virtual unsigned long long get_position_ms() const = 0;
+	virtual unsigned long long get_length_ms() const = 0;
+	virtual void rewind() = 0;
+};
 class splitter_node : public virtual audio_node {
 	public:
 	static splitter_node* create(audio_engine* engine, int channels);
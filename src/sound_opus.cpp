@@ -0,0 +1,365 @@
+/* sound_opus.cpp - Ogg Opus decoding backend
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include "sound_opus.h"
+
+#ifndef MA_NO_LIBOPUS
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <ogg/ogg.h>
+#include <opus/opus_multistream.h>
+
+static const int opus_rate = 48000;
+static const int opus_max_packet_frames = 5760; // 120 ms, the longest an Opus packet can be.
+static const ma_int64 opus_preroll = 3840;     // 80 ms, enough for the decoder to converge after a seek.
+static const ma_uint64 opus_bisect_threshold = 65536; // Below this many bytes we scan pages linearly rather than keep bisecting.
+
+typedef struct ma_opus {
+	ma_data_source_base ds; // Must be first.
+	ma_read_proc onRead;
+	ma_seek_proc onSeek;
+	ma_tell_proc onTell;
+	void *pReadSeekTellUserData;
+	ma_format format; // f32 or s16.
+	ogg_sync_state oy;
+	ogg_stream_state os;
+	OpusMSDecoder *decoder;
+	int serial;
+	int channels;
+	ma_int64 pre_skip;
+	ma_uint64 data_start; // Byte offset of the first audio page.
+	ma_uint64 file_size;  // 0 if the stream can't tell us, in which case we can't seek.
+	ma_uint64 sync_offset; // Byte offset of the next unconsumed byte in oy.
+	ma_uint64 length;     // In frames, after pre-skip.
+	ma_uint64 cursor;     // In frames, after pre-skip.
+	ma_int64 granule;     // Granule position at which the next packet starts.
+	ma_int64 discard;     // Frames to drop from the front of upcoming output, for pre-skip and seek pre-roll.
+	bool eos;
+	std::vector<unsigned char> pcm; // The most recently decoded packet.
+	int pcm_frames, pcm_pos;
+} ma_opus;
+
+// Ogg plumbing.
+static void ma_opus_raw_seek(ma_opus *pOpus, ma_uint64 offset) {
+	pOpus->onSeek(pOpus->pReadSeekTellUserData, (ma_int64)offset, ma_seek_origin_start);
+	ogg_sync_reset(&pOpus->oy);
+	pOpus->sync_offset = offset;
+}
+static bool ma_opus_next_page(ma_opus *pOpus, ogg_page *og, ma_uint64 *offset) {
+	for (;;) {
+		long ret = ogg_sync_pageseek(&pOpus->oy, og);
+		if (ret < 0) {
+			pOpus->sync_offset += -ret; // Skipped bytes that weren't a page.
+			continue;
+		} else if (ret > 0) {
+			if (offset)
+				*offset = pOpus->sync_offset;
+			pOpus->sync_offset += ret;
+			return true;
+		}
+		char *buffer = ogg_sync_buffer(&pOpus->oy, 8192);
+		size_t bytes_read = 0;
+		if (!buffer)
+			return false;
+		pOpus->onRead(pOpus->pReadSeekTellUserData, buffer, 8192, &bytes_read);
+		if (bytes_read == 0)
+			return false;
+		ogg_sync_wrote(&pOpus->oy, (long)bytes_read);
+	}
+}
+// Reads pages from the current position until one of ours that completes a packet, stopping at limit.
+static bool ma_opus_next_granule_page(ma_opus *pOpus, ma_uint64 limit, ogg_page *og, ma_uint64 *offset) {
+	while (ma_opus_next_page(pOpus, og, offset) && *offset < limit) {
+		if (ogg_page_serialno(og) == pOpus->serial && ogg_page_granulepos(og) >= 0)
+			return true;
+	}
+	return false;
+}
+
+static bool ma_opus_parse_head(ma_opus *pOpus, const ogg_packet &op) {
+	const unsigned char *p = op.packet;
+	if (op.bytes < 19 || memcmp(p, "OpusHead", 8) != 0 || (p[8] >> 4) != 0)
+		return false; // Only major version 0 is defined.
+	pOpus->channels = p[9];
+	pOpus->pre_skip = p[10] | (p[11] << 8);
+	int gain = (ma_int16)(p[16] | (p[17] << 8)); // Q7.8 dB, which is exactly what OPUS_SET_GAIN wants.
+	int family = p[18];
+	int streams = 1, coupled = pOpus->channels > 1 ? 1 : 0;
+	unsigned char mapping[255] = {0, 1};
+	if (pOpus->channels < 1)
+		return false;
+	if (family == 0) {
+		if (pOpus->channels > 2)
+			return false;
+	} else {
+		if (op.bytes < 21 + pOpus->channels)
+			return false;
+		streams = p[19];
+		coupled = p[20];
+		memcpy(mapping, p + 21, pOpus->channels);
+	}
+	int err;
+	pOpus->decoder = opus_multistream_decoder_create(opus_rate, pOpus->channels, streams, coupled, mapping, &err);
+	if (!pOpus->decoder)
+		return false;
+	if (gain != 0)
+		opus_multistream_decoder_ctl(pOpus->decoder, OPUS_SET_GAIN(gain));
+	return true;
+}
+static bool ma_opus_open(ma_opus *pOpus) {
+	// Cheaply reject anything that isn't Ogg Opus before handing libogg a stream it would otherwise scan end to end looking for a page.
+	unsigned char head[64];
+	size_t head_size = 0;
+	pOpus->onRead(pOpus->pReadSeekTellUserData, head, sizeof(head), &head_size);
+	if (head_size < 28 || memcmp(head, "OggS", 4) != 0 || 27 + (size_t)head[26] + 8 > head_size || memcmp(head + 27 + head[26], "OpusHead", 8) != 0)
+		return false;
+	ma_opus_raw_seek(pOpus, 0);
+	ogg_page og;
+	ogg_packet op;
+	ma_uint64 offset;
+	if (!ma_opus_next_page(pOpus, &og, &offset) || !ogg_page_bos(&og))
+		return false;
+	pOpus->serial = ogg_page_serialno(&og);
+	ogg_stream_reset_serialno(&pOpus->os, pOpus->serial);
+	ogg_stream_pagein(&pOpus->os, &og);
+	if (ogg_stream_packetout(&pOpus->os, &op) != 1 || !ma_opus_parse_head(pOpus, op))
+		return false;
+	// The comment header follows and can span several pages. Audio starts on the page after it ends.
+	for (;;) {
+		int ret = ogg_stream_packetout(&pOpus->os, &op);
+		if (ret == 1)
+			break;
+		if (ret < 0 || !ma_opus_next_page(pOpus, &og, &offset))
+			return false;
+		if (ogg_page_serialno(&og) == pOpus->serial)
+			ogg_stream_pagein(&pOpus->os, &og);
+	}
+	if (op.bytes < 8 || memcmp(op.packet, "OpusTags", 8) != 0)
+		return false;
+	pOpus->data_start = pOpus->sync_offset;
+	// Find the length from the last granule position in the file, searching backwards in growing windows.
+	ma_int64 size;
+	if (pOpus->onTell && pOpus->onSeek(pOpus->pReadSeekTellUserData, 0, ma_seek_origin_end) == MA_SUCCESS && pOpus->onTell(pOpus->pReadSeekTellUserData, &size) == MA_SUCCESS && size > 0) {
+		pOpus->file_size = size;
+		ma_int64 last = -1;
+		for (ma_uint64 window = 65536;; window *= 2) {
+			ma_uint64 start = pOpus->file_size > pOpus->data_start + window ? pOpus->file_size - window : pOpus->data_start;
+			ma_opus_raw_seek(pOpus, start);
+			while (ma_opus_next_granule_page(pOpus, pOpus->file_size, &og, &offset))
+				last = ogg_page_granulepos(&og);
+			if (last >= 0 || start == pOpus->data_start)
+				break;
+		}
+		pOpus->length = last > pOpus->pre_skip ? last - pOpus->pre_skip : 0;
+	}
+	ma_opus_raw_seek(pOpus, pOpus->data_start);
+	ogg_stream_reset(&pOpus->os);
+	pOpus->granule = 0;
+	pOpus->discard = pOpus->pre_skip;
+	return true;
+}
+
+static bool ma_opus_decode_packet(ma_opus *pOpus) {
+	ogg_packet op;
+	ogg_page og;
+	for (;;) {
+		if (pOpus->eos)
+			return false;
+		int ret = ogg_stream_packetout(&pOpus->os, &op);
+		if (ret < 0)
+			continue; // A hole in the data, the next packet is still good.
+		if (ret == 0) {
+			if (!ma_opus_next_page(pOpus, &og, nullptr))
+				return false;
+			if (ogg_page_serialno(&og) != pOpus->serial) {
+				if (ogg_page_bos(&og))
+					pOpus->eos = true; // A chained stream, which we don't follow.
+				continue;
+			}
+			ogg_stream_pagein(&pOpus->os, &og);
+			continue;
+		}
+		int frames;
+		if (pOpus->format == ma_format_s16)
+			frames = opus_multistream_decode(pOpus->decoder, op.packet, op.bytes, (opus_int16 *)&pOpus->pcm[0], opus_max_packet_frames, 0);
+		else
+			frames = opus_multistream_decode_float(pOpus->decoder, op.packet, op.bytes, (float *)&pOpus->pcm[0], opus_max_packet_frames, 0);
+		if (op.e_o_s)
+			pOpus->eos = true;
+		if (frames <= 0)
+			continue; // Corrupt packet, skip it.
+		pOpus->granule += frames;
+		// The final page's granule position tells us how much of its last packet is padding.
+		if (op.e_o_s && op.granulepos >= 0 && pOpus->granule > op.granulepos)
+			frames -= (int)std::min<ma_int64>(frames, pOpus->granule - op.granulepos);
+		int skip = (int)std::min<ma_int64>(frames, pOpus->discard);
+		pOpus->discard -= skip;
+		pOpus->pcm_pos = skip;
+		pOpus->pcm_frames = frames;
+		if (skip < frames)
+			return true;
+	}
+}
+
+static ma_result ma_opus_read_pcm_frames(ma_opus *pOpus, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead) {
+	ma_uint64 total = 0;
+	while (total < frameCount) {
+		if (pOpus->pcm_pos >= pOpus->pcm_frames && !ma_opus_decode_packet(pOpus))
+			break;
+		ma_uint64 count = std::min<ma_uint64>(frameCount - total, pOpus->pcm_frames - pOpus->pcm_pos);
+		if (pFramesOut)
+			ma_copy_pcm_frames(ma_offset_pcm_frames_ptr(pFramesOut, total, pOpus->format, pOpus->channels), ma_offset_pcm_frames_ptr(&pOpus->pcm[0], pOpus->pcm_pos, pOpus->format, pOpus->channels), count, pOpus->format, pOpus->channels);
+		pOpus->pcm_pos += (int)count;
+		total += count;
+	}
+	pOpus->cursor += total;
+	if (pFramesRead)
+		*pFramesRead = total;
+	return total == 0 ? MA_AT_END : MA_SUCCESS;
+}
+static ma_result ma_opus_seek_to_pcm_frame(ma_opus *pOpus, ma_uint64 frameIndex) {
+	if (pOpus->file_size == 0)
+		return MA_INVALID_OPERATION;
+	if (pOpus->length > 0 && frameIndex > pOpus->length)
+		frameIndex = pOpus->length;
+	ma_int64 target = (ma_int64)frameIndex + pOpus->pre_skip;
+	ma_int64 preroll_target = target - opus_preroll;
+	opus_multistream_decoder_ctl(pOpus->decoder, OPUS_RESET_STATE);
+	ogg_stream_reset(&pOpus->os);
+	pOpus->pcm_frames = pOpus->pcm_pos = 0;
+	pOpus->cursor = frameIndex;
+	pOpus->eos = false;
+	// Find the last page whose granule position is at or before where pre-roll should begin, bisecting until the search range is small and then scanning it.
+	ogg_page og;
+	ma_uint64 offset, best = 0, lo = pOpus->data_start, hi = pOpus->file_size;
+	bool found = false;
+	if (preroll_target > 0) {
+		while (hi - lo > opus_bisect_threshold) {
+			ma_uint64 mid = lo + (hi - lo) / 2;
+			ma_opus_raw_seek(pOpus, mid);
+			if (!ma_opus_next_granule_page(pOpus, hi, &og, &offset))
+				hi = mid;
+			else if (ogg_page_granulepos(&og) <= preroll_target) {
+				best = offset;
+				found = true;
+				lo = offset + 1;
+			} else
+				hi = mid;
+		}
+		ma_opus_raw_seek(pOpus, found ? best : lo);
+		while (ma_opus_next_granule_page(pOpus, pOpus->file_size, &og, &offset) && ogg_page_granulepos(&og) <= preroll_target) {
+			best = offset;
+			found = true;
+		}
+	}
+	if (!found) {
+		ma_opus_raw_seek(pOpus, pOpus->data_start);
+		pOpus->granule = 0;
+		pOpus->discard = target;
+		return MA_SUCCESS;
+	}
+	ma_opus_raw_seek(pOpus, best);
+	if (!ma_opus_next_page(pOpus, &og, &offset))
+		return MA_ERROR;
+	// The page's granule position is where its last completed packet ends. Work back to where the first packet we'll actually get from it begins; a packet continued from the previous page is dropped by libogg because we never gave it that page.
+	ogg_stream_state counter;
+	ogg_packet op;
+	ma_int64 duration = 0;
+	ogg_stream_init(&counter, pOpus->serial);
+	ogg_stream_reset_serialno(&counter, pOpus->serial); // Unlike a reset, init expects page 0 and would treat a page from mid-file as following a hole.
+	ogg_stream_pagein(&counter, &og);
+	while (ogg_stream_packetout(&counter, &op) == 1) {
+		int frames = opus_packet_get_nb_samples(op.packet, op.bytes, opus_rate);
+		if (frames > 0)
+			duration += frames;
+	}
+	ogg_stream_clear(&counter);
+	ogg_stream_pagein(&pOpus->os, &og);
+	pOpus->granule = ogg_page_granulepos(&og) - duration;
+	pOpus->discard = std::max<ma_int64>(target - pOpus->granule, 0);
+	return MA_SUCCESS;
+}
+
+static ma_result ma_opus_ds_read(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead) {
+	return ma_opus_read_pcm_frames((ma_opus *)pDataSource, pFramesOut, frameCount, pFramesRead);
+}
+static ma_result ma_opus_ds_seek(ma_data_source *pDataSource, ma_uint64 frameIndex) {
+	return ma_opus_seek_to_pcm_frame((ma_opus *)pDataSource, frameIndex);
+}
+static ma_result ma_opus_ds_get_data_format(ma_data_source *pDataSource, ma_format *pFormat, ma_uint32 *pChannels, ma_uint32 *pSampleRate, ma_channel *pChannelMap, size_t channelMapCap) {
+	ma_opus *pOpus = (ma_opus *)pDataSource;
+	if (pFormat)
+		*pFormat = pOpus->format;
+	if (pChannels)
+		*pChannels = pOpus->channels;
+	if (pSampleRate)
+		*pSampleRate = opus_rate;
+	if (pChannelMap)
+		ma_channel_map_init_standard(ma_standard_channel_map_vorbis, pChannelMap, channelMapCap, pOpus->channels); // Opus mapping families 0 and 1 use Vorbis channel order.
+	return MA_SUCCESS;
+}
+static ma_result ma_opus_ds_get_cursor(ma_data_source *pDataSource, ma_uint64 *pCursor) {
+	*pCursor = ((ma_opus *)pDataSource)->cursor;
+	return MA_SUCCESS;
+}
+static ma_result ma_opus_ds_get_length(ma_data_source *pDataSource, ma_uint64 *pLength) {
+	*pLength = ((ma_opus *)pDataSource)->length;
+	return MA_SUCCESS;
+}
+static ma_data_source_vtable g_ma_opus_ds_vtable = {ma_opus_ds_read, ma_opus_ds_seek, ma_opus_ds_get_data_format, ma_opus_ds_get_cursor, ma_opus_ds_get_length, nullptr, 0};
+
+static void ma_opus_free(ma_opus *pOpus) {
+	if (pOpus->decoder)
+		opus_multistream_decoder_destroy(pOpus->decoder);
+	ogg_stream_clear(&pOpus->os);
+	ogg_sync_clear(&pOpus->oy);
+	ma_data_source_uninit(&pOpus->ds);
+	delete pOpus;
+}
+static ma_result ma_decoding_backend_init__opus(void *pUserData, ma_read_proc onRead, ma_seek_proc onSeek, ma_tell_proc onTell, void *pReadSeekTellUserData, const ma_decoding_backend_config *pConfig, const ma_allocation_callbacks *pAllocationCallbacks, ma_data_source **ppBackend) {
+	if (!onRead || !onSeek)
+		return MA_INVALID_ARGS;
+	ma_opus *pOpus = new (std::nothrow) ma_opus();
+	if (!pOpus)
+		return MA_OUT_OF_MEMORY;
+	ma_data_source_config cfg = ma_data_source_config_init();
+	cfg.vtable = &g_ma_opus_ds_vtable;
+	ma_result result = ma_data_source_init(&cfg, &pOpus->ds);
+	if (result != MA_SUCCESS) {
+		delete pOpus;
+		return result;
+	}
+	pOpus->onRead = onRead;
+	pOpus->onSeek = onSeek;
+	pOpus->onTell = onTell;
+	pOpus->pReadSeekTellUserData = pReadSeekTellUserData;
+	pOpus->format = pConfig && pConfig->preferredFormat == ma_format_s16 ? ma_format_s16 : ma_format_f32;
+	ogg_sync_init(&pOpus->oy);
+	ogg_stream_init(&pOpus->os, 0);
+	if (!ma_opus_open(pOpus)) {
+		ma_opus_free(pOpus);
+		return MA_INVALID_FILE;
+	}
+	pOpus->pcm.resize(opus_max_packet_frames * ma_get_bytes_per_frame(pOpus->format, pOpus->channels));
+	*ppBackend = pOpus;
+	return MA_SUCCESS;
+}
+static void ma_decoding_backend_uninit__opus(void *pUserData, ma_data_source *pBackend, const ma_allocation_callbacks *pAllocationCallbacks) {
+	ma_opus_free((ma_opus *)pBackend);
+}
+static ma_decoding_backend_vtable g_ma_decoding_backend_vtable_opus = {ma_decoding_backend_init__opus, nullptr, nullptr, nullptr, ma_decoding_backend_uninit__opus};
+ma_decoding_backend_vtable *ma_decoding_backend_opus = &g_ma_decoding_backend_vtable_opus;
+#else
+ma_decoding_backend_vtable *ma_decoding_backend_opus = nullptr;
+#endif
@@ -0,0 +1,19 @@
+/* sound_opus.h - Ogg Opus decoding backend
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#pragma once
+
+#include <miniaudio.h>
+
+// Decodes Ogg Opus (RFC 7845) with libopus directly, plus the libogg we already link for Vorbis, rather than pulling in opusfile. Output is always 48 kHz. Seeking bisects the file on page granule positions and pre-rolls 80 ms as the specification recommends. Chained streams play up to the end of the first link.
+// Null if NVGT was built with MA_NO_LIBOPUS, in which case MiniAudio simply skips it.
+extern ma_decoding_backend_vtable *ma_decoding_backend_opus;
@@ -0,0 +1,265 @@
+/* sound_seek_index.cpp - seek indexed decoding backends for long compressed audio
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+#include <miniaudio_libvorbis.h>
+#ifndef OV_EXCLUDE_STATIC_CALLBACKS
+	#define OV_EXCLUDE_STATIC_CALLBACKS
+#endif
+#include <vorbis/vorbisfile.h>
+#include "sound_seek_index.h"
+
+struct ogg_seek_point {
+	ma_uint64 offset;  // Byte offset of the start of a page.
+	ma_uint64 granule; // The granule position of that page, which is the PCM frame its last completed packet ends on.
+};
+typedef std::shared_ptr<const std::vector<ogg_seek_point>> seek_index_ptr;
+
+static std::atomic<unsigned int> g_seek_index_threshold(0);
+// Indexes are keyed by a fingerprint of the file rather than its name, because the decoder only ever sees a byte stream and because the same name can refer to different assets in different packs.
+static std::mutex g_seek_index_mutex;
+static std::unordered_map<ma_uint64, seek_index_ptr> g_seek_index_cache;
+static std::deque<ma_uint64> g_seek_index_cache_order; // Oldest first, so that the cache can't grow without bound if a game streams many distinct long files.
+static const size_t seek_index_cache_capacity = 64;
+static const size_t fingerprint_block_size = 4096;
+static const ma_uint64 ogg_seek_point_spacing = 16384; // In bytes, roughly a second of audio at common bitrates.
+
+void set_sound_seek_index_threshold(unsigned int bytes) { g_seek_index_threshold = bytes; }
+unsigned int get_sound_seek_index_threshold() { return g_seek_index_threshold; }
+void clear_sound_seek_index_cache() {
+	std::lock_guard<std::mutex> lock(g_seek_index_mutex);
+	g_seek_index_cache.clear();
+	g_seek_index_cache_order.clear();
+}
+static seek_index_ptr seek_index_lookup(ma_uint64 key) {
+	std::lock_guard<std::mutex> lock(g_seek_index_mutex);
+	auto it = g_seek_index_cache.find(key);
+	return it != g_seek_index_cache.end() ? it->second : nullptr;
+}
+static void seek_index_store(ma_uint64 key, const seek_index_ptr &index) {
+	std::lock_guard<std::mutex> lock(g_seek_index_mutex);
+	if (!g_seek_index_cache.emplace(key, index).second)
+		return; // Another thread indexed the same file at the same time.
+	g_seek_index_cache_order.push_back(key);
+	if (g_seek_index_cache_order.size() > seek_index_cache_capacity) {
+		g_seek_index_cache.erase(g_seek_index_cache_order.front());
+		g_seek_index_cache_order.pop_front();
+	}
+}
+
+static ma_uint64 fnv1a(const unsigned char *data, size_t size, ma_uint64 hash = 14695981039346656037ULL) {
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+// Decides whether a stream should be indexed, and if so fingerprints it by size plus its first and last blocks. The first block is left in head for format sniffing. The stream is always rewound.
+static bool seek_index_prepare(ma_read_proc onRead, ma_seek_proc onSeek, ma_tell_proc onTell, void *pUserData, unsigned char *head, size_t *head_size, ma_uint64 *file_size, ma_uint64 *key) {
+	unsigned int threshold = g_seek_index_threshold;
+	if (threshold == 0 || !onTell)
+		return false;
+	bool result = false;
+	ma_int64 size;
+	if (onSeek(pUserData, 0, ma_seek_origin_end) == MA_SUCCESS && onTell(pUserData, &size) == MA_SUCCESS && size >= (ma_int64)threshold && size >= (ma_int64)fingerprint_block_size * 2) {
+		unsigned char tail[fingerprint_block_size];
+		size_t tail_size = 0;
+		if (onSeek(pUserData, -(ma_int64)fingerprint_block_size, ma_seek_origin_end) == MA_SUCCESS && onRead(pUserData, tail, fingerprint_block_size, &tail_size) == MA_SUCCESS && onSeek(pUserData, 0, ma_seek_origin_start) == MA_SUCCESS && onRead(pUserData, head, fingerprint_block_size, head_size) == MA_SUCCESS) {
+			*file_size = size;
+			*key = fnv1a(tail, tail_size, fnv1a(head, *head_size, fnv1a((const unsigned char *)&size, sizeof(size))));
+			result = true;
+		}
+	}
+	onSeek(pUserData, 0, ma_seek_origin_start);
+	return result;
+}
+
+// MP3: MiniAudio's MP3 decoder can build and use a seek table itself but only exposes that through ma_decoder, so we nest one. It is told the encoding up front so it never comes back to our backends.
+typedef struct {
+	ma_decoder decoder; // Must be first so that MiniAudio can treat this as the nested decoder's data source.
+	ma_read_proc onRead;
+	ma_seek_proc onSeek;
+	void *pReadSeekTellUserData;
+} ma_indexed_mp3;
+static bool looks_like_mp3(const unsigned char *head, size_t size) {
+	if (size >= 3 && memcmp(head, "ID3", 3) == 0)
+		return true;
+	return size >= 2 && head[0] == 0xFF && (head[1] & 0xE0) == 0xE0;
+}
+static ma_result ma_indexed_mp3_read(ma_decoder *pDecoder, void *pBufferOut, size_t bytesToRead, size_t *pBytesRead) {
+	ma_indexed_mp3 *pMP3 = (ma_indexed_mp3 *)pDecoder;
+	return pMP3->onRead(pMP3->pReadSeekTellUserData, pBufferOut, bytesToRead, pBytesRead);
+}
+static ma_result ma_indexed_mp3_seek(ma_decoder *pDecoder, ma_int64 byteOffset, ma_seek_origin origin) {
+	ma_indexed_mp3 *pMP3 = (ma_indexed_mp3 *)pDecoder;
+	return pMP3->onSeek(pMP3->pReadSeekTellUserData, byteOffset, origin);
+}
+static ma_result ma_decoding_backend_init__indexed_mp3(void *pUserData, ma_read_proc onRead, ma_seek_proc onSeek, ma_tell_proc onTell, void *pReadSeekTellUserData, const ma_decoding_backend_config *pConfig, const ma_allocation_callbacks *pAllocationCallbacks, ma_data_source **ppBackend) {
+	unsigned char head[fingerprint_block_size];
+	size_t head_size = 0;
+	ma_uint64 file_size, key;
+	if (!seek_index_prepare(onRead, onSeek, onTell, pReadSeekTellUserData, head, &head_size, &file_size, &key) || !looks_like_mp3(head, head_size))
+		return MA_NO_BACKEND; // Let the regular MP3 decoder have it.
+	ma_indexed_mp3 *pMP3 = new (std::nothrow) ma_indexed_mp3();
+	if (!pMP3)
+		return MA_OUT_OF_MEMORY;
+	pMP3->onRead = onRead;
+	pMP3->onSeek = onSeek;
+	pMP3->pReadSeekTellUserData = pReadSeekTellUserData;
+	ma_decoder_config cfg = ma_decoder_config_init(pConfig ? pConfig->preferredFormat : ma_format_unknown, 0, 0);
+	cfg.encodingFormat = ma_encoding_format_mp3;
+	// About one seek point per 16KB, or a second of audio at 128kbps.
+	cfg.seekPointCount = (ma_uint32)std::min<ma_uint64>(std::max<ma_uint64>(file_size / 16384, 16), 8192);
+	if (pAllocationCallbacks)
+		cfg.allocationCallbacks = *pAllocationCallbacks;
+	ma_result result = ma_decoder_init(ma_indexed_mp3_read, ma_indexed_mp3_seek, pMP3, &cfg, &pMP3->decoder);
+	if (result != MA_SUCCESS) {
+		delete pMP3;
+		return result;
+	}
+	*ppBackend = pMP3;
+	return MA_SUCCESS;
+}
+static void ma_decoding_backend_uninit__indexed_mp3(void *pUserData, ma_data_source *pBackend, const ma_allocation_callbacks *pAllocationCallbacks) {
+	ma_indexed_mp3 *pMP3 = (ma_indexed_mp3 *)pBackend;
+	ma_decoder_uninit(&pMP3->decoder);
+	delete pMP3;
+}
+static ma_decoding_backend_vtable g_ma_decoding_backend_vtable_indexed_mp3 = {ma_decoding_backend_init__indexed_mp3, nullptr, nullptr, nullptr, ma_decoding_backend_uninit__indexed_mp3};
+ma_decoding_backend_vtable *ma_decoding_backend_indexed_mp3 = &g_ma_decoding_backend_vtable_indexed_mp3;
+
+// Ogg Vorbis: we record page offsets against granule positions, then seek by jumping to the last page before the target with ov_raw_seek and decoding forward to the exact frame.
+typedef struct {
+	ma_libvorbis vorbis; // Must be first, see above.
+	seek_index_ptr index;
+} ma_indexed_vorbis;
+static bool looks_like_vorbis(const unsigned char *head, size_t size) {
+	static const unsigned char vorbis_id[] = {0x01, 'v', 'o', 'r', 'b', 'i', 's'};
+	if (size < 4 || memcmp(head, "OggS", 4) != 0)
+		return false;
+	size = std::min<size_t>(size, 512); // The identification header is always on the first page.
+	return std::search(head, head + size, vorbis_id, vorbis_id + sizeof(vorbis_id)) != head + size;
+}
+static seek_index_ptr build_ogg_index(ma_read_proc onRead, ma_seek_proc onSeek, void *pUserData) {
+	std::shared_ptr<std::vector<ogg_seek_point>> index = std::make_shared<std::vector<ogg_seek_point>>();
+	ogg_sync_state oy;
+	ogg_page og;
+	ogg_sync_init(&oy);
+	ma_uint64 offset = 0, last_offset = 0;
+	int serial = -1;
+	bool valid = true;
+	for (;;) {
+		long ret = ogg_sync_pageseek(&oy, &og);
+		if (ret < 0) {
+			offset += -ret; // Skipped garbage.
+			continue;
+		} else if (ret > 0) {
+			if (serial == -1)
+				serial = ogg_page_serialno(&og);
+			else if (ogg_page_serialno(&og) != serial) {
+				valid = false; // Chained or multiplexed, leave these to libvorbisfile.
+				break;
+			}
+			ogg_int64_t granule = ogg_page_granulepos(&og);
+			if (granule > 0 && (index->empty() || offset - last_offset >= ogg_seek_point_spacing)) {
+				index->push_back({offset, (ma_uint64)granule});
+				last_offset = offset;
+			}
+			offset += ret;
+			continue;
+		}
+		char *buffer = ogg_sync_buffer(&oy, 65536);
+		size_t bytes_read = 0;
+		if (!buffer || onRead(pUserData, buffer, 65536, &bytes_read) != MA_SUCCESS || bytes_read == 0)
+			break;
+		ogg_sync_wrote(&oy, (long)bytes_read);
+	}
+	ogg_sync_clear(&oy);
+	onSeek(pUserData, 0, ma_seek_origin_start);
+	if (!valid || index->empty())
+		return nullptr;
+	return index;
+}
+static ma_result ma_indexed_vorbis_ds_seek(ma_data_source *pDataSource, ma_uint64 frameIndex) {
+	ma_indexed_vorbis *pVorbis = (ma_indexed_vorbis *)pDataSource;
+	OggVorbis_File *vf = (OggVorbis_File *)pVorbis->vorbis.vf;
+	const std::vector<ogg_seek_point> &points = *pVorbis->index;
+	// Find the last page that completes before our target. Decoding can't start mid-page, and libvorbisfile will discard the first packet it sees after a raw seek to prime the decoder.
+	auto it = std::upper_bound(points.begin(), points.end(), frameIndex, [](ma_uint64 frame, const ogg_seek_point &p) { return frame < p.granule; });
+	if (it == points.begin() || ov_raw_seek(vf, (ogg_int64_t)(it - 1)->offset) != 0)
+		return ma_libvorbis_seek_to_pcm_frame(&pVorbis->vorbis, frameIndex);
+	ogg_int64_t position = ov_pcm_tell(vf);
+	if (position < 0 || (ma_uint64)position > frameIndex)
+		return ma_libvorbis_seek_to_pcm_frame(&pVorbis->vorbis, frameIndex);
+	while ((ma_uint64)position < frameIndex) {
+		float **pcm;
+		long frames = ov_read_float(vf, &pcm, (int)std::min<ma_uint64>(frameIndex - position, 4096), nullptr);
+		if (frames <= 0)
+			return frames == 0 ? MA_SUCCESS : MA_ERROR; // Seeking past the end just leaves us at the end.
+		position += frames;
+	}
+	return MA_SUCCESS;
+}
+static ma_result ma_indexed_vorbis_ds_read(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead) {
+	return ma_libvorbis_read_pcm_frames((ma_libvorbis *)pDataSource, pFramesOut, frameCount, pFramesRead);
+}
+static ma_result ma_indexed_vorbis_ds_get_data_format(ma_data_source *pDataSource, ma_format *pFormat, ma_uint32 *pChannels, ma_uint32 *pSampleRate, ma_channel *pChannelMap, size_t channelMapCap) {
+	return ma_libvorbis_get_data_format((ma_libvorbis *)pDataSource, pFormat, pChannels, pSampleRate, pChannelMap, channelMapCap);
+}
+static ma_result ma_indexed_vorbis_ds_get_cursor(ma_data_source *pDataSource, ma_uint64 *pCursor) {
+	return ma_libvorbis_get_cursor_in_pcm_frames((ma_libvorbis *)pDataSource, pCursor);
+}
+static ma_result ma_indexed_vorbis_ds_get_length(ma_data_source *pDataSource, ma_uint64 *pLength) {
+	return ma_libvorbis_get_length_in_pcm_frames((ma_libvorbis *)pDataSource, pLength);
+}
+static ma_data_source_vtable g_ma_indexed_vorbis_ds_vtable = {ma_indexed_vorbis_ds_read, ma_indexed_vorbis_ds_seek, ma_indexed_vorbis_ds_get_data_format, ma_indexed_vorbis_ds_get_cursor, ma_indexed_vorbis_ds_get_length, nullptr, 0};
+static ma_result ma_decoding_backend_init__indexed_vorbis(void *pUserData, ma_read_proc onRead, ma_seek_proc onSeek, ma_tell_proc onTell, void *pReadSeekTellUserData, const ma_decoding_backend_config *pConfig, const ma_allocation_callbacks *pAllocationCallbacks, ma_data_source **ppBackend) {
+	unsigned char head[fingerprint_block_size];
+	size_t head_size = 0;
+	ma_uint64 file_size, key;
+	if (!seek_index_prepare(onRead, onSeek, onTell, pReadSeekTellUserData, head, &head_size, &file_size, &key) || !looks_like_vorbis(head, head_size))
+		return MA_NO_BACKEND; // Falls through to the plain libvorbis backend.
+	seek_index_ptr index = seek_index_lookup(key);
+	if (!index) {
+		index = build_ogg_index(onRead, onSeek, pReadSeekTellUserData);
+		if (!index)
+			return MA_NO_BACKEND;
+		seek_index_store(key, index);
+	}
+	ma_indexed_vorbis *pVorbis = new (std::nothrow) ma_indexed_vorbis();
+	if (!pVorbis)
+		return MA_OUT_OF_MEMORY;
+	ma_result result = ma_libvorbis_init(onRead, onSeek, onTell, pReadSeekTellUserData, pConfig, pAllocationCallbacks, &pVorbis->vorbis);
+	if (result != MA_SUCCESS) {
+		delete pVorbis;
+		return result;
+	}
+	pVorbis->index = index;
+	pVorbis->vorbis.ds.vtable = &g_ma_indexed_vorbis_ds_vtable;
+	*ppBackend = pVorbis;
+	return MA_SUCCESS;
+}
+static void ma_decoding_backend_uninit__indexed_vorbis(void *pUserData, ma_data_source *pBackend, const ma_allocation_callbacks *pAllocationCallbacks) {
+	ma_indexed_vorbis *pVorbis = (ma_indexed_vorbis *)pBackend;
+	ma_libvorbis_uninit(&pVorbis->vorbis, pAllocationCallbacks);
+	delete pVorbis;
+}
+static ma_decoding_backend_vtable g_ma_decoding_backend_vtable_indexed_vorbis = {ma_decoding_backend_init__indexed_vorbis, nullptr, nullptr, nullptr, ma_decoding_backend_uninit__indexed_vorbis};
+ma_decoding_backend_vtable *ma_decoding_backend_indexed_vorbis = &g_ma_decoding_backend_vtable_indexed_vorbis;
@@ -0,0 +1,27 @@
+/* sound_seek_index.h - seek indexed decoding backends for long compressed audio
+ *
+ * NVGT - NonVisual Gaming Toolkit
+ * Copyright (c) 2022-2025 Sam Tupy
+ * https://nvgt.gg
+ * This software is provided "as-is", without any express or implied warranty. In no event will the authors be held liable for any damages arising from the use of this software.
+ * Permission is granted to anyone to use this software for any purpose, including commercial applications, and to alter it and redistribute it freely, subject to the following restrictions:
+ * 1. The origin of this software must not be misrepresented; you must not claim that you wrote the original software. If you use this software in a product, an acknowledgment in the product documentation would be appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#pragma once
+
+#include <miniaudio.h>
+
+/**
+ * Without help, seeking in a long MP3 decodes forward from the start of the file and seeking in Ogg Vorbis bisects the file a page at a time, both of which are slow when every read goes through a decryption filter.
+ * These backends scan a file once when it is opened, recording byte offsets of frames or pages against their PCM positions, then jump straight to the nearest one when seeking.
+ * Ogg indexes are also cached by a fingerprint of the file's contents, so streaming the same track again doesn't rescan it. MiniAudio keeps its MP3 seek tables private, so those are rebuilt per load.
+ * Files smaller than the threshold are passed through to the regular decoders untouched, and a threshold of 0 (the default) disables indexing.
+ */
+extern ma_decoding_backend_vtable *ma_decoding_backend_indexed_mp3;
+extern ma_decoding_backend_vtable *ma_decoding_backend_indexed_vorbis;
+void set_sound_seek_index_threshold(unsigned int bytes);
+unsigned int get_sound_seek_index_threshold();
+void clear_sound_seek_index_cache();
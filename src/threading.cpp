@@ -11,6 +11,7 @@
 */
 
 #include <atomic>
+#include <functional>
 #include <string>
 #include <type_traits>
 #include <Poco/Event.h>
@@ -41,9 +42,11 @@ class async_result : public RefCountedObject, public Runnable {
 	asIScriptContext* ctx; // The angelscript context used to call the function asynchronously, stored as a property because we need to pass it between functions in this class without arguments.
 	std::unordered_map<void*, asITypeInfo*> value_args; // Value typed arguments must be copied before being passed to the destination function on another thread, this is because such arguments reside on the stack and so they would otherwise get destroyed when the async_result::call method unwinds but well before the destination function returns. Store pointers to such copied arguments here so they can be released later.
 	std::string exception; // Set to an exception string if an exception is thrown from within the async function call.
+	std::function<void*()> native_task; // Set instead of ctx when the result comes from native code, see async_native_start.
+	bool native;
 public:
 	Event progress; // Public so that some functions in this object can be called directly from Angelscript such as wait and tryWait.
-	async_result(asITypeInfo* t) : value(nullptr), subtype(t), subtypeid(subtype->GetSubTypeId()), progress(Event::EVENT_MANUALRESET), task(nullptr), ctx(nullptr) {}
+	async_result(asITypeInfo* t) : value(nullptr), subtype(t), subtypeid(subtype->GetSubTypeId()), progress(Event::EVENT_MANUALRESET), task(nullptr), ctx(nullptr), native(false) {}
 	~async_result() {
 		if (task) angelscript_refcounted_release<Thread>(task);
 		release_value_args();
@@ -53,7 +56,7 @@ public:
 		}
 	}
 	void* get_value() {
-		if (!ctx) throw NullValueException("Object not initialized");
+		if (!ctx && !native) throw NullValueException("Object not initialized");
 		progress.wait();
 		if (exception != "") throw Exception(exception);
 		if ((subtypeid & asTYPEID_MASK_OBJECT) && !(subtypeid & asTYPEID_OBJHANDLE))
@@ -174,7 +177,39 @@ public:
 		}
 		return true;
 	}
+	bool start_native(std::function<void*()> task, ThreadPool& pool) {
+		native_task = std::move(task);
+		native = true;
+		duplicate();
+		try {
+			pool.start(*this);
+		} catch (...) {
+			release();
+			throw;
+		}
+		return true;
+	}
+	void run_native() {
+		try {
+			void* obj = native_task();
+			value = malloc(sizeof(asPWORD));
+			*(void**)value = obj;
+		} catch (Exception& e) {
+			exception = e.displayText();
+		} catch (std::exception& e) {
+			exception = e.what();
+		} catch (...) {
+			exception = "unknown exception";
+		}
+		native_task = nullptr; // Drops anything the task captured as soon as it's done.
+		progress.set();
+		release();
+	}
 	void run() {
+		if (native) {
+			run_native();
+			return;
+		}
 		int result = ctx->Execute();
 		if (result == asEXECUTION_ABORTED) exception = "function call aborted";
 		else if (result == asEXECUTION_SUSPENDED) exception = "function call suspended";
@@ -205,7 +240,7 @@ public:
 		for (const auto& obj : value_args) g_ScriptEngine->ReleaseScriptObject(obj.first, obj.second);
 		value_args.clear();
 	}
-	bool complete() { return ctx && progress.tryWait(0); }
+	bool complete() { return (ctx || native) && progress.tryWait(0); }
 	bool failed() { return progress.tryWait(0) && exception != ""; }
 };
 async_result* async_unprepared_factory(asITypeInfo* type) { return new async_result(type); }
@@ -215,6 +250,39 @@ void async_factory(asIScriptGeneric* gen) {
 	if (!r->call(gen)) delete r;
 	else *(async_result**)gen->GetAddressOfReturnLocation() = r;
 }
+async_result* async_native_start(asITypeInfo* type, std::function<void*()> task, ThreadPool& pool) {
+	async_result* r = new async_result(type);
+	try {
+		r->start_native(std::move(task), pool);
+	} catch (...) {
+		r->release();
+		throw;
+	}
+	return r;
+}
+
+void cancellation_token::cancel() {
+	FastMutex::ScopedLock lock(mutex);
+	if (cancelled.exchange(true)) return;
+	// Run with the mutex held, so that a callback can never race with unsubscribe.
+	for (const auto& c : callbacks) c.second();
+	callbacks.clear();
+}
+int cancellation_token::subscribe(const std::function<void()>& callback) {
+	FastMutex::ScopedLock lock(mutex);
+	if (cancelled) return 0;
+	callbacks.emplace_back(next_id, callback);
+	return next_id++;
+}
+void cancellation_token::unsubscribe(int id) {
+	FastMutex::ScopedLock lock(mutex);
+	for (auto it = callbacks.begin(); it != callbacks.end(); ++it) {
+		if (it->first != id) continue;
+		callbacks.erase(it);
+		return;
+	}
+}
+cancellation_token* cancellation_token_factory() { return new cancellation_token(); }
 
 // Poco does support starting a thread by directly passing a function pointer and user data, but things like Poco's ThreadPool do not support this and so instead we opt to inherit from their Runnable class which is more unified and which works with all of Poco's multithreading mechanisms.
 class script_runnable : public Runnable {
@@ -482,5 +550,11 @@ void RegisterThreading(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod("async<T>", "string get_exception() const property", asMETHOD(async_result, get_exception), asCALL_THISCALL);
 	engine->RegisterObjectMethod("async<T>", "void wait()", asMETHOD(Event, wait), asCALL_THISCALL, 0, asOFFSET(async_result, progress), false);
 	engine->RegisterObjectMethod("async<T>", "bool try_wait(uint ms)", asMETHOD(Event, tryWait), asCALL_THISCALL, 0, asOFFSET(async_result, progress), false);
+	engine->RegisterObjectType("cancellation_token", 0, asOBJ_REF);
+	engine->RegisterObjectBehaviour("cancellation_token", asBEHAVE_FACTORY, "cancellation_token@ f()", asFUNCTION(cancellation_token_factory), asCALL_CDECL);
+	engine->RegisterObjectBehaviour("cancellation_token", asBEHAVE_ADDREF, "void f()", asMETHODPR(cancellation_token, duplicate, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectBehaviour("cancellation_token", asBEHAVE_RELEASE, "void f()", asMETHODPR(cancellation_token, release, () const, void), asCALL_THISCALL);
+	engine->RegisterObjectMethod("cancellation_token", "void cancel()", asMETHOD(cancellation_token, cancel), asCALL_THISCALL);
+	engine->RegisterObjectMethod("cancellation_token", "bool get_cancelled() const property", asMETHOD(cancellation_token, is_cancelled), asCALL_THISCALL);
 	RegisterAtomics(engine);
 }
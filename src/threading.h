@@ -12,6 +12,35 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <Poco/Mutex.h>
+#include <Poco/RefCountedObject.h>
+
 class asIScriptEngine;
+class asITypeInfo;
+class async_result;
+namespace Poco { class ThreadPool; }
+
+// A flag that a script raises to ask native work, such as a request started by http_request_async, to stop early. Native code can subscribe a callback that interrupts a blocking call when the token is cancelled.
+class cancellation_token : public Poco::RefCountedObject {
+	mutable Poco::FastMutex mutex;
+	std::atomic<bool> cancelled;
+	std::vector<std::pair<int, std::function<void()>>> callbacks;
+	int next_id;
+public:
+	cancellation_token() : cancelled(false), next_id(1) {}
+	void cancel();
+	bool is_cancelled() const { return cancelled; }
+	// Returns an id for unsubscribe, or 0 without subscribing if the token is already cancelled. Callbacks run on the thread that calls cancel.
+	int subscribe(const std::function<void()>& callback);
+	// Once this returns, the callback is not running and never will.
+	void unsubscribe(int id);
+};
+
+// Runs task on the given thread pool and returns a new async<T>, where type is that async<T> type. The task returns an object or handle of type T with a reference that the async takes over, or throws to make the async fail with the exception's message.
+async_result* async_native_start(asITypeInfo* type, std::function<void*()> task, Poco::ThreadPool& pool);
 
 void RegisterThreading(asIScriptEngine* engine);
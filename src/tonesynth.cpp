@@ -17,6 +17,7 @@
 
 #include "tonesynth.h"
 #include "sound.h"
+#include "sound_nodes.h"
 
 tone_synth::tone_synth() {
 	gen = new elz_tonar{};
@@ -37,6 +38,7 @@ void tone_synth::Release() {
 }
 void tone_synth::reset() {
 	el_tonar_reset(gen);
+	events.clear();
 }
 void tone_synth::set_waveform(int type) {
 	int real_type = bgt_to_tonar_waveform(type);
@@ -79,35 +81,43 @@ void tone_synth::set_freq_transpose(double freq_transpose) {
 double tone_synth::get_freq_transpose() {
 	return el_tonar_get_freq_transpose(gen);
 }
+// The note functions mirror their el_tonar counterparts, but record the tone in the event list instead of synthesizing it straight away.
 bool tone_synth::note(std::string note, double length) {
-	return el_tonar_note(gen, const_cast<char*> (note.c_str()), length)? true: false;
+	return note_ms(note, elz_tonar_music_beat_to_ms(gen->tempo, length));
 }
 bool tone_synth::note_ms(std::string note, int ms) {
-	return el_tonar_note_ms(gen, const_cast<char*> (note.c_str()), ms)? true: false;
+	return sequence(elz_tonar_music_note_to_freq(elz_tonar_music_name_to_note(const_cast<char*> (note.c_str()), gen->note_transpose)), 0, ms, 0, 0);
 }
 bool tone_synth::note_bend(std::string note, int bend_amount, double length, double bend_start, double bend_length) {
-	return el_tonar_note_bend(gen, const_cast<char*> (note.c_str()), bend_amount, length, bend_start, bend_length)? true: false;
+	return note_bend_ms(note, bend_amount, elz_tonar_music_beat_to_ms(gen->tempo, length), elz_tonar_music_beat_to_ms(gen->tempo, bend_start), elz_tonar_music_beat_to_ms(gen->tempo, bend_length));
 }
 bool tone_synth::note_bend_ms(std::string note, int bend_amount, int length, int bend_start, int bend_length) {
-	return el_tonar_note_bend_ms(gen, const_cast<char*> (note.c_str()), bend_amount, length, bend_start, bend_length)? true: false;
+	int start_note = elz_tonar_music_name_to_note(const_cast<char*> (note.c_str()), gen->note_transpose);
+	double start_freq = elz_tonar_music_note_to_freq(start_note);
+	return sequence(start_freq, elz_tonar_music_note_to_freq(start_note + bend_amount) - start_freq, length, bend_start, bend_length);
 }
 bool tone_synth::freq(double freq, double length) {
-	return el_tonar_freq(gen, freq, length)? true: false;
+	return freq_ms(freq, elz_tonar_music_beat_to_ms(gen->tempo, length));
 }
 bool tone_synth::freq_ms(double freq, int ms) {
-	return el_tonar_freq_ms(gen, freq, ms)? true: false;
+	return sequence(freq + gen->freq_transpose, 0, ms, 0, 0);
 }
 bool tone_synth::freq_bend(double freq, int bend_amount, double length, double bend_start, double bend_length) {
-	return el_tonar_freq_bend(gen, freq, bend_amount, length, bend_start, bend_length)? true: false;
+	return freq_bend_ms(freq, bend_amount, elz_tonar_music_beat_to_ms(gen->tempo, length), elz_tonar_music_beat_to_ms(gen->tempo, bend_start), elz_tonar_music_beat_to_ms(gen->tempo, bend_length));
 }
 bool tone_synth::freq_bend_ms(double freq, int bend_amount, int length, int bend_start, int bend_length) {
-	return el_tonar_freq_bend_ms(gen, freq, bend_amount, length, bend_start, bend_length)? true: false;
+	return sequence(freq + gen->freq_transpose, bend_amount, length, bend_start, bend_length);
 }
 bool tone_synth::rest(double length) {
-	return el_tonar_rest(gen, length)? true: false;
+	return rest_ms(elz_tonar_music_beat_to_ms(gen->tempo, length));
 }
 bool tone_synth::rest_ms(int ms) {
-	return el_tonar_rest_ms(gen, ms)? true: false;
+	if (ms <= 0) return false;
+	int frames = elz_tonar_ms_to_frames(gen, ms);
+	if (frames <= 0) return false;
+	gen->cursor += frames * gen->channels;
+	if (gen->cursor > gen->length) gen->length = gen->cursor;
+	return true;
 }
 double tone_synth::get_length() {
 	return el_tonar_get_length(gen);
@@ -133,16 +143,50 @@ bool tone_synth::rewind(double amount) {
 bool tone_synth::rewind_ms(int amount) {
 	return el_tonar_rewind_ms(gen, amount)? true: false;
 }
+bool tone_synth::sequence(double freq, double bend_amount, int length, int bend_start, int bend_length) {
+	// Same validation as elz_tonar_sequence, which will eventually receive exactly these arguments.
+	double target_freq = freq + bend_amount;
+	if (freq < 20 || freq > 20000 || target_freq < 20 || target_freq > 20000) return false;
+	if (length <= 0) return false;
+	int frames = elz_tonar_ms_to_frames(gen, length);
+	if (frames <= 0) return false;
+	events.push_back({gen->cursor / gen->channels, gen->waveform, gen->volume, gen->pan, gen->fade_start, gen->fade_end, freq, bend_amount, length, bend_start, bend_length});
+	return elz_tonar_adjust_length(gen, frames * gen->channels)? true: false;
+}
+bool tone_synth::render(el_tonar* output) {
+	el_tonar_reset(output);
+	output->sample_rate = gen->sample_rate;
+	output->channels = gen->channels;
+	if (gen->length <= 0) return true; // Nothing to render, tonar treats the output as silent.
+	if (!elz_tonar_manage_buffer(output, gen->length)) return false;
+	for (const tone_synth_event& e : events) {
+		output->cursor = e.start * output->channels;
+		output->waveform = e.waveform;
+		output->volume = e.volume;
+		output->pan = e.pan;
+		output->fade_start = e.fade_start;
+		output->fade_end = e.fade_end;
+		if (!elz_tonar_sequence(output, e.freq, e.bend_amount, e.length, e.bend_start, e.bend_length)) return false;
+	}
+	output->cursor = gen->cursor;
+	output->length = gen->length;
+	return true;
+}
 sound* tone_synth::generate_sound() {
 init_sound();
-	int size = el_tonar_output_buffer_size(gen);
-	if (size <= 0) return nullptr;
-	char* buffer = new char[size];
-	if (!buffer) return nullptr;
-	if (!el_tonar_output_buffer(gen, buffer, size)) {
+	elz_tonar output{};
+	if (!render(&output)) {
+		elz_tonar_cleanup(&output);
+		return nullptr;
+	}
+	int size = el_tonar_output_buffer_size(&output);
+	char* buffer = size > 0? new char[size] : nullptr;
+	if (!buffer || !el_tonar_output_buffer(&output, buffer, size)) {
 		delete[] buffer;
+		elz_tonar_cleanup(&output);
 		return nullptr;
 	}
+	elz_tonar_cleanup(&output);
 	sound *s = g_audio_engine->new_sound();
 	if (!s) {
 		delete[] buffer;
@@ -157,7 +201,14 @@ init_sound();
 	return s;
 }
 bool tone_synth::generate_file(const std::string& filename) {
-	return el_tonar_output_file(gen, const_cast<char*> (filename.c_str()))? true: false;
+	elz_tonar output{};
+	bool result = render(&output) && el_tonar_output_file(&output, const_cast<char*> (filename.c_str()));
+	elz_tonar_cleanup(&output);
+	return result;
+}
+tone_synth_node* tone_synth::create_node(audio_engine* engine) {
+	if (!engine && init_sound()) engine = g_audio_engine;
+	return tone_synth_node::create(engine, events, gen->length / gen->channels, gen->sample_rate, gen->channels);
 }
 int tone_synth::bgt_to_tonar_waveform(int type) {
 	if (type == 1) return 3;
@@ -208,4 +259,5 @@ void RegisterScriptTonesynth(asIScriptEngine* engine) {
 	engine->RegisterObjectMethod("tone_synth", "bool rest_ms(int ms)", asMETHOD(tone_synth, rest_ms), asCALL_THISCALL);
 	engine->RegisterObjectMethod("tone_synth", "sound@ write_wave_sound()", asMETHOD(tone_synth, generate_sound), asCALL_THISCALL);
 	engine->RegisterObjectMethod("tone_synth", "bool write_wave_file(const string &in filename)", asMETHOD(tone_synth, generate_file), asCALL_THISCALL);
+	engine->RegisterObjectMethod("tone_synth", "tone_synth_node@ create_node(audio_engine@+ engine = sound_default_engine)", asMETHOD(tone_synth, create_node), asCALL_THISCALL);
 }
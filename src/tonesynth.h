@@ -17,11 +17,29 @@ extern "C" {
 }
 
 #include <string>
+#include <vector>
 
 #include <angelscript.h>
 
 // Forward declare a few things so they'll work.
+class audio_engine;
 class sound;
+class tone_synth_node;
+
+// A single tone as recorded by tone_synth. The synth keeps a list of these rather than a rendered buffer, so that the score can either be rendered through tonar for the wave writers or synthesized on the fly by a tone_synth_node.
+struct tone_synth_event {
+	int start; // In frames at the synth's sample rate.
+	int waveform; // tonar waveform.
+	double volume;
+	double pan;
+	int fade_start;
+	int fade_end;
+	double freq;
+	double bend_amount; // In HZ.
+	int length; // All remaining durations in milliseconds, exactly as passed to elz_tonar_sequence.
+	int bend_start;
+	int bend_length;
+};
 
 class tone_synth {
 public:
@@ -66,12 +84,16 @@ public:
 
 	sound* generate_sound();
 	bool generate_file(const std::string& filename);
+	tone_synth_node* create_node(audio_engine* engine);
 
 private:
 	int bgt_to_tonar_waveform(int type);
+	bool sequence(double freq, double bend_amount, int length, int bend_start, int bend_length);
+	bool render(el_tonar* output);
 
 	int refCount = 1;
-	el_tonar* gen = nullptr;
+	el_tonar* gen = nullptr; // Holds the synth parameters, cursor and length. Its sample buffer is only ever filled in the temporary generators created by render().
+	std::vector<tone_synth_event> events;
 };
 
 tone_synth *script_tone_synth_factory();
@@ -29,7 +29,11 @@
 	#include <Poco/Format.h>
 	#include <SDL3/SDL.h>
 #endif
+#include <cctype>
 #include <limits>
+#include <list>
+#include <thread>
+#include <vector>
 #include <miniaudio.h>
 #include <Poco/FileStream.h>
 // Normalize TTS.
@@ -48,13 +52,13 @@ static void tts_normalize(t *data, unsigned long size_in_samples) {
 	}
 }
 // Trim prenormalized TTS based on minimum threshholds in dB.
-// Size is in frames.
+// Size is in frames. Either end can be left untouched, which is how pieces of a streamed utterance keep the pauses between them.
 template <class t>
-t *tts_trim_internal(t *data, unsigned long *size_in_frames, int channels, float begin_db, float end_db) {
+t *tts_trim_internal(t *data, unsigned long *size_in_frames, int channels, float begin_db, float end_db, bool trim_begin = true, bool trim_end = true) {
 	// tts_normalize<t>(data, *size_in_frames * channels);
 	t min_begin_sample = std::ceil(ma_volume_db_to_linear(begin_db) * (double)std::numeric_limits<t>::max());
 	t min_end_sample = std::ceil(ma_volume_db_to_linear(end_db) * (double)std::numeric_limits<t>::max());
-	for (unsigned long i = 0; i < *size_in_frames; i++) {
+	for (unsigned long i = 0; trim_begin && i < *size_in_frames; i++) {
 		double mean = 0;
 		for (int c = 0; c < channels; c++)
 			mean += abs(data[(i * channels) + c]);
@@ -65,34 +69,29 @@ t *tts_trim_internal(t *data, unsigned long *size_in_frames, int channels, float
 			break;
 		}
 	}
-	for (unsigned long i = *size_in_frames - 1; i >= 0; i--) {
+	for (unsigned long i = *size_in_frames; trim_end && i-- > 0;) {
 		double mean = 0;
 		for (int c = 0; c < channels; c++)
 			mean += abs(data[(i * channels) + c]);
 		mean /= channels;
-		if (mean > 0) {
-		}
-
 		if (mean > min_end_sample) {
-			if (i < *size_in_frames - 1)
-				i++;
-			*size_in_frames -= (*size_in_frames - i);
+			*size_in_frames = i + 1;
 			break;
 		}
 	}
 	return data;
 }
-static char *tts_trim(char *data, unsigned long *size, int bps, int channels, float begin_db = -60, float end_db = -60) {
+static char *tts_trim(char *data, unsigned long *size, int bps, int channels, float begin_db = -60, float end_db = -60, bool trim_begin = true, bool trim_end = true) {
 	unsigned long size_in_frames;
 	switch (bps) {
 		case 16:
 			size_in_frames = *size / 2 / channels;
-			data = (char *)tts_trim_internal<int16_t>((int16_t *)data, &size_in_frames, channels, begin_db, end_db);
+			data = (char *)tts_trim_internal<int16_t>((int16_t *)data, &size_in_frames, channels, begin_db, end_db, trim_begin, trim_end);
 			*size = size_in_frames * 2 * channels;
 			return data;
 		case 8:
 			size_in_frames = *size / channels;
-			data = tts_trim_internal<char>(data, &size_in_frames, channels, begin_db, end_db);
+			data = tts_trim_internal<char>(data, &size_in_frames, channels, begin_db, end_db, trim_begin, trim_end);
 			*size = size_in_frames * channels;
 			return data;
 		default:
@@ -132,6 +131,42 @@ static char *minitrim(char *data, unsigned long *size, int bitrate, int channels
 	*size = (endIndex - startIndex + 1) * samplesPerFrame;
 	return data + startIndex * samplesPerFrame;
 }
+// Splits text into pieces that can be synthesized one after another so that playback can begin before the whole utterance has been rendered.
+// The first piece ends at the first sentence or clause boundary past first_min characters so that it renders quickly, following pieces end at sentence boundaries past rest_min characters to keep the number of synthesis calls down. Markup such as SSML is never split.
+static std::vector<std::string> tts_split_text(const std::string &text, size_t first_min = 24, size_t rest_min = 200) {
+	std::vector<std::string> chunks;
+	size_t first = text.find_first_not_of(" \t\r\n");
+	if (first == std::string::npos)
+		return chunks;
+	if (text[first] == '<') {
+		chunks.push_back(text);
+		return chunks;
+	}
+	size_t start = 0;
+	for (size_t i = 0; i < text.size(); i++) {
+		char c = text[i];
+		bool clause = c == ',' || c == ';' || c == ':';
+		if (!clause && c != '.' && c != '!' && c != '?' && c != '\n')
+			continue;
+		if (clause && !chunks.empty())
+			continue;
+		if (i + 1 < text.size() && !isspace((unsigned char)text[i + 1]))
+			continue; // Things like 3.5 or example.com.
+		if (i + 1 - start < (chunks.empty() ? first_min : rest_min))
+			continue;
+		chunks.push_back(text.substr(start, i + 1 - start));
+		start = i + 1;
+	}
+	if (text.find_first_not_of(" \t\r\n", start) != std::string::npos)
+		chunks.push_back(text.substr(start));
+	return chunks;
+}
+// The builtin synthesizer keeps a little global state for its noise source, and streamed speech calls it from worker threads too.
+static std::mutex g_builtin_synth_mtx;
+static char *tts_speech_gen(int *samples, const std::string &text) {
+	std::lock_guard<std::mutex> lock(g_builtin_synth_mtx);
+	return (char *)speech_gen(samples, text.c_str(), NULL);
+}
 bool tts_voice::schedule(soundptr &s, bool interrupt) {
 	try {
 		cleanup_completed_fades();
@@ -199,9 +234,11 @@ ma_result tts_voice::job_proc(ma_job *pJob) {
 	voice->queue.front()->play();
 	return MA_SUCCESS;
 }
+static void tts_join_stream_jobs(const tts_voice *owner, bool cancel);
 tts_voice::tts_voice(const std::string &builtin_voice_name) {
 	init_sound();
 	RefCount = 1;
+	streaming = false;
 	samprate = 0;
 	bitrate = 0;
 	channels = 0;
@@ -215,6 +252,7 @@ tts_voice::tts_voice(const std::string &builtin_voice_name) {
 }
 tts_voice::~tts_voice() {
 	// destroy();
+	tts_join_stream_jobs(this, true);
 }
 void tts_voice::setup() {
 	#ifdef _WIN32
@@ -304,6 +342,23 @@ bool tts_voice::speak(const std::string &text, bool interrupt) {
 		clear();
 		return true;
 	}
+	#ifdef _WIN32
+	if (voice_index != builtin_index && !inst && !refresh())
+		return false;
+	bool streamable = true;
+	#else
+	bool streamable = voice_index == builtin_index;
+	#endif
+	if (streaming && streamable) {
+		// Longer utterances are rendered a piece at a time so that speech starts as soon as the first sentence is ready.
+		std::vector<std::string> chunks = tts_split_text(text);
+		if (chunks.size() > 1) {
+			soundptr s(g_audio_engine->new_sound());
+			if (!stream_to_sound(s.get(), chunks))
+				return false;
+			return schedule(s, interrupt);
+		}
+	}
 	unsigned long bufsize;
 	char *data = NULL;
 	if (voice_index == builtin_index) {
@@ -339,7 +394,7 @@ bool tts_voice::speak(const std::string &text, bool interrupt) {
 	#endif
 	if (voice_index == builtin_index && !text.empty()) {
 		int samples;
-		data = (char *)speech_gen(&samples, text.c_str(), NULL);
+		data = tts_speech_gen(&samples, text);
 		bufsize = samples * 4;
 	}
 	if (!data)
@@ -379,7 +434,7 @@ std::string tts_voice::speak_to_memory(const std::string &text) {
 			channels = 2;
 		}
 		int samples;
-		data = (char *)speech_gen(&samples, text.c_str(), NULL);
+		data = tts_speech_gen(&samples, text);
 		bufsize = samples * 4;
 	}
 	#ifdef _WIN32
@@ -409,6 +464,169 @@ std::string tts_voice::speak_to_memory(const std::string &text) {
 		free(data);
 	return output;
 }
+static bool tts_render_builtin(const std::string &text, std::string &pcm, long &rate, short &bits, short &chans) {
+	int samples;
+	char *data = tts_speech_gen(&samples, text);
+	if (!data)
+		return false;
+	pcm.assign(data, samples * 4);
+	free(data);
+	rate = 48000;
+	bits = 16;
+	chans = 2;
+	return true;
+}
+#ifdef _WIN32
+static bool tts_render_sapi(blastspeak *sapi, const std::string &text, std::string &pcm, long &rate, short &bits, short &chans) {
+	unsigned long bufsize;
+	char *data = blastspeak_speak_to_memory(sapi, &bufsize, text.c_str());
+	if (!data)
+		return false;
+	pcm.assign(data, bufsize); // Blastspeak reuses this buffer on the next call.
+	rate = sapi->sample_rate;
+	bits = sapi->bits_per_sample;
+	chans = sapi->channels;
+	return true;
+}
+#endif
+bool tts_voice::synthesize(const std::string &text, std::string &pcm, long &rate, short &bits, short &chans) {
+	if (voice_index == builtin_index)
+		return tts_render_builtin(text, pcm, rate, bits, chans);
+	#ifdef _WIN32
+	return inst && tts_render_sapi(inst, text, pcm, rate, bits, chans);
+	#else
+	return false;
+	#endif
+}
+// The rest of a streamed utterance is rendered by a worker thread that never touches the tts_voice which started it. A SAPI worker creates a voice of its own on its own thread, with the same voice, rate and volume, so no COM object is ever shared between threads.
+// Workers are tracked here so that destroying a voice, or shutting down, can cancel and join them.
+struct tts_stream_job {
+	const tts_voice *owner = nullptr;
+	std::shared_ptr<pcm_stream> stream;
+	std::vector<std::string> chunks;
+	int sapi_voice = -1; // -1 for the builtin voice.
+	long sapi_rate = 0, sapi_volume = 0;
+	long rate = 0;
+	short bits = 0, chans = 0;
+	std::thread thread;
+	std::atomic<bool> finished {false};
+};
+static std::mutex g_tts_stream_jobs_mtx;
+static std::list<tts_stream_job> g_tts_stream_jobs;
+static void tts_stream_worker(tts_stream_job *job, std::string pcm) {
+	#ifdef _WIN32
+	blastspeak *sapi = nullptr;
+	if (job->sapi_voice >= 0) {
+		sapi = (blastspeak *)calloc(1, sizeof(blastspeak));
+		if (sapi && blastspeak_initialize(sapi)) {
+			blastspeak_set_voice(sapi, job->sapi_voice);
+			blastspeak_set_voice_rate(sapi, job->sapi_rate);
+			blastspeak_set_voice_volume(sapi, job->sapi_volume);
+		} else {
+			free(sapi);
+			sapi = nullptr;
+		}
+	}
+	#endif
+	unsigned int frame_size = (job->bits / 8) * job->chans;
+	bool ok = job->stream->write(pcm.data(), pcm.size() / frame_size);
+	for (size_t i = 1; ok && i < job->chunks.size() && !job->stream->is_cancelled(); i++) {
+		long r;
+		short b, c;
+		#ifdef _WIN32
+		bool rendered = job->sapi_voice < 0 ? tts_render_builtin(job->chunks[i], pcm, r, b, c) : sapi && tts_render_sapi(sapi, job->chunks[i], pcm, r, b, c);
+		#else
+		bool rendered = tts_render_builtin(job->chunks[i], pcm, r, b, c);
+		#endif
+		// End early rather than feed the stream audio in a different format, should the worker's voice not match the one that rendered the first piece.
+		if (!rendered || r != job->rate || b != job->bits || c != job->chans)
+			break;
+		unsigned long size = pcm.size();
+		char *ptr = tts_trim(&pcm[0], &size, job->bits, job->chans, -60, -60, false, i == job->chunks.size() - 1);
+		ok = job->stream->write(ptr, size / frame_size);
+	}
+	job->stream->finish();
+	#ifdef _WIN32
+	if (sapi) {
+		blastspeak_destroy(sapi);
+		free(sapi);
+	}
+	#endif
+	job->finished = true;
+}
+// Joins workers that have finished. If cancel is set, also cancels and joins every worker started by owner, or every worker at all if owner is null.
+static void tts_join_stream_jobs(const tts_voice *owner, bool cancel) {
+	std::list<tts_stream_job> joining;
+	{
+		std::lock_guard<std::mutex> lock(g_tts_stream_jobs_mtx);
+		for (auto it = g_tts_stream_jobs.begin(); it != g_tts_stream_jobs.end();) {
+			auto next = std::next(it);
+			if (it->finished || (cancel && (!owner || it->owner == owner)))
+				joining.splice(joining.end(), g_tts_stream_jobs, it);
+			it = next;
+		}
+	}
+	for (tts_stream_job &job : joining) {
+		if (!job.finished)
+			job.stream->cancel();
+		job.thread.join();
+	}
+}
+void tts_stop_streams() {
+	tts_join_stream_jobs(nullptr, true);
+}
+bool tts_voice::stream_to_sound(sound *s, std::vector<std::string> &chunks) {
+	std::string pcm;
+	long rate;
+	short bits, chans;
+	if (chunks.empty() || !synthesize(chunks[0], pcm, rate, bits, chans))
+		return false;
+	unsigned long size = pcm.size();
+	char *ptr = tts_trim(&pcm[0], &size, bits, chans, -60, -60, true, chunks.size() == 1);
+	pcm = std::string(ptr, size);
+	std::shared_ptr<pcm_stream> stream;
+	try {
+		stream = pcm_stream::create(bits == 16 ? ma_format_s16 : ma_format_u8, rate, chans, rate * 5);
+	} catch (std::exception &) {
+		return false;
+	}
+	if (!s->load_pcm_stream(stream))
+		return false;
+	tts_join_stream_jobs(nullptr, false);
+	std::lock_guard<std::mutex> lock(g_tts_stream_jobs_mtx);
+	tts_stream_job &job = g_tts_stream_jobs.emplace_back();
+	job.owner = this;
+	job.stream = stream;
+	job.chunks = std::move(chunks);
+	job.rate = rate;
+	job.bits = bits;
+	job.chans = chans;
+	#ifdef _WIN32
+	if (voice_index != builtin_index) {
+		job.sapi_voice = voice_index - (builtin_index + 1);
+		blastspeak_get_voice_rate(inst, &job.sapi_rate);
+		blastspeak_get_voice_volume(inst, &job.sapi_volume);
+	}
+	#endif
+	try {
+		job.thread = std::thread(tts_stream_worker, &job, std::move(pcm));
+	} catch (std::exception &) {
+		g_tts_stream_jobs.pop_back();
+		s->close();
+		return false;
+	}
+	return true;
+}
+sound *tts_voice::speak_to_sound_stream(const std::string &text) {
+	sound *s = g_audio_engine->new_sound();
+	#ifdef _WIN32
+	if (voice_index != builtin_index && !inst && !refresh())
+		return s;
+	#endif
+	std::vector<std::string> chunks = tts_split_text(text);
+	stream_to_sound(s, chunks); // Return the sound whether it fails or not, like speak_to_sound.
+	return s;
+}
 sound *tts_voice::speak_to_sound(const std::string &text) {
 	sound *s = g_audio_engine->new_sound();
 	std::string speech = speak_to_memory(text);
@@ -634,6 +852,8 @@ void RegisterTTSVoice(asIScriptEngine *engine) {
 	engine->RegisterObjectMethod("tts_voice", "bool speak_wait(const string &in text, bool interrupt = false)", asMETHOD(tts_voice, speak_wait), asCALL_THISCALL);
 	engine->RegisterObjectMethod("tts_voice", "string speak_to_memory(const string &in text)", asMETHOD(tts_voice, speak_to_memory), asCALL_THISCALL);
 	engine->RegisterObjectMethod("tts_voice", Poco::format("%s::sound@ speak_to_sound(const string &in text)", get_system_namespace("sound")).c_str(), asMETHOD(tts_voice, speak_to_sound), asCALL_THISCALL);
+	engine->RegisterObjectMethod("tts_voice", Poco::format("%s::sound@ speak_to_sound_stream(const string &in text)", get_system_namespace("sound")).c_str(), asMETHOD(tts_voice, speak_to_sound_stream), asCALL_THISCALL);
+	engine->RegisterObjectProperty("tts_voice", "bool streaming", asOFFSET(tts_voice, streaming));
 	engine->RegisterObjectMethod("tts_voice", "bool speak_interrupt_wait(const string &in text)", asMETHOD(tts_voice, speak_interrupt_wait), asCALL_THISCALL);
 	engine->RegisterObjectMethod("tts_voice", "bool refresh()", asMETHOD(tts_voice, refresh), asCALL_THISCALL);
 	engine->RegisterObjectMethod("tts_voice", "bool stop()", asMETHOD(tts_voice, stop), asCALL_THISCALL);
@@ -24,7 +24,9 @@
 	#include <jni.h>
 #endif
 #include <queue>
+#include <memory>
 #include <mutex>
+#include <vector>
 #include <atomic>
 class tts_voice {
 	int RefCount;
@@ -63,9 +65,14 @@ class tts_voice {
 	static void at_end(void *pUserData, ma_sound *pSound);
 	// This gets called from Miniaudio's job infrastructure to start the next sound when one finishes.
 	static ma_result job_proc(ma_job *pJob);
+	// Renders text to raw PCM on the memory based synthesizers (the builtin voice, and SAPI on Windows), returning its format.
+	bool synthesize(const std::string &text, std::string &pcm, long &rate, short &bits, short &chans);
+	// Renders the first chunk, loads a pcm_stream into s and hands the remaining chunks to a worker thread that feeds the stream as s plays.
+	bool stream_to_sound(sound *s, std::vector<std::string> &chunks);
 
 public:
 	int voice_index;
+	bool streaming; // Whether speak renders longer text a sentence at a time while it plays, off by default.
 	tts_voice(const std::string &builtin_voice_name = "builtin fallback voice");
 	~tts_voice();
 	void setup();
@@ -77,6 +84,7 @@ public:
 	std::string speak_to_memory(const std::string &text);
 	bool speak_wait(const std::string &text, bool interrupt = false);
 	sound *speak_to_sound(const std::string &text);
+	sound *speak_to_sound_stream(const std::string &text);
 
 	bool speak_interrupt(const std::string &text) {
 		return speak(text, true);
@@ -99,4 +107,6 @@ public:
 	bool stop();
 };
 
+// Cancels and joins every worker still rendering streamed speech, called at shutdown before the sound system goes away.
+void tts_stop_streams();
 void RegisterTTSVoice(asIScriptEngine *engine);